@@ -25,10 +25,23 @@
 
 #include "json.h"
 #include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if JSON_ZLIB == 1
+#include <zlib.h>
+#endif
+#if JSON_ZSTD == 1
+#include <zstd.h>
+#endif
+#if JSON_MMAP == 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 
 #define HAVE_TRACE 0
@@ -310,6 +323,10 @@ static void *marena_realloc_rt(marena_t *ma, void *ptr, size_t size)
     if (ma == NULL)
         goto exit;
 
+    // no block yet - allocate new one
+    if (ptr == NULL)
+        return marena_alloc_rt(ma, size);
+
     // add header size
     ROUNDUP(size);
     size += sizeof(marena_rt_hdr_t);
@@ -330,8 +347,8 @@ static void *marena_realloc_rt(marena_t *ma, void *ptr, size_t size)
     if (ret == NULL)
         goto exit;
 
-    // copy data to new block
-    memcpy(ret, ptr, curr->size);
+    // copy data to new block (block size includes header)
+    memcpy(ret, ptr, curr->size - sizeof(marena_rt_hdr_t));
 
     // free old block
     curr->mmc = 0;
@@ -357,6 +374,43 @@ static void marena_free_rt(marena_t *ma, void *ptr)
 }
 
 
+// Arena position (used for rollback of allocations).
+typedef struct {
+    marena_chunk_hdr_t *chunk; // current chunk
+    size_t allocated; // amount of allocated bytes in current chunk
+} marena_pos_t;
+
+// Get current arena position.
+static inline void marena_mark(marena_t *ma, marena_pos_t *pos)
+{
+    pos->chunk = ma->curr;
+    pos->allocated = ma->curr->allocated;
+}
+
+// Release all memory allocated after arena position.
+// Rollback is possible only if allocations were made inside one chunk.
+static bool marena_rollback(marena_t *ma, marena_pos_t *pos)
+{
+    if (ma->curr != pos->chunk)
+        return false;
+
+    // remove free blocks located inside of released memory
+    char *start = (char*)ma->curr + sizeof(marena_chunk_hdr_t);
+    char *lo = start + pos->allocated;
+    char *hi = start + ma->curr->allocated;
+    marena_rt_hdr_t **prev = &ma->free;
+    for (marena_rt_hdr_t *curr = *prev; curr; curr = curr->next) {
+        if (lo <= (char*)curr && (char*)curr < hi)
+            *prev = curr->next;
+        else
+            prev = &curr->next;
+    }
+
+    ma->curr->allocated = pos->allocated;
+    return true;
+}
+
+
 /*****************************************************************************
 * Json object attribute name table.
 *****************************************************************************/
@@ -369,7 +423,8 @@ typedef ushort ani_t;
 
 // Attribute names table object.
 typedef struct _ant_t {
-    marena_t *mem; // memory allocator
+    marena_t *mem; // memory allocator for tables
+    marena_t *smem; // memory allocator for names
 
     // array of attribute names
     const char **an; // attribute names
@@ -383,12 +438,13 @@ typedef struct _ant_t {
 } ant_t;
 
 // Create attribute names table object.
-static ant_t *ant_create(marena_t *mem)
+static ant_t *ant_create(marena_t *mem, marena_t *smem)
 {
     ant_t *ant = marena_alloc(mem, sizeof(*ant));
     if (ant == NULL)
         return NULL;
     ant->mem = mem;
+    ant->smem = smem;
 
     ant->an_cap = 16;
     ant->an = marena_alloc_rt(mem, ant->an_cap * sizeof(ant->an[0]));
@@ -444,27 +500,23 @@ static int ant_get(ant_t *ant, const char *name)
     return -1;
 }
 
-// Add new or search for existing token.
-static int ant_add_token(ant_t *ant, const char *start, uint len)
+// Add new or search for existing name.
+static int ant_add(ant_t *ant, const char *name, uint len)
 {
     uint i;
 
-    // copy name to buffer adding 0 at end
-    char name[256];
-    if (len >= sizeof(name)) {
-        ERROR("attribute name too long");
-        goto exit;
-    }
-    memcpy(name, start, len);
-    name[len] = 0;
-
     // check if attribute name is already present
     int index = ant_get(ant, name);
     if (index >= 0)
         return index;
 
+    if (ant->an_cnt >= ANI_MAX) {
+        ERROR("too many attribute names");
+        goto exit;
+    }
+
     // allocate memory for attribute name
-    char *p = marena_alloc(ant->mem, len + 1);
+    char *p = marena_alloc(ant->smem, len + 1);
     if (!p)
         goto exit;
     memcpy(p, name, len + 1);
@@ -505,6 +557,21 @@ exit:
     return -1;
 }
 
+// Add new or search for existing token.
+static int ant_add_token(ant_t *ant, const char *start, uint len)
+{
+    // copy name to buffer adding 0 at end
+    char name[256];
+    if (len >= sizeof(name)) {
+        ERROR("attribute name too long");
+        return -1;
+    }
+    memcpy(name, start, len);
+    name[len] = 0;
+
+    return ant_add(ant, name, len);
+}
+
 
 /*****************************************************************************
 * Hash table for mapping between attribute name index and node array index.
@@ -589,6 +656,26 @@ static int ht_get(ht_t *ht, ani_t k)
 // Initial capacity of dynamic arrays.
 #define JSON_CAP_MIN 8
 
+// Maximum length of string value that can be interned.
+#define JSON_INTERN_MAX 64
+
+// Maximum length of string value that is stored inside node.
+#define JSON_STR_INLINE 15
+
+// Initial size of window buffer for json read by parts.
+#define JSON_READ_BUF (64 * 1024)
+
+// Maximum count of attribute names kept between array elements.
+#define JSON_ITER_NAMES 16384
+
+// Iteration states.
+enum {
+    JI_NONE, // no iteration
+    JI_FIRST, // before first element
+    JI_NEXT, // before next element
+    JI_END // after array end
+};
+
 // Character types.
 enum {
     CNV, // invalid characters
@@ -639,6 +726,14 @@ typedef struct {
     uint pos; // position inside json string
 } jtok;
 
+// Node flags.
+enum {
+    NF_ARR = 0x01, // array node is of type jnode_arr_t
+    NF_EDIT = 0x02, // node is a temporary editable copy (see jn_patch())
+    NF_SHARED = 0x04, // node is used in several places (see JP_DEDUP)
+    NF_DECTXT = 0x08 // decimal value is given by text only
+};
+
 // Json object node.
 typedef struct _jnode_obj_t {
     jnode_t b; // inheritance from base type
@@ -647,25 +742,64 @@ typedef struct _jnode_obj_t {
         ani_t *anis; // array of attribute name indexes
         ht_t *ht; // ptr to hash table
     };
+    uint hash; // structural hash (0 - not calculated yet)
 } jnode_obj_t;
 
+// Json string node with string value stored inside.
+typedef struct _jnode_str_t {
+    jnode_t b; // inheritance from base type
+    char buf[JSON_STR_INLINE + 1]; // string value
+} jnode_str_t;
+
+// Json array node (used if arrays can be packed or shared).
+typedef struct _jnode_arr_t {
+    jnode_t b; // inheritance from base type
+    marena_t *mem; // memory for element nodes of packed array
+    int ndim; // number of dimensions of packed array (0 - not packed)
+    int shape[JSON_NDIM_MAX]; // sizes of dimensions of packed array
+    uint hash; // structural hash (0 - not calculated yet)
+} jnode_arr_t;
+
+// Table of unique nodes (used for sharing of equal subtrees).
+typedef struct _nt_t {
+    jnode_t **nodes; // hash table of nodes
+    uint cnt; // count of nodes
+    uint size; // size of hash table
+} nt_t;
+
+// State of parser memory at start of json node.
+typedef struct {
+    marena_pos_t pos; // node arena position
+    marena_pos_t spos; // string arena position
+    uint an_cnt; // count of attribute names
+    uint vs_cnt; // count of interned string values
+    uint nt_cnt; // count of unique nodes
+} jpmark;
+
 // Stack element of parser.
 typedef struct {
     jtok tokp; // previous token
     jctx ctx; // parsing context
     jnode_t *node; // current json node
     int node_cap; // capacity of all arrays for current node
+    jnode_arr_t row; // temporary node for array that can become matrix row
+    jpmark mark; // memory state at node start (if equal nodes are shared)
 } jpstk;
 
 // Json parser object.
 struct _jparser_t {
-    marena_t *mem; // memory allocator
+    marena_t *mem; // memory allocator for nodes and their arrays
+    marena_t *smem; // memory allocator for strings
+    marena_t *amem; // memory allocator for application data
+    int flags; // parser flags (JP_xxx)
 
     const char *start; // json string start
     uint len; // json string length
     uint pos; // current position in json string
 
     ant_t *ant; // attribute names table
+    ant_t *vst; // table of interned string values
+    nt_t *nt; // table of unique nodes
 
     jnode_t **root; // ptr to root node ptr
     jtok tokc; // current token
@@ -673,6 +807,18 @@ struct _jparser_t {
     uint sidx; // stack index
     jpstk *stack; // stack
     uint ssize; // stack size
+
+    // iteration over array elements
+    int iter; // iteration state (JI_xxx)
+    const char *end; // json string end
+    marena_t *nmem; // memory allocator for attribute names
+
+    // reading of json by parts
+    jp_read_t read; // read function (NULL - json is in memory)
+    void *rctx; // context of read function
+    char *buf; // window buffer
+    uint bsize; // size of window buffer
+    bool eof; // json end is reached
 };
 
 // Character type translation table.
@@ -689,16 +835,107 @@ static uchar ct[256] = {
 };
 
 // Forward declarations.
+static int jp_tables(jparser_t *jp);
+static int jp_value(jparser_t *jp, jnode_t **root, bool one);
+static inline void jp_next_more(jparser_t *jp);
 static jnode_t *jp_new_node(jparser_t *jp, jtype_t type);
-static int jp_add_elt(jparser_t *jp, jnode_t *n);
+static jnode_t *jp_new_row(jparser_t *jp);
+static int jp_add_elt(jparser_t *jp, jpstk *s, jnode_t *n);
+static int jp_add_num(jparser_t *jp, jtype_t type);
+static int jp_row_end(jparser_t *jp);
+static void jp_mark(jparser_t *jp, jpstk *s);
+static int jp_dedup(jparser_t *jp, jpstk *s, jnode_t *n, bool rollback);
 static int jp_add_attr(jparser_t *jp, ani_t index);
 static int jp_obj_end(jparser_t *jp);
 static void jp_next(jparser_t *jp);
+static uint jp_unescape(char *d, const char *s, uint ssize);
 static const char *jp_read_str(jparser_t *jp, int *len);
+static int jp_read_dec(jparser_t *jp, jnode_t *n);
+static const char *jp_read_txt(jparser_t *jp);
+static uint jn_hash_node(jnode_t *n);
+static bool jn_equal_node(jnode_t *a, jnode_t *b);
+static jnode_t *jn_elt_tmp(jnode_t *node, int i, jnode_arr_t *tmp);
+static double js_num(jnode_t *n);
 
 // Json node for returning absent values.
 static jnode_t none;
 
+// Get number of values in one element of packed array.
+static size_t jn_row_size(jnode_arr_t *node)
+{
+    size_t size = 1;
+    for (int i = 1; i < node->ndim; i++)
+        size *= (size_t)node->shape[i];
+    return size;
+}
+
+// Get size of packed array value.
+static inline size_t jn_val_size(jtype_t type)
+{
+#if JSON_DOUBLE == 1
+    if (type == JT_DBL)
+        return sizeof(double);
+#endif
+    (void)type;
+    return sizeof(int);
+}
+
+// Create element nodes for packed array node.
+// Elements of matrix are packed arrays sharing values with it.
+static int jn_unpack(marena_t *mem, jnode_arr_t *node, int cap)
+{
+    int cnt = node->b.elts.count;
+    jtype_t type = node->b.elts.packed;
+    jnode_t **values = marena_alloc_rt(mem, (size_t)cap * sizeof(values[0]));
+    if (values == NULL)
+        goto enomem;
+
+    if (node->ndim > 1) {
+        jnode_arr_t *rows = marena_alloc(mem, (size_t)cnt * sizeof(rows[0]));
+        if (rows == NULL)
+            goto enomem;
+        memset(rows, 0, (size_t)cnt * sizeof(rows[0]));
+
+        char *data = (char*)node->b.elts.ints;
+        size_t rs = jn_row_size(node) * jn_val_size(type);
+        for (int i = 0; i < cnt; i++) {
+            jnode_arr_t *r = rows + i;
+            r->b.type = JT_ARR;
+            r->b.flags = NF_ARR;
+            r->b.elts.packed = type;
+            r->b.elts.count = node->shape[1];
+            r->b.elts.ints = (int*)(void*)(data + (size_t)i * rs);
+            r->mem = mem;
+            r->ndim = node->ndim - 1;
+            memcpy(r->shape, node->shape + 1, (size_t)r->ndim * sizeof(int));
+            values[i] = &r->b;
+        }
+    } else {
+        jnode_t *nodes = marena_alloc(mem, (size_t)cnt * sizeof(nodes[0]));
+        if (nodes == NULL)
+            goto enomem;
+        memset(nodes, 0, (size_t)cnt * sizeof(nodes[0]));
+
+        for (int i = 0; i < cnt; i++) {
+            nodes[i].type = type;
+#if JSON_DOUBLE == 1
+            if (type == JT_DBL)
+                nodes[i].dbl_val = node->b.elts.dbls[i];
+            else
+#endif
+                nodes[i].int_val = node->b.elts.ints[i];
+            values[i] = nodes + i;
+        }
+    }
+
+    node->b.elts.values = values;
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    return -1;
+}
+
 /* Get node from array node by index.
  *
  * In:
@@ -715,603 +952,1699 @@ jnode_t *jn_elt(jnode_t *node, int i)
     if (!(0 <= i && i < node->elts.count))
         return &none;
 
+    // packed array gets element nodes on first access
+    if (node->elts.values == NULL) {
+        jnode_arr_t *narr = (jnode_arr_t*)node;
+        if (jn_unpack(narr->mem, narr, node->elts.count))
+            return &none;
+    }
+
     return node->elts.values[i];
 }
 
-/* Get node from object node by attribute name.
- * Attribute names are case sensitive.
- * Searching is done using hash tables.
+/* Get packed values of int array.
+ * Array is packed if parser flag JP_PACK is set and all array elements
+ * are of type JT_INT.
  *
  * In:
- *      node - json node of type JT_OBJ
- *      name - object attribute name
+ *      node - json node of type JT_ARR
  * Return:
- *      json node
+ *      ptr to array of values or NULL if array is not packed;
+ *      number of values is node->elts.count for plain array or
+ *      product of all dimensions for matrix (see jn_matrix())
  */
-jnode_t *jn_attr(jnode_t *node, const char *name)
+int *jn_ints(jnode_t *node)
 {
-    if (node->type != JT_OBJ)
-        return &none;
+    if (node->type != JT_ARR || node->elts.packed != JT_INT)
+        return NULL;
+
+    return node->elts.ints;
+}
+
+#if JSON_DOUBLE == 1
+/* Get packed values of double array.
+ * Array is packed if parser flag JP_PACK is set and all array elements
+ * are of type JT_DBL.
+ *
+ * In:
+ *      node - json node of type JT_ARR
+ * Return:
+ *      ptr to array of values or NULL if array is not packed;
+ *      number of values is node->elts.count for plain array or
+ *      product of all dimensions for matrix (see jn_matrix())
+ */
+double *jn_dbls(jnode_t *node)
+{
+    if (node->type != JT_ARR || node->elts.packed != JT_DBL)
+        return NULL;
+
+    return node->elts.dbls;
+}
+#endif
+
+/* Get dimensions of packed array.
+ * Matrix is an array of packed arrays (or matrices) of the same type
+ * and shape. It is created if parser flag JP_MATRIX is set.
+ * Values of matrix are stored in one buffer in row-major order.
+ *
+ * In:
+ *      node - json node of type JT_ARR
+ *      shape[out] - sizes of dimensions starting from outermost one
+ * Return:
+ *      number of dimensions (1 for plain packed array) or
+ *      0 if array is not packed
+ */
+int jn_matrix(jnode_t *node, int shape[JSON_NDIM_MAX])
+{
+    if (node->type != JT_ARR || node->elts.packed == JT_NONE)
+        return 0;
+
+    jnode_arr_t *narr = (jnode_arr_t*)node;
+    memcpy(shape, narr->shape, (size_t)narr->ndim * sizeof(shape[0]));
+    return narr->ndim;
+}
+
+// Get index of attribute of object node (-1 if there is none).
+static int jn_attr_idx(jnode_t *node, const char *name)
+{
+    if (node->attrs.count == 0)
+        return -1;
+
+    // editable copies have no hash tables
+    if (node->flags & NF_EDIT) {
+        for (int i = 0; i < node->attrs.count; i++)
+            if (0 == strcmp(node->attrs.names[i], name))
+                return i;
+        return -1;
+    }
 
     // get attribute name index
     jnode_obj_t *nobj = (jnode_obj_t*)node;
     int i = ant_get(nobj->ant, name);
     if (i < 0)
-        return &none;
+        return -1;
 
     // get array index
-    i = ht_get(nobj->ht, (ani_t)i);
-    if (i < 0)
-        return &none;
-
-    return node->attrs.values[i];
+    return ht_get(nobj->ht, (ani_t)i);
 }
 
-/* Create json parser object.
- * All memory is allocated here and during parsing there are no
- * calls to malloc() or free().
+/* Get node from object node by attribute name.
+ * Attribute names are case sensitive.
+ * Searching is done using hash tables.
  *
  * In:
- *      jp[out] - address of ptr to json parser object
- *      mem - amount of memory to be used for parsing;
- *            if 0, then default value is used
- *      stack - stack depth; this value controls maximum nesting in json;
- *              if 0 then default value is used
+ *      node - json node of type JT_OBJ
+ *      name - object attribute name
  * Return:
- *      0 - success
- *      !0 - error
+ *      json node
  */
-int jp_create(jparser_t **jp, size_t mem, size_t stack)
+jnode_t *jn_attr(jnode_t *node, const char *name)
 {
-    int ret = -1;
+    if (node->type != JT_OBJ)
+        return &none;
 
-    // adjust input values
-    if (mem < JSON_MEM_MIN)
-        mem = JSON_MEM_MIN;
-    if (stack < JSON_STACK_MIN)
-        stack = JSON_STACK_MIN;
+    int i = jn_attr_idx(node, name);
+    if (i < 0)
+        return &none;
 
-    // get memory for parser object
-    jparser_t *p = malloc(sizeof(*p));
-    if (!p)
-        goto enomem;
-    memset(p, 0, sizeof(*p));
+    return node->attrs.values[i];
+}
 
-    // get memory for stack
-    p->stack = malloc(stack * sizeof(p->stack[0]));
-    if (!p->stack)
-        goto enomem;
-    p->ssize = (uint)stack;
+// Mix hash value with another one.
+static inline uint jn_hmix(uint h, uint v)
+{
+    return h ^ (v + 0x9E3779B9u + (h << 6) + (h >> 2));
+}
 
-    // get memory for allocator
-    p->mem = marena_create(mem);
-    if (!p->mem)
-        goto enomem;
+// Calculate hash value of memory block.
+static inline uint jn_hmem(uint h, const void *p, size_t len)
+{
+    const uchar *s = p;
+    for (size_t i = 0; i < len; i++)
+        h = h * 7879 + (h >> 16) + s[i];
+    return h;
+}
 
-    *jp = p;
-    ret = 0;
+// Calculate hash value of int.
+static inline uint jn_hint(int v)
+{
+    return jn_hmix(JT_INT, (uint)v);
+}
 
-exit:
-    return ret;
+#if JSON_DOUBLE == 1
+// Calculate hash value of double.
+static inline uint jn_hdbl(double v)
+{
+    v += 0.0; // make negative zero positive
+    return jn_hmem(JT_DBL, &v, sizeof(v));
+}
+#endif
 
-enomem:
-    ERROR("no memory");
-    if (p) {
-        free(p->stack);
-        free(p);
-    }
-    goto exit;
+// Check if decimal value is given by text only.
+static inline bool jn_dec_txt(jnode_t *n)
+{
+    return (n->flags & NF_DECTXT);
 }
 
-/* Destroy json parser object and release all allocated memory.
- *
- * In:
- *      jp - ptr to json parser object
- */
-void jp_destroy(jparser_t *jp)
+// Remove trailing zeros from decimal mantissa.
+static inline void jn_dec_norm(int64_t *mant, int *exp)
 {
-    if (jp == NULL)
+    if (*mant == 0) {
+        *exp = 0;
         return;
+    }
+    while (*mant % 10 == 0) {
+        *mant /= 10;
+        (*exp)++;
+    }
+}
 
-    marena_destroy(jp->mem);
-    free(jp->stack);
-    free(jp);
+// Calculate hash value of packed array.
+// Result is the same as for array of separate nodes.
+static uint jn_hash_packed(jtype_t type, const void *data,
+    int ndim, const int *shape)
+{
+    size_t rs = 1;
+    for (int i = 1; i < ndim; i++)
+        rs *= (size_t)shape[i];
+    rs *= jn_val_size(type);
+
+    uint h = JT_ARR;
+    for (int i = 0; i < shape[0]; i++) {
+        uint eh;
+        if (ndim > 1)
+            eh = jn_hash_packed(type, (const char*)data + (size_t)i * rs,
+                ndim - 1, shape + 1);
+#if JSON_DOUBLE == 1
+        else if (type == JT_DBL)
+            eh = jn_hdbl(((const double*)data)[i]);
+#endif
+        else
+            eh = jn_hint(((const int*)data)[i]);
+        h = jn_hmix(h, eh);
+    }
+    return h;
 }
 
-/* Parse json string into a tree of 'jnode_t' structures.
- * These structures need not to be freed manually. They are freed
- * automatically then jp_parse() is called next time or
- * json parser object is destroyed.
- *
- * In:
- *      jp - ptr to json parser object
- *      root[out] - addres of ptr to root node
- *      json - ptr to json string
- *      len - length of json string
- *
- * Return:
- *      0 - success
- *      !0 - error
- */
-int jp_parse(jparser_t *jp, jnode_t **root, const char *json, size_t len)
+// Get cached structural hash of node (0 if there is none).
+static inline uint jn_hash_cached(jnode_t *n)
 {
-    jnode_t *n = NULL;
+    if (n->type == JT_OBJ)
+        return ((jnode_obj_t*)n)->hash;
+    if (n->type == JT_ARR && (n->flags & NF_ARR))
+        return ((jnode_arr_t*)n)->hash;
+    return 0;
+}
 
-    if (!marena_reset(jp->mem, JSON_MEM_MIN)) {
-        ERROR("no memory");
-        return -1;
+// Calculate structural hash of json node.
+// Hashes of arrays and objects are cached in nodes.
+static uint jn_hash_node(jnode_t *n)
+{
+    uint h = jn_hash_cached(n);
+    if (h)
+        return h;
+
+    if (n->type == JT_BOOL) {
+        return jn_hmix(JT_BOOL, n->bool_val);
+    } else if (n->type == JT_INT) {
+        return jn_hint(n->int_val);
+#if JSON_DOUBLE == 1
+    } else if (n->type == JT_DBL) {
+        return jn_hdbl(n->dbl_val);
+#endif
+    } else if (n->type == JT_DEC) {
+        if (jn_dec_txt(n))
+            return jn_hmem(JT_DEC, n->num_txt, strlen(n->num_txt));
+        int64_t m = n->dec_val.mant;
+        int exp = n->dec_val.exp;
+        jn_dec_norm(&m, &exp);
+        h = jn_hmem(JT_DEC, &m, sizeof(m));
+        return jn_hmix(h, (uint)exp);
+    } else if (n->type == JT_STR) {
+        return jn_hmem(JT_STR, n->str_val, (size_t)n->str_len);
+    } else if (n->type == JT_ARR) {
+        jnode_arr_t *narr = (jnode_arr_t*)n;
+        if (n->elts.packed != JT_NONE) {
+            h = jn_hash_packed(n->elts.packed, n->elts.ints,
+                narr->ndim, narr->shape);
+        } else {
+            h = JT_ARR;
+            for (int i = 0; i < n->elts.count; i++)
+                h = jn_hmix(h, jn_hash_node(n->elts.values[i]));
+        }
+        h += !h; // 0 means 'not calculated'
+        if (n->flags & NF_ARR)
+            narr->hash = h;
+        return h;
+    } else if (n->type == JT_OBJ) {
+        h = JT_OBJ;
+        for (int i = 0; i < n->attrs.count; i++) {
+            uint ah = jn_hmix(ant_hash(n->attrs.names[i]),
+                jn_hash_node(n->attrs.values[i]));
+            h = jn_hmix(h, ah);
+        }
+        h += !h; // 0 means 'not calculated'
+        ((jnode_obj_t*)n)->hash = h;
+        return h;
     }
 
-    jp->start = json;
-    jp->len = (uint)len;
-    jp->pos = 0;
+    return n->type;
+}
 
-    jp->ant = ant_create(jp->mem);
-    if (!jp->ant) {
-        ERROR("no memory");
-        return -1;
+// Get element of array node without making element nodes of packed
+// array: value or row of matrix is put to temporary node 'tmp'.
+static jnode_t *jn_elt_tmp(jnode_t *node, int i, jnode_arr_t *tmp)
+{
+    if (node->elts.values)
+        return node->elts.values[i];
+
+    jnode_arr_t *narr = (jnode_arr_t*)node;
+    jtype_t type = node->elts.packed;
+    memset(tmp, 0, sizeof(*tmp));
+    if (narr->ndim > 1) {
+        size_t rs = jn_row_size(narr) * jn_val_size(type);
+        tmp->b.type = JT_ARR;
+        tmp->b.flags = NF_ARR;
+        tmp->b.elts.packed = type;
+        tmp->b.elts.count = narr->shape[1];
+        tmp->b.elts.ints = (int*)(void*)((char*)node->elts.ints
+            + (size_t)i * rs);
+        tmp->mem = narr->mem;
+        tmp->ndim = narr->ndim - 1;
+        memcpy(tmp->shape, narr->shape + 1, (size_t)tmp->ndim * sizeof(int));
+    } else {
+        tmp->b.type = type;
+#if JSON_DOUBLE == 1
+        if (type == JT_DBL)
+            tmp->b.dbl_val = node->elts.dbls[i];
+        else
+#endif
+            tmp->b.int_val = node->elts.ints[i];
     }
+    return &tmp->b;
+}
 
-    *root = &none;
-    jp->root = root;
-
-    jp->tokc.type = JINSTART;
-    jp->tokc.pos = 0;
-    jp->tokc.len = 0;
-
-    jp->sidx = 0; // stack index
-    jpstk *s = jp->stack; // stack pointer
-    s->ctx = CTXVAL;
+// Compare array nodes for equality.
+static bool jn_equal_arr(jnode_t *a, jnode_t *b)
+{
+    if (a->elts.count != b->elts.count)
+        return false;
 
-    for (;;) {
-        s->tokp = jp->tokc;
-        jtt t = s->tokp.type;
-        jp_next(jp);
-        switch (jp->tokc.type) {
-        case JINEND:
-            if (s->ctx != CTXVAL)
-                return -1;
-            if (t == JINSTART)
-                return -1;
-            goto exit;
-        case JASTART:
-            n = jp_new_node(jp, JT_ARR);
-            if (n == NULL)
-                return -1;
-            if (++jp->sidx >= jp->ssize)
-                return -1;
-            s++;
-            s->node = n;
-            s->node_cap = JSON_CAP_MIN;
-            s->ctx = CTXARR;
-            break;
-        case JOSTART:
-            n = jp_new_node(jp, JT_OBJ);
-            if (n == NULL)
-                return -1;
-            if (++jp->sidx >= jp->ssize)
-                return -1;
-            s++;
-            s->node = n;
-            s->node_cap = JSON_CAP_MIN;
-            s->ctx = CTXOBJ;
-            break;
-        case JAEND:
-            if (s->ctx != CTXARR)
-                return -1;
-            if (t == JCOMMA)
-                return -1;
-            if (jp->sidx == 0)
-                return -1;
-            jp->sidx--;
-            s--;
-            break;
-        case JOEND:
-            if (s->ctx != CTXOBJ)
-                return -1;
-            if (t == JCOMMA || t == JNAME)
-                return -1;
-            if (jp_obj_end(jp))
-                return -1;
-            if (jp->sidx == 0)
-                return -1;
-            jp->sidx--;
-            s--;
-            break;
-        case JCOMMA:
-            if (s->ctx == CTXVAL) {
-                return -1;
-            } else if (s->ctx == CTXARR) {
-                if (t == JASTART)
-                    return -1;
-            } else {
-                if (t == JOSTART || t == JNAME)
-                    return -1;
-            }
-            break;
-        case JNULL:
-            n = jp_new_node(jp, JT_NULL);
-            if (n == NULL)
-                return -1;
-            break;
-        case JBOOL:
-            n = jp_new_node(jp, JT_BOOL);
-            if (n == NULL)
-                return -1;
-            break;
-        case JINT:
-            n = jp_new_node(jp, JT_INT);
-            if (n == NULL)
-                return -1;
-            break;
-        case JDBL:
+    // compare packed arrays of the same shape directly
+    jnode_arr_t *pa = (jnode_arr_t*)a;
+    jnode_arr_t *pb = (jnode_arr_t*)b;
+    if (a->elts.packed != JT_NONE && a->elts.packed == b->elts.packed
+            && pa->ndim == pb->ndim && 0 == memcmp(pa->shape, pb->shape,
+                (size_t)pa->ndim * sizeof(pa->shape[0]))) {
+        size_t cnt = jn_row_size(pa) * (size_t)a->elts.count;
 #if JSON_DOUBLE == 1
-            n = jp_new_node(jp, JT_DBL);
-            if (n == NULL)
-                return -1;
-            break;
-#else
-            return -1;
-#endif
-        case JSTR:
-            n = jp_new_node(jp, JT_STR);
-            if (n == NULL)
-                return -1;
-            break;
-        case JNAME:
-            if (s->ctx != CTXOBJ)
-                return -1;
-            if (t != JOSTART && t != JCOMMA)
-                return -1;
-            jtok *t = &jp->tokc;
-            int i = ant_add_token(jp->ant, jp->start + t->pos, t->len);
-            if (i < 0)
-                return -1;
-            if (jp_add_attr(jp, (ani_t)i))
-                return -1;
-            break;
-        default:
-            return -1;
+        if (a->elts.packed == JT_DBL) {
+            for (size_t i = 0; i < cnt; i++)
+                if (a->elts.dbls[i] != b->elts.dbls[i])
+                    return false;
+            return true;
         }
+#endif
+        return 0 == memcmp(a->elts.ints, b->elts.ints, cnt * sizeof(int));
     }
 
-exit:
-    TRACE("Total memory: %ld", jp->mem->size_total);
-    TRACE("Allocations count: %ld", jp->mem->alloc_count);
-    TRACE("Search count: %ld", jp->mem->search_count);
-    return 0;
+    // packed arrays are not unpacked: memory of node being parsed with
+    // JP_DEDUP may be rolled back after comparison
+    for (int i = 0; i < a->elts.count; i++) {
+        jnode_arr_t ta, tb;
+        if (!jn_equal_node(jn_elt_tmp(a, i, &ta), jn_elt_tmp(b, i, &tb)))
+            return false;
+    }
+    return true;
 }
 
-// Create new json node.
-static jnode_t *jp_new_node(jparser_t *jp, jtype_t type)
+// Compare object nodes for equality (attribute order is significant).
+static bool jn_equal_obj(jnode_t *a, jnode_t *b)
 {
-    uint ns = (type == JT_OBJ) ? sizeof(jnode_obj_t) : sizeof(jnode_t);
-    jnode_t *n = marena_alloc(jp->mem, ns);
-    if (n == NULL) {
-        ERROR("no memory");
-        return NULL;
+    if (a->attrs.count != b->attrs.count)
+        return false;
+
+    // names from the same table can be compared by pointers
+    ant_t *ant = ((jnode_obj_t*)a)->ant;
+    bool same = (ant && ant == ((jnode_obj_t*)b)->ant);
+    for (int i = 0; i < a->attrs.count; i++) {
+        const char *na = a->attrs.names[i];
+        const char *nb = b->attrs.names[i];
+        if (same ? na != nb : 0 != strcmp(na, nb))
+            return false;
+        if (!jn_equal_node(a->attrs.values[i], b->attrs.values[i]))
+            return false;
     }
-    memset(n, 0, ns);
-    n->type = type;
+    return true;
+}
 
-    // set node value
-    if (type == JT_BOOL) {
-        const char *p = jp->start + jp->tokc.pos;
-        n->bool_val = ((*p | 0x20) == 't');
-    } else if (type == JT_INT) {
-        n->int_val = atoi(jp->start + jp->tokc.pos);
+// Compare json nodes for equality.
+static bool jn_equal_node(jnode_t *a, jnode_t *b)
+{
+    if (a == b)
+        return true;
+    if (a->type != b->type)
+        return false;
+
+    // nodes with different hashes are not equal
+    uint ha = jn_hash_cached(a);
+    uint hb = jn_hash_cached(b);
+    if (ha && hb && ha != hb)
+        return false;
+
+    // numbers with original text are equal if texts are equal
+    if (a->num_txt && b->num_txt && (a->type == JT_INT
 #if JSON_DOUBLE == 1
-    } else if (type == JT_DBL) {
-        n->dbl_val = strtod(jp->start + jp->tokc.pos, NULL);
+            || a->type == JT_DBL
 #endif
-    } else if (type == JT_STR) {
-        n->str_val = jp_read_str(jp, &n->str_len);
-        if (n->str_val == NULL)
-            return NULL;
-    } else if (type == JT_ARR) {
-        size_t size = JSON_CAP_MIN * sizeof(n->elts.values[0]);
-        void *arr = marena_alloc_rt(jp->mem, size);
-        if (arr == NULL)
-            return NULL;
-        n->elts.values = arr;
-    } else if (type == JT_OBJ) {
-        jnode_obj_t *nobj = (jnode_obj_t*)n;
-        size_t size = JSON_CAP_MIN * sizeof(n->attrs.values[0]);
-        void *arr = marena_alloc_rt(jp->mem, size);
-        if (arr == NULL)
-            return NULL;
-        n->attrs.values = arr;
-        nobj->ant = jp->ant;
-        size = JSON_CAP_MIN * sizeof(nobj->anis[0]);
-        arr = marena_alloc_rt(jp->mem, size);
-        if (arr == NULL)
-            return NULL;
-        nobj->anis = arr;
-    }
+            || a->type == JT_DEC))
+        return (0 == strcmp(a->num_txt, b->num_txt));
 
-    // store new node to parent node or set it as a root node
-    jpstk *s = jp->stack + jp->sidx;
-    jtt t = s->tokp.type;
-    if (s->ctx == CTXVAL) {
-        if (t != JINSTART)
-            return NULL;
-        *jp->root = n;
-    } else if (s->ctx == CTXARR) {
-        if (t != JASTART && t != JCOMMA)
-            return NULL;
-        if (jp_add_elt(jp, n))
-            return NULL;
-    } else {
-        if (t != JNAME)
-            return NULL;
-        int i = s->node->attrs.count - 1;
-        s->node->attrs.values[i] = n;
+    if (a->type == JT_BOOL)
+        return (a->bool_val == b->bool_val);
+    if (a->type == JT_INT)
+        return (a->int_val == b->int_val);
+#if JSON_DOUBLE == 1
+    if (a->type == JT_DBL)
+        return (a->dbl_val == b->dbl_val);
+#endif
+    if (a->type == JT_DEC) {
+        if (jn_dec_txt(a) || jn_dec_txt(b))
+            return false;
+        int64_t ma = a->dec_val.mant, mb = b->dec_val.mant;
+        int ea = a->dec_val.exp, eb = b->dec_val.exp;
+        jn_dec_norm(&ma, &ea);
+        jn_dec_norm(&mb, &eb);
+        return (ma == mb && ea == eb);
     }
-
-    return n;
+    if (a->type == JT_STR)
+        return (a->str_len == b->str_len
+            && 0 == memcmp(a->str_val, b->str_val, (size_t)a->str_len));
+    if (a->type == JT_ARR)
+        return jn_equal_arr(a, b);
+    if (a->type == JT_OBJ)
+        return jn_equal_obj(a, b);
+    return true;
 }
 
-// Add node to current array node.
-static int jp_add_elt(jparser_t *jp, jnode_t *node)
+// Calculate structural hash of json node ignoring order of attributes.
+static uint jn_hash_unord(jnode_t *n)
 {
-    jpstk *s = jp->stack + jp->sidx;
-    jnode_t *n = s->node;
+    uint h;
+
+    if (n->type == JT_OBJ) {
+        // sum of attribute hashes does not depend on their order
+        h = 0;
+        for (int i = 0; i < n->attrs.count; i++)
+            h += jn_hmix(ant_hash(n->attrs.names[i]),
+                jn_hash_unord(n->attrs.values[i]));
+        h = jn_hmix(JT_OBJ, h);
+        return h + !h;
+    }
 
-    if (n->elts.count >= s->node_cap) {
-        s->node_cap *= 2;
-        size_t size = (size_t)s->node_cap * sizeof(n->elts.values[0]);
-        n->elts.values = marena_realloc_rt(jp->mem, n->elts.values, size);
-        if (!n->elts.values)
-            return -1;
+    if (n->type == JT_ARR && n->elts.packed == JT_NONE) {
+        h = JT_ARR;
+        for (int i = 0; i < n->elts.count; i++)
+            h = jn_hmix(h, jn_hash_unord(n->elts.values[i]));
+        return h + !h;
     }
 
-    n->elts.values[n->elts.count++] = node;
-    return 0;
+    return jn_hash_node(n);
 }
 
-// Add attribute name to current object node.
-static int jp_add_attr(jparser_t *jp, ani_t index)
+// Compare json nodes for equality ignoring order of attributes.
+static bool jn_equal_unord(jnode_t *a, jnode_t *b)
 {
-    jpstk *s = jp->stack + jp->sidx;
-    jnode_obj_t *n = (jnode_obj_t*)s->node;
+    if (a == b)
+        return true;
+    if (a->type != b->type)
+        return false;
 
-    if (n->b.attrs.count >= s->node_cap) {
-        s->node_cap *= 2;
+    if (a->type == JT_OBJ) {
+        if (a->attrs.count != b->attrs.count)
+            return false;
 
-        size_t size = (size_t)s->node_cap * sizeof(n->anis[0]);
-        n->anis = marena_realloc_rt(jp->mem, n->anis, size);
-        if (!n->anis)
-            return -1;
+        // names from the same table can be compared by pointers
+        ant_t *ant = ((jnode_obj_t*)a)->ant;
+        bool same = (ant && ant == ((jnode_obj_t*)b)->ant);
+        for (int i = 0; i < a->attrs.count; i++) {
+            const char *name = a->attrs.names[i];
+            int j = (same && name == b->attrs.names[i]) ?
+                i : jn_attr_idx(b, name);
+            if (j < 0)
+                return false;
+            if (!jn_equal_unord(a->attrs.values[i], b->attrs.values[j]))
+                return false;
+        }
+        return true;
+    }
 
-        size = (size_t)s->node_cap * sizeof(n->b.attrs.values[0]);
-        n->b.attrs.values = marena_realloc_rt(jp->mem, n->b.attrs.values, size);
-        if (!n->b.attrs.values)
-            return -1;
+    if (a->type == JT_ARR && a->elts.packed == JT_NONE
+            && b->elts.packed == JT_NONE) {
+        if (a->elts.count != b->elts.count)
+            return false;
+        for (int i = 0; i < a->elts.count; i++)
+            if (!jn_equal_unord(a->elts.values[i], b->elts.values[i]))
+                return false;
+        return true;
     }
 
-    n->anis[n->b.attrs.count] = index;
-    n->b.attrs.values[n->b.attrs.count++] = NULL;
-    return 0;
+    return jn_equal_node(a, b);
 }
 
-// Finish creation of object node.
-static int jp_obj_end(jparser_t *jp)
+/* Calculate structural hash of json node.
+ * Equal nodes (see jn_equal()) have equal hashes. Hashes of objects
+ * with significant order of attributes are cached in nodes, so next
+ * call for the same node or its parent is fast.
+ *
+ * In:
+ *      node - json node
+ *      flags - combination of JN_xxx values:
+ *          JN_UNORDERED - order of object attributes is not significant
+ * Return:
+ *      hash value
+ */
+unsigned int jn_hash(jnode_t *node, int flags)
 {
-    jpstk *s = jp->stack + jp->sidx;
-    jnode_obj_t *n = (jnode_obj_t*)s->node;
-    ani_t *anis = n->anis;
+    if (flags & JN_UNORDERED)
+        return jn_hash_unord(node);
+    return jn_hash_node(node);
+}
 
-    // allocate and fill array of attribute names
-    uint size = (uint)n->b.attrs.count * sizeof(n->b.attrs.names[0]);
-    n->b.attrs.names = marena_alloc(jp->mem, size);
-    if (!n->b.attrs.names)
-        return -1;
-    for (int i = 0; i < n->b.attrs.count; i++)
-        n->b.attrs.names[i] = jp->ant->an[anis[i]];
-
-    // allocate and fill hash table
-    n->ht = ht_create(jp->mem, n->b.attrs.count);
-    if (!n->ht)
-        return -1;
-    for (int i = 0; i < n->b.attrs.count; i++)
-        ht_set(n->ht, anis[i], i);
-
-    marena_free_rt(jp->mem, anis);
-    return 0;
+/* Compare json nodes for equality.
+ * Nodes can belong to different trees. Attribute names of nodes from
+ * the same tree are compared by pointers. Subtrees with different
+ * cached hashes (see jn_hash()) are found unequal without walking.
+ *
+ * In:
+ *      a, b - json nodes
+ *      flags - combination of JN_xxx values:
+ *          JN_UNORDERED - order of object attributes is not significant
+ * Return:
+ *      true if nodes are equal
+ */
+bool jn_equal(jnode_t *a, jnode_t *b, int flags)
+{
+    if (flags & JN_UNORDERED)
+        return jn_equal_unord(a, b);
+    return jn_equal_node(a, b);
 }
 
-// Compare ignoring case.
-static inline bool jp_cmpi(const uchar *s1, const char *s2)
+// Create table of unique nodes.
+static nt_t *nt_create(marena_t *mem)
 {
-    for (int i = 0; s2[i]; i++)
-        if ((s1[i] | 0x20) != (uchar)s2[i])
-            return false;
-    return true;
+    nt_t *nt = marena_alloc(mem, sizeof(*nt));
+    if (nt == NULL)
+        return NULL;
+
+    nt->cnt = 0;
+    nt->size = 64;
+    size_t size = nt->size * sizeof(nt->nodes[0]);
+    nt->nodes = marena_alloc_rt(mem, size);
+    if (nt->nodes == NULL)
+        return NULL;
+    memset(nt->nodes, 0, size);
+
+    return nt;
 }
 
-// Read next token from json stream.
-static void jp_next(jparser_t *jp)
+// Add new node or search for existing equal node.
+// Only arrays and objects with cached hashes can be added.
+static jnode_t *nt_add(nt_t *nt, marena_t *mem, jnode_t *n)
 {
-    const uchar *jsn = (const uchar*)jp->start;
-    const uint len = jp->len;
-    uint pos = jp->pos;
-    jtok *tok = &jp->tokc;
-    int t = CNV;
+    uint h = jn_hash_node(n);
+    uint mask = nt->size - 1;
+    uint i;
 
-    // skip spaces
-    for (; pos < len; pos++) {
-        t = ct[jsn[pos]];
-        if (t == CBL) // blank character
-            continue;
-        if (t == CSL) { // slash character
-            bool cf = false; // comment found flag
-            uint cl = 1; // comment length
-            if (pos+cl<len && jsn[pos+cl]=='/') { // one-line comment
-                for (cl++; ; cl++) {
-                    if (pos+cl >= len) {
-                        cl--;
-                        break;
-                    } else if (jsn[pos+cl]=='\n') {
-                        break;
-                    } else if (jsn[pos+cl]=='\r') {
-                        if (pos+cl+1<len && jsn[pos+cl+1]=='\n')
-                            cl++;
-                        break;
-                    }
-                }
-                cf = true;
-            } else if (pos+cl<len && jsn[pos+cl]=='*') { // multi-line comment
-                for (cl++; pos+cl < len; cl++) {
-                    if (jsn[pos+cl]=='*' && pos+cl+1<len && jsn[pos+cl+1]=='/') {
-                        cl++;
-                        cf = true;
-                        break;
-                    }
-                }
-            }
-            if (cf) {
-                pos += cl;
+    for (i = h & mask; nt->nodes[i]; i = (i + 1) & mask) {
+        jnode_t *e = nt->nodes[i];
+        if (jn_hash_cached(e) == h && jn_equal_node(e, n))
+            return e;
+    }
+
+    // grow hash table
+    if (2 * (nt->cnt + 1) > nt->size) {
+        jnode_t **old = nt->nodes;
+        uint old_size = nt->size;
+        nt->size *= 2;
+        mask = nt->size - 1;
+        size_t size = nt->size * sizeof(nt->nodes[0]);
+        nt->nodes = marena_alloc_rt(mem, size);
+        if (nt->nodes == NULL) {
+            ERROR("no memory");
+            return NULL;
+        }
+        memset(nt->nodes, 0, size);
+        for (uint j = 0; j < old_size; j++) { // do rehashing
+            if (old[j] == NULL)
                 continue;
-            }
+            uint k = jn_hash_cached(old[j]) & mask;
+            while (nt->nodes[k])
+                k = (k + 1) & mask;
+            nt->nodes[k] = old[j];
         }
-        break;
+        marena_free_rt(mem, old);
+        for (i = h & mask; nt->nodes[i]; i = (i + 1) & mask);
     }
 
-    // check for input end
-    if (pos >= len) {
-        tok->type = JINEND;
-        goto exit;
+    nt->nodes[i] = n;
+    nt->cnt++;
+    return n;
+}
+
+/* Create json parser object.
+ * All memory is allocated here and during parsing there are no
+ * calls to malloc() or free().
+ *
+ * In:
+ *      jp[out] - address of ptr to json parser object
+ *      mem - amount of memory to be used for parsing; nodes and strings
+ *            are kept in separate memory regions of this size each;
+ *            if 0, then default value is used
+ *      stack - stack depth; this value controls maximum nesting in json;
+ *              if 0 then default value is used
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jp_create(jparser_t **jp, size_t mem, size_t stack)
+{
+    int ret = -1;
+
+    // adjust input values
+    if (mem < JSON_MEM_MIN)
+        mem = JSON_MEM_MIN;
+    if (stack < JSON_STACK_MIN)
+        stack = JSON_STACK_MIN;
+
+    // get memory for parser object
+    jparser_t *p = malloc(sizeof(*p));
+    if (!p)
+        goto enomem;
+    memset(p, 0, sizeof(*p));
+
+    // get memory for stack
+    p->stack = malloc(stack * sizeof(p->stack[0]));
+    if (!p->stack)
+        goto enomem;
+    p->ssize = (uint)stack;
+
+    // get memory for allocator
+    p->mem = marena_create(mem);
+    if (!p->mem)
+        goto enomem;
+
+    // get memory for string allocator
+    p->smem = marena_create(mem);
+    if (!p->smem)
+        goto enomem;
+
+    // get memory for application data (see jp_arena())
+    p->amem = marena_create(JSON_MEM_MIN);
+    if (!p->amem)
+        goto enomem;
+
+    *jp = p;
+    ret = 0;
+
+exit:
+    return ret;
+
+enomem:
+    ERROR("no memory");
+    if (p) {
+        if (p->mem)
+            marena_destroy(p->mem);
+        if (p->smem)
+            marena_destroy(p->smem);
+        free(p->stack);
+        free(p);
     }
+    goto exit;
+}
 
-    // check for array start
-    if (t == CAS) {
-        tok->type = JASTART;
-        goto exit1;
+/* Destroy json parser object and release all allocated memory.
+ *
+ * In:
+ *      jp - ptr to json parser object
+ */
+void jp_destroy(jparser_t *jp)
+{
+    if (jp == NULL)
+        return;
+
+    marena_destroy(jp->mem);
+    marena_destroy(jp->smem);
+    marena_destroy(jp->amem);
+    if (jp->nmem)
+        marena_destroy(jp->nmem);
+    free(jp->buf);
+    free(jp->stack);
+    free(jp);
+}
+
+/* Set parser flags.
+ * Flags take effect on next call to jp_parse().
+ *
+ * In:
+ *      jp - ptr to json parser object
+ *      flags - combination of JP_xxx values:
+ *          JP_PACK - arrays consisting of numbers of the same type are
+ *                    stored as plain C arrays (see jn_ints(), jn_dbls());
+ *                    elts.values of such arrays stays NULL until
+ *                    jn_elt() is called
+ *          JP_MATRIX - arrays of packed arrays of the same type and size
+ *                      are stored as one packed array with multiple
+ *                      dimensions (see jn_matrix()); implies JP_PACK
+ *          JP_INTERN - string values up to 64 bytes long are stored
+ *                      only once per json; equal strings have equal
+ *                      str_val pointers and can be compared by them
+ *          JP_DEDUP - equal objects and arrays are stored only once and
+ *                     shared by all their occurrences; nodes of parsed
+ *                     tree must not be modified
+ *          JP_DECIMAL - numbers with fraction or exponent and integers
+ *                       out of int range are stored as exact decimals
+ *                       (JT_DEC); if mantissa does not fit into 64 bits,
+ *                       then mant and exp are 0 and number text is
+ *                       stored in num_txt
+ *          JP_RAWNUM - original text of every number is kept in num_txt;
+ *                      jw_node() writes such numbers as text; arrays of
+ *                      numbers are not packed
+ */
+void jp_set_flags(jparser_t *jp, int flags)
+{
+    if (jp == NULL)
+        return;
+
+    if (flags & JP_MATRIX)
+        flags |= JP_PACK;
+    jp->flags = flags;
+}
+
+/* Parse json string into a tree of 'jnode_t' structures.
+ * These structures need not to be freed manually. They are freed
+ * automatically then jp_parse() is called next time or
+ * json parser object is destroyed.
+ *
+ * In:
+ *      jp - ptr to json parser object
+ *      root[out] - addres of ptr to root node
+ *      json - ptr to json string
+ *      len - length of json string
+ *
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jp_parse(jparser_t *jp, jnode_t **root, const char *json, size_t len)
+{
+    if (!marena_reset(jp->mem, JSON_MEM_MIN)
+            || !marena_reset(jp->smem, JSON_MEM_MIN)
+            || !marena_reset(jp->amem, JSON_MEM_MIN)) {
+        ERROR("no memory");
+        return -1;
     }
 
-    // check for array end
-    if (t == CAE) {
-        tok->type = JAEND;
-        goto exit1;
+    jp->start = json;
+    jp->len = (uint)len;
+    jp->pos = 0;
+    jp->iter = JI_NONE;
+
+    jp->ant = ant_create(jp->mem, jp->smem);
+    if (!jp->ant) {
+        ERROR("no memory");
+        return -1;
     }
 
-    // check for object start
-    if (t == COS) {
-        tok->type = JOSTART;
-        goto exit1;
+    if (jp_tables(jp))
+        return -1;
+
+    jp->tokc.type = JINSTART;
+    jp->tokc.pos = 0;
+    jp->tokc.len = 0;
+    return jp_value(jp, root, false);
+}
+
+/* Parse json read by parts into a tree of 'jnode_t' structures.
+ * Json is read into window buffer of parser; parsed part of buffer is
+ * reused, so whole json is never kept in memory. Buffer grows only if
+ * a single token does not fit into it. Tree is valid until next call
+ * to jp_parse() like after jp_parse().
+ *
+ * In:
+ *      jp - ptr to json parser object
+ *      root[out] - address of ptr to root node
+ *      read - function reading next part of json
+ *      ctx - context of read function
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jp_parse_read(jparser_t *jp, jnode_t **root, jp_read_t read, void *ctx)
+{
+    if (jp->buf == NULL) {
+        // one more byte for terminator of numbers at buffer end
+        jp->buf = malloc(JSON_READ_BUF + 1);
+        if (jp->buf == NULL) {
+            ERROR("no memory");
+            return -1;
+        }
+        jp->bsize = JSON_READ_BUF;
     }
+    jp->buf[0] = 0;
+
+    jp->read = read;
+    jp->rctx = ctx;
+    jp->eof = false;
+    int res = jp_parse(jp, root, jp->buf, 0);
+    jp->read = NULL;
+    return res;
+}
 
-    // check for object end
-    if (t == COE) {
-        tok->type = JOEND;
-        goto exit1;
+// Read more json keeping not parsed part of buffer from position 'keep'.
+static int jp_fill(jparser_t *jp, uint keep)
+{
+    uint rest = jp->len - keep;
+    if (keep == 0 && rest == jp->bsize) {
+        // token is longer than buffer
+        if (jp->bsize > UINT_MAX / 2) {
+            ERROR("token is too long");
+            return -1;
+        }
+        char *p = realloc(jp->buf, jp->bsize * 2 + 1);
+        if (p == NULL) {
+            ERROR("no memory");
+            return -1;
+        }
+        jp->buf = p;
+        jp->bsize *= 2;
     }
 
-    // check for comma
-    if (t == CCM) {
-        tok->type = JCOMMA;
-        goto exit1;
+    memmove(jp->buf, jp->buf + keep, rest);
+    size_t n = jp->read(jp->rctx, jp->buf + rest, jp->bsize - rest);
+    if (n == (size_t)-1) {
+        ERROR("read error");
+        return -1;
     }
+    jp->eof = (n == 0);
+    jp->start = jp->buf;
+    jp->len = rest + (uint)n;
+    jp->pos = 0;
 
-    // check for number
-    if (t == CMN || t == CNM) {
-        tok->type = JINT;
-        tok->pos = pos++;
-        tok->len = 1;
-        for (; pos < len; pos++, tok->len++) {
-            t = ct[jsn[pos]];
-            if (t != CNM)
-                break;
+    // numbers are converted by atoi() and strtod()
+    jp->buf[jp->len] = 0;
+    return 0;
+}
+
+// Check if token reaches end of buffer, so it can continue after it.
+static inline bool jp_at_end(jparser_t *jp)
+{
+    if (jp->pos >= jp->len)
+        return true;
+    if (jp->tokc.type != JERROR)
+        return false;
+
+    // error is found at buffer end or comment is not closed
+    uint pos = jp->tokc.pos;
+    return pos >= jp->len || jp->start[pos] == '/';
+}
+
+// Get next token reading more json if token can continue after buffer.
+static inline void jp_next_more(jparser_t *jp)
+{
+    uint pos = jp->pos;
+    jp_next(jp);
+    while (jp->read && !jp->eof && jp_at_end(jp)) {
+        // blanks before token are not kept
+        while (pos < jp->len && ct[(uchar)jp->start[pos]] == CBL)
+            pos++;
+        if (jp_fill(jp, pos)) {
+            jp->tokc.type = JERROR;
+            return;
         }
-        if (pos < len) {
-            if (jsn[pos] == '.') {
-                tok->type = JDBL;
-                tok->len++;
-                if (++pos >= len)
-                    goto error;
-                t = ct[jsn[pos]];
-                if (t != CNM)
-                    goto error;
-                pos++;
-                tok->len++;
-                for (; pos < len; pos++, tok->len++) {
-                    t = ct[jsn[pos]];
-                    if (t != CNM)
-                        break;
-                }
-                if (pos >= len)
-                    goto exit;
-            }
-            if ((jsn[pos] | 0x20) == 'e') {
-                tok->type = JDBL;
-                tok->len++;
-                if (++pos >= len)
-                    goto error;
-                if (jsn[pos] == '-' || jsn[pos] == '+') {
-                    tok->len++;
-                    if (++pos >= len)
-                        goto error;
-                }
-                t = ct[jsn[pos]];
-                if (t != CNM)
-                    goto error;
-                tok->len++;
-                pos++;
-                for (; pos < len; pos++, tok->len++) {
-                    t = ct[jsn[pos]];
-                    if (t != CNM)
-                        break;
-                }
-            }
+        pos = 0;
+        jp_next(jp);
+    }
+}
+
+/* Start iteration over elements of json array.
+ * Elements are parsed one by one by jp_iter_next(), so memory is needed
+ * only for the biggest element, not for the whole array. String can be
+ * longer than 4 GB (for example, memory mapped file). It must not be
+ * changed until iteration is finished. Call of jp_parse() stops
+ * iteration.
+ *
+ * In:
+ *      jp - ptr to json parser object
+ *      json - ptr to json string with array
+ *      len - length of json string
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jp_iter_begin(jparser_t *jp, const char *json, size_t len)
+{
+    // attribute names are kept between elements
+    if (jp->nmem == NULL)
+        jp->nmem = marena_create(JSON_MEM_MIN);
+    if (jp->nmem == NULL || !marena_reset(jp->nmem, JSON_MEM_MIN))
+        goto enomem;
+    jp->ant = ant_create(jp->nmem, jp->nmem);
+    if (jp->ant == NULL)
+        goto enomem;
+
+    jp->iter = JI_NONE;
+    jp->start = json;
+    jp->end = json + len;
+    jp->len = (len > UINT_MAX) ? UINT_MAX : (uint)len;
+    jp->pos = 0;
+    jp_next(jp);
+    if (jp->tokc.type != JASTART) {
+        ERROR("json is not an array");
+        return -1;
+    }
+
+    jp->iter = JI_FIRST;
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    return -1;
+}
+
+/* Parse next element of json array.
+ * Tree of previous element is freed (memory of jp_arena() is kept).
+ *
+ * In:
+ *      jp - ptr to json parser object
+ *      elt[out] - address of ptr to element
+ * Return:
+ *      1 - element is parsed
+ *      0 - no more elements
+ *      -1 - error
+ */
+int jp_iter_next(jparser_t *jp, jnode_t **elt)
+{
+    *elt = &none;
+    if (jp->iter == JI_END)
+        return 0;
+    if (jp->iter == JI_NONE)
+        return -1;
+
+    // window of json string starts at current position
+    jp->start += jp->pos;
+    size_t len = (size_t)(jp->end - jp->start);
+    jp->len = (len > UINT_MAX) ? UINT_MAX : (uint)len;
+    jp->pos = 0;
+
+    // separator or end of array
+    jp_next(jp);
+    if (jp->tokc.type == JAEND) {
+        jp_next(jp);
+        if (jp->tokc.type != JINEND)
+            goto error;
+        jp->iter = JI_END;
+        return 0;
+    }
+    if (jp->iter == JI_FIRST)
+        jp->pos = 0;
+    else if (jp->tokc.type != JCOMMA)
+        goto error;
+
+    // too many different names are forgotten
+    if (jp->ant->an_cnt > JSON_ITER_NAMES) {
+        if (!marena_reset(jp->nmem, JSON_MEM_MIN)
+                || (jp->ant = ant_create(jp->nmem, jp->nmem)) == NULL)
+            goto enomem;
+    }
+
+    if (!marena_reset(jp->mem, JSON_MEM_MIN)
+            || !marena_reset(jp->smem, JSON_MEM_MIN)
+            || jp_tables(jp))
+        goto enomem;
+
+    jp->tokc.type = JINSTART;
+    if (jp_value(jp, elt, true))
+        goto error;
+    jp->iter = JI_NEXT;
+    return 1;
+
+enomem:
+    ERROR("no memory");
+    jp->iter = JI_NONE;
+    return -1;
+
+error:
+    ERROR("invalid array element");
+    jp->iter = JI_NONE;
+    return -1;
+}
+
+// Create tables of interned strings and unique nodes.
+static int jp_tables(jparser_t *jp)
+{
+    jp->vst = NULL;
+    if (jp->flags & JP_INTERN) {
+        jp->vst = ant_create(jp->mem, jp->smem);
+        if (!jp->vst) {
+            ERROR("no memory");
+            return -1;
         }
-        if (tok->type == JINT) { // check if value is in int range
-            if (tok->len > 10)
-                tok->type = JDBL;
-            else if (tok->len == 10) {
-                const char *val = jp->start + tok->pos;
-                const char *max = "2147483647";
-                if (*val == '-') {
-                    val++;
-                    max = "2147483648";
-                }
-                for (int i = 0; i < 10; i++)
-                    if (val[i] > max[i]) {
-                        tok->type = JDBL;
-                        break;
-                    }
-            }
+    }
+
+    jp->nt = NULL;
+    if (jp->flags & JP_DEDUP) {
+        jp->nt = nt_create(jp->mem);
+        if (!jp->nt) {
+            ERROR("no memory");
+            return -1;
         }
-        goto exit;
     }
 
-    // check for string or an object attribute name with quotes
-    if (t == CQT) {
-        int c = jsn[pos];
-        tok->type = JERROR;
-        tok->pos = ++pos;
-        tok->len = 0;
-        for (; pos < len; pos++, tok->len++) {
-            if (jsn[pos] == c && jsn[pos - 1] != '\\') {
-                tok->type = JSTR;
-                pos++;
-                break;
+    return 0;
+}
+
+// Parse json value starting after current token.
+// If 'one' is true, then parsing stops after the value.
+static int jp_value(jparser_t *jp, jnode_t **root, bool one)
+{
+    jnode_t *n = NULL;
+
+    *root = &none;
+    jp->root = root;
+
+    jp->sidx = 0; // stack index
+    jpstk *s = jp->stack; // stack pointer
+    s->ctx = CTXVAL;
+
+    for (;;) {
+        s->tokp = jp->tokc;
+        jtt t = s->tokp.type;
+        jp_next_more(jp);
+        switch (jp->tokc.type) {
+        case JINEND:
+            if (s->ctx != CTXVAL)
+                return -1;
+            if (t == JINSTART)
+                return -1;
+            goto exit;
+        case JASTART:
+            n = jp_new_node(jp, JT_ARR);
+            if (n == NULL)
+                return -1;
+            if (++jp->sidx >= jp->ssize)
+                return -1;
+            s++;
+            s->node = n;
+            s->node_cap = (jp->flags & JP_PACK) ? 0 : JSON_CAP_MIN;
+            s->ctx = CTXARR;
+            if (jp->nt)
+                jp_mark(jp, s);
+            break;
+        case JOSTART:
+            n = jp_new_node(jp, JT_OBJ);
+            if (n == NULL)
+                return -1;
+            if (++jp->sidx >= jp->ssize)
+                return -1;
+            s++;
+            s->node = n;
+            s->node_cap = JSON_CAP_MIN;
+            s->ctx = CTXOBJ;
+            if (jp->nt)
+                jp_mark(jp, s);
+            break;
+        case JAEND:
+            if (s->ctx != CTXARR)
+                return -1;
+            if (t == JCOMMA)
+                return -1;
+            if (jp->sidx == 0)
+                return -1;
+            if (s->node == &s->row.b) {
+                if (jp_row_end(jp))
+                    return -1;
+            } else if (jp->nt) {
+                if (jp_dedup(jp, s, s->node, true))
+                    return -1;
             }
-        }
-        for (; pos < len; pos++) {
-            t = ct[jsn[pos]];
-            if (t != CBL)
+            jp->sidx--;
+            s--;
+            break;
+        case JOEND:
+            if (s->ctx != CTXOBJ)
+                return -1;
+            if (t == JCOMMA || t == JNAME)
+                return -1;
+            if (jp_obj_end(jp))
+                return -1;
+            if (jp->sidx == 0)
+                return -1;
+            if (jp->nt && jp_dedup(jp, s, s->node, true))
+                return -1;
+            jp->sidx--;
+            s--;
+            break;
+        case JCOMMA:
+            if (s->ctx == CTXVAL) {
+                return -1;
+            } else if (s->ctx == CTXARR) {
+                if (t == JASTART)
+                    return -1;
+            } else {
+                if (t == JOSTART || t == JNAME)
+                    return -1;
+            }
+            break;
+        case JNULL:
+            n = jp_new_node(jp, JT_NULL);
+            if (n == NULL)
+                return -1;
+            break;
+        case JBOOL:
+            n = jp_new_node(jp, JT_BOOL);
+            if (n == NULL)
+                return -1;
+            break;
+        case JINT:
+            if (jp_add_num(jp, JT_INT))
+                return -1;
+            break;
+        case JDBL:
+            if (jp->flags & JP_DECIMAL) {
+                n = jp_new_node(jp, JT_DEC);
+                if (n == NULL)
+                    return -1;
                 break;
+            }
+#if JSON_DOUBLE == 1
+            if (jp_add_num(jp, JT_DBL))
+                return -1;
+            break;
+#else
+            return -1;
+#endif
+        case JSTR:
+            n = jp_new_node(jp, JT_STR);
+            if (n == NULL)
+                return -1;
+            break;
+        case JNAME:
+            if (s->ctx != CTXOBJ)
+                return -1;
+            if (t != JOSTART && t != JCOMMA)
+                return -1;
+            jtok *t = &jp->tokc;
+            int i = ant_add_token(jp->ant, jp->start + t->pos, t->len);
+            if (i < 0)
+                return -1;
+            if (jp_add_attr(jp, (ani_t)i))
+                return -1;
+            break;
+        default:
+            return -1;
         }
-        if (pos >= len)
+        if (one && jp->sidx == 0)
             goto exit;
-        if (t == CCL) {
-            tok->type = JNAME;
-            pos++;
-        }
-        goto exit;
     }
 
-    // check for 'null'
+exit:
+    TRACE("Total memory: %ld", jp->mem->size_total);
+    TRACE("String memory: %ld", jp->smem->size_total);
+    TRACE("Allocations count: %ld", jp->mem->alloc_count);
+    TRACE("Search count: %ld", jp->mem->search_count);
+    return 0;
+}
+
+// Create new json node.
+static jnode_t *jp_new_node(jparser_t *jp, jtype_t type)
+{
+    // array inside of array that can be a matrix
+    if (type == JT_ARR && (jp->flags & JP_MATRIX)) {
+        jpstk *s = jp->stack + jp->sidx;
+        jnode_arr_t *p = (jnode_arr_t*)s->node;
+        if (s->ctx == CTXARR && (p->ndim > 1
+                || (p->b.elts.count == 0 && p->b.elts.values == NULL)))
+            return jp_new_row(jp);
+    }
+
+    // short strings are stored inside node if they are not interned
+    bool inl = (type == JT_STR && jp->vst == NULL
+        && jp->tokc.len <= JSON_STR_INLINE);
+
+    bool ext = (type == JT_ARR && (jp->flags & (JP_PACK | JP_DEDUP)));
+
+    uint ns = sizeof(jnode_t);
+    if (type == JT_OBJ)
+        ns = sizeof(jnode_obj_t);
+    else if (ext)
+        ns = sizeof(jnode_arr_t);
+    else if (inl)
+        ns = sizeof(jnode_str_t);
+    jnode_t *n = marena_alloc(jp->mem, ns);
+    if (n == NULL) {
+        ERROR("no memory");
+        return NULL;
+    }
+    memset(n, 0, ns);
+    n->type = type;
+    if (ext) {
+        n->flags = NF_ARR;
+        ((jnode_arr_t*)n)->mem = jp->mem;
+    }
+
+    // set node value
+    if (type == JT_BOOL) {
+        const char *p = jp->start + jp->tokc.pos;
+        n->bool_val = ((*p | 0x20) == 't');
+    } else if (type == JT_INT) {
+        n->int_val = atoi(jp->start + jp->tokc.pos);
+#if JSON_DOUBLE == 1
+    } else if (type == JT_DBL) {
+        n->dbl_val = strtod(jp->start + jp->tokc.pos, NULL);
+#endif
+    } else if (type == JT_DEC) {
+        if (jp_read_dec(jp, n))
+            return NULL;
+    } else if (inl) {
+        jnode_str_t *nstr = (jnode_str_t*)n;
+        const char *s = jp->start + jp->tokc.pos;
+        n->str_len = (int)jp_unescape(nstr->buf, s, jp->tokc.len);
+        n->str_val = nstr->buf;
+    } else if (type == JT_STR) {
+        n->str_val = jp_read_str(jp, &n->str_len);
+        if (n->str_val == NULL)
+            return NULL;
+    } else if (type == JT_ARR && (jp->flags & JP_PACK)) {
+        // arrays are allocated on demand
+    } else if (type == JT_ARR) {
+        size_t size = JSON_CAP_MIN * sizeof(n->elts.values[0]);
+        void *arr = marena_alloc_rt(jp->mem, size);
+        if (arr == NULL)
+            return NULL;
+        n->elts.values = arr;
+    } else if (type == JT_OBJ) {
+        jnode_obj_t *nobj = (jnode_obj_t*)n;
+        size_t size = JSON_CAP_MIN * sizeof(n->attrs.values[0]);
+        void *arr = marena_alloc_rt(jp->mem, size);
+        if (arr == NULL)
+            return NULL;
+        n->attrs.values = arr;
+        nobj->ant = jp->ant;
+        size = JSON_CAP_MIN * sizeof(nobj->anis[0]);
+        arr = marena_alloc_rt(jp->mem, size);
+        if (arr == NULL)
+            return NULL;
+        nobj->anis = arr;
+    }
+
+    // keep original text of number
+    if ((jp->flags & JP_RAWNUM) && n->num_txt == NULL && (type == JT_INT
+#if JSON_DOUBLE == 1
+            || type == JT_DBL
+#endif
+            || type == JT_DEC)) {
+        n->num_txt = jp_read_txt(jp);
+        if (n->num_txt == NULL)
+            return NULL;
+    }
+
+    // store new node to parent node or set it as a root node
+    jpstk *s = jp->stack + jp->sidx;
+    jtt t = s->tokp.type;
+    if (s->ctx == CTXVAL) {
+        if (t != JINSTART)
+            return NULL;
+        *jp->root = n;
+    } else if (s->ctx == CTXARR) {
+        if (t != JASTART && t != JCOMMA)
+            return NULL;
+        if (jp_add_elt(jp, s, n))
+            return NULL;
+    } else {
+        if (t != JNAME)
+            return NULL;
+        int i = s->node->attrs.count - 1;
+        s->node->attrs.values[i] = n;
+    }
+
+    return n;
+}
+
+// Create temporary node for array that can become a row of matrix.
+// Node is stored in the parser stack until it is known whether
+// array is merged to matrix or not.
+static jnode_t *jp_new_row(jparser_t *jp)
+{
+    jpstk *s = jp->stack + jp->sidx;
+    jtt t = s->tokp.type;
+    if (t != JASTART && t != JCOMMA)
+        return NULL;
+    if (jp->sidx + 1 >= jp->ssize)
+        return NULL;
+
+    jnode_arr_t *n = &s[1].row;
+    memset(n, 0, sizeof(*n));
+    n->b.type = JT_ARR;
+    n->b.flags = NF_ARR;
+    n->mem = jp->mem;
+    return &n->b;
+}
+
+// Finish creation of array node that can become a row of matrix.
+static int jp_row_end(jparser_t *jp)
+{
+    jpstk *s = jp->stack + jp->sidx;
+    jnode_arr_t *row = &s->row;
+    jnode_arr_t *n = (jnode_arr_t*)s[-1].node;
+    jtype_t type = row->b.elts.packed;
+
+    // check if row fits into matrix
+    bool fit = (type != JT_NONE && row->ndim < JSON_NDIM_MAX);
+    if (fit && n->b.elts.count > 0) {
+        fit = (n->ndim == row->ndim + 1 && n->b.elts.packed == type
+            && 0 == memcmp(n->shape + 1, row->shape,
+                (size_t)row->ndim * sizeof(row->shape[0])));
+    }
+
+    // add row to matrix
+    if (fit) {
+        size_t rs = jn_row_size(n);
+        if (n->b.elts.count == 0) {
+            n->ndim = row->ndim + 1;
+            n->b.elts.packed = type;
+            memcpy(n->shape + 1, row->shape,
+                (size_t)row->ndim * sizeof(row->shape[0]));
+            rs = jn_row_size(n);
+        }
+        rs *= jn_val_size(type);
+
+        if (n->b.elts.count >= s[-1].node_cap) {
+            int cap = s[-1].node_cap ? s[-1].node_cap * 2 : JSON_CAP_MIN;
+            void *arr = marena_realloc_rt(jp->mem, n->b.elts.ints,
+                (size_t)cap * rs);
+            if (arr == NULL) {
+                ERROR("no memory");
+                return -1;
+            }
+            n->b.elts.ints = arr;
+            s[-1].node_cap = cap;
+        }
+
+        char *data = (char*)n->b.elts.ints;
+        memcpy(data + (size_t)n->b.elts.count * rs, row->b.elts.ints, rs);
+        n->shape[0] = ++n->b.elts.count;
+        marena_free_rt(jp->mem, row->b.elts.ints);
+        return 0;
+    }
+
+    // make row a separate node
+    jnode_arr_t *copy = marena_alloc(jp->mem, sizeof(*copy));
+    if (copy == NULL) {
+        ERROR("no memory");
+        return -1;
+    }
+    *copy = *row;
+    if (jp_add_elt(jp, s - 1, &copy->b))
+        return -1;
+
+    // parent array could be changed, so memory can not be released
+    if (jp->nt)
+        return jp_dedup(jp, s, &copy->b, false);
+    return 0;
+}
+
+// Remember memory state at start of object or array node.
+static void jp_mark(jparser_t *jp, jpstk *s)
+{
+    marena_mark(jp->mem, &s->mark.pos);
+    marena_mark(jp->smem, &s->mark.spos);
+    s->mark.an_cnt = jp->ant->an_cnt;
+    s->mark.vs_cnt = jp->vst ? jp->vst->an_cnt : 0;
+    s->mark.nt_cnt = jp->nt->cnt;
+}
+
+// Replace just completed object or array node with equal one, if any.
+// If possible, memory allocated after start of node is released.
+static int jp_dedup(jparser_t *jp, jpstk *s, jnode_t *n, bool rollback)
+{
+    jnode_t *e = nt_add(jp->nt, jp->mem, n);
+    if (e == NULL)
+        return -1;
+    if (e == n)
+        return 0;
+    e->flags |= NF_SHARED;
+
+    // replace node in parent node
+    jpstk *p = s - 1;
+    if (p->ctx == CTXVAL)
+        *jp->root = e;
+    else if (p->ctx == CTXARR)
+        p->node->elts.values[p->node->elts.count - 1] = e;
+    else
+        p->node->attrs.values[p->node->attrs.count - 1] = e;
+
+    if (!rollback)
+        return 0;
+
+    // free arrays allocated before start of node
+    if (n->type == JT_OBJ) {
+        marena_free_rt(jp->mem, n->attrs.values);
+    } else {
+        if (n->elts.values)
+            marena_free_rt(jp->mem, n->elts.values);
+        if (n->elts.packed != JT_NONE)
+            marena_free_rt(jp->mem, n->elts.ints);
+    }
+
+    // release memory if nothing else was allocated in it
+    if (s->mark.an_cnt == jp->ant->an_cnt
+            && s->mark.vs_cnt == (jp->vst ? jp->vst->an_cnt : 0)
+            && s->mark.nt_cnt == jp->nt->cnt) {
+        marena_rollback(jp->mem, &s->mark.pos);
+        marena_rollback(jp->smem, &s->mark.spos);
+    }
+    return 0;
+}
+
+// Add node to array node.
+static int jp_add_elt(jparser_t *jp, jpstk *s, jnode_t *node)
+{
+    jnode_t *n = s->node;
+
+    // packed array gets value of other type - make it ordinary array
+    if (n->elts.packed != JT_NONE) {
+        jnode_arr_t *narr = (jnode_arr_t*)n;
+        if (jn_unpack(jp->mem, narr, s->node_cap))
+            return -1;
+        if (narr->ndim == 1) // matrix keeps values for its rows
+            marena_free_rt(jp->mem, n->elts.ints);
+        n->elts.ints = NULL;
+        n->elts.packed = JT_NONE;
+        narr->ndim = 0;
+    }
+
+    if (n->elts.count >= s->node_cap) {
+        s->node_cap = s->node_cap ? s->node_cap * 2 : JSON_CAP_MIN;
+        size_t size = (size_t)s->node_cap * sizeof(n->elts.values[0]);
+        n->elts.values = marena_realloc_rt(jp->mem, n->elts.values, size);
+        if (!n->elts.values)
+            return -1;
+    }
+
+    n->elts.values[n->elts.count++] = node;
+    return 0;
+}
+
+// Add number to json tree.
+// If enabled, numbers of the same type are stored packed inside arrays.
+static int jp_add_num(jparser_t *jp, jtype_t type)
+{
+    jpstk *s = jp->stack + jp->sidx;
+    jnode_t *n = s->node;
+
+    // store number to separate node
+    if (!(jp->flags & JP_PACK) || (jp->flags & JP_RAWNUM) || s->ctx != CTXARR
+            || (n->elts.count > 0 && n->elts.packed != type)
+            || ((jnode_arr_t*)n)->ndim > 1)
+        return jp_new_node(jp, type) ? 0 : -1;
+
+    jtt t = s->tokp.type;
+    if (t != JASTART && t != JCOMMA)
+        return -1;
+
+    // grow packed array as needed
+    if (n->elts.count >= s->node_cap) {
+        s->node_cap = s->node_cap ? s->node_cap * 2 : JSON_CAP_MIN;
+        size_t size = (size_t)s->node_cap
+            * (type == JT_INT ? sizeof(int) : sizeof(double));
+        void *arr = marena_realloc_rt(jp->mem, n->elts.ints, size);
+        if (arr == NULL) {
+            ERROR("no memory");
+            return -1;
+        }
+        n->elts.ints = arr;
+    }
+
+    // store number
+    const char *p = jp->start + jp->tokc.pos;
+    n->elts.packed = type;
+#if JSON_DOUBLE == 1
+    if (type == JT_DBL)
+        n->elts.dbls[n->elts.count++] = strtod(p, NULL);
+    else
+#endif
+        n->elts.ints[n->elts.count++] = atoi(p);
+
+    jnode_arr_t *narr = (jnode_arr_t*)n;
+    narr->ndim = 1;
+    narr->shape[0] = n->elts.count;
+    return 0;
+}
+
+// Add attribute name to current object node.
+static int jp_add_attr(jparser_t *jp, ani_t index)
+{
+    jpstk *s = jp->stack + jp->sidx;
+    jnode_obj_t *n = (jnode_obj_t*)s->node;
+
+    if (n->b.attrs.count >= s->node_cap) {
+        s->node_cap *= 2;
+
+        size_t size = (size_t)s->node_cap * sizeof(n->anis[0]);
+        n->anis = marena_realloc_rt(jp->mem, n->anis, size);
+        if (!n->anis)
+            return -1;
+
+        size = (size_t)s->node_cap * sizeof(n->b.attrs.values[0]);
+        n->b.attrs.values = marena_realloc_rt(jp->mem, n->b.attrs.values, size);
+        if (!n->b.attrs.values)
+            return -1;
+    }
+
+    n->anis[n->b.attrs.count] = index;
+    n->b.attrs.values[n->b.attrs.count++] = NULL;
+    return 0;
+}
+
+// Finish creation of object node.
+static int jp_obj_end(jparser_t *jp)
+{
+    jpstk *s = jp->stack + jp->sidx;
+    jnode_obj_t *n = (jnode_obj_t*)s->node;
+    ani_t *anis = n->anis;
+
+    // allocate and fill array of attribute names
+    uint size = (uint)n->b.attrs.count * sizeof(n->b.attrs.names[0]);
+    n->b.attrs.names = marena_alloc(jp->mem, size);
+    if (!n->b.attrs.names)
+        return -1;
+    for (int i = 0; i < n->b.attrs.count; i++)
+        n->b.attrs.names[i] = jp->ant->an[anis[i]];
+
+    // allocate and fill hash table
+    n->ht = ht_create(jp->mem, n->b.attrs.count);
+    if (!n->ht)
+        return -1;
+    for (int i = 0; i < n->b.attrs.count; i++)
+        ht_set(n->ht, anis[i], i);
+
+    marena_free_rt(jp->mem, anis);
+    return 0;
+}
+
+// Compare ignoring case.
+static inline bool jp_cmpi(const uchar *s1, const char *s2)
+{
+    for (int i = 0; s2[i]; i++)
+        if ((s1[i] | 0x20) != (uchar)s2[i])
+            return false;
+    return true;
+}
+
+// Read next token from json stream.
+static void jp_next(jparser_t *jp)
+{
+    const uchar *jsn = (const uchar*)jp->start;
+    const uint len = jp->len;
+    uint pos = jp->pos;
+    jtok *tok = &jp->tokc;
+    int t = CNV;
+
+    // skip spaces
+    for (; pos < len; pos++) {
+        t = ct[jsn[pos]];
+        if (t == CBL) // blank character
+            continue;
+        if (t == CSL) { // slash character
+            bool cf = false; // comment found flag
+            uint cl = 1; // comment length
+            if (pos+cl<len && jsn[pos+cl]=='/') { // one-line comment
+                for (cl++; ; cl++) {
+                    if (pos+cl >= len) {
+                        cl--;
+                        break;
+                    } else if (jsn[pos+cl]=='\n') {
+                        break;
+                    } else if (jsn[pos+cl]=='\r') {
+                        if (pos+cl+1<len && jsn[pos+cl+1]=='\n')
+                            cl++;
+                        break;
+                    }
+                }
+                cf = true;
+            } else if (pos+cl<len && jsn[pos+cl]=='*') { // multi-line comment
+                for (cl++; pos+cl < len; cl++) {
+                    if (jsn[pos+cl]=='*' && pos+cl+1<len && jsn[pos+cl+1]=='/') {
+                        cl++;
+                        cf = true;
+                        break;
+                    }
+                }
+            }
+            if (cf) {
+                pos += cl;
+                continue;
+            }
+        }
+        break;
+    }
+
+    // check for input end
+    if (pos >= len) {
+        tok->type = JINEND;
+        goto exit;
+    }
+
+    // check for array start
+    if (t == CAS) {
+        tok->type = JASTART;
+        goto exit1;
+    }
+
+    // check for array end
+    if (t == CAE) {
+        tok->type = JAEND;
+        goto exit1;
+    }
+
+    // check for object start
+    if (t == COS) {
+        tok->type = JOSTART;
+        goto exit1;
+    }
+
+    // check for object end
+    if (t == COE) {
+        tok->type = JOEND;
+        goto exit1;
+    }
+
+    // check for comma
+    if (t == CCM) {
+        tok->type = JCOMMA;
+        goto exit1;
+    }
+
+    // check for number
+    if (t == CMN || t == CNM) {
+        tok->type = JINT;
+        tok->pos = pos++;
+        tok->len = 1;
+        for (; pos < len; pos++, tok->len++) {
+            t = ct[jsn[pos]];
+            if (t != CNM)
+                break;
+        }
+        if (pos < len) {
+            if (jsn[pos] == '.') {
+                tok->type = JDBL;
+                tok->len++;
+                if (++pos >= len)
+                    goto error;
+                t = ct[jsn[pos]];
+                if (t != CNM)
+                    goto error;
+                pos++;
+                tok->len++;
+                for (; pos < len; pos++, tok->len++) {
+                    t = ct[jsn[pos]];
+                    if (t != CNM)
+                        break;
+                }
+                if (pos >= len)
+                    goto exit;
+            }
+            if ((jsn[pos] | 0x20) == 'e') {
+                tok->type = JDBL;
+                tok->len++;
+                if (++pos >= len)
+                    goto error;
+                if (jsn[pos] == '-' || jsn[pos] == '+') {
+                    tok->len++;
+                    if (++pos >= len)
+                        goto error;
+                }
+                t = ct[jsn[pos]];
+                if (t != CNM)
+                    goto error;
+                tok->len++;
+                pos++;
+                for (; pos < len; pos++, tok->len++) {
+                    t = ct[jsn[pos]];
+                    if (t != CNM)
+                        break;
+                }
+            }
+        }
+        if (tok->type == JINT) { // check if value is in int range
+            if (tok->len > 10)
+                tok->type = JDBL;
+            else if (tok->len == 10) {
+                const char *val = jp->start + tok->pos;
+                const char *max = "2147483647";
+                if (*val == '-') {
+                    val++;
+                    max = "2147483648";
+                }
+                for (int i = 0; i < 10; i++)
+                    if (val[i] > max[i]) {
+                        tok->type = JDBL;
+                        break;
+                    }
+            }
+        }
+        goto exit;
+    }
+
+    // check for string or an object attribute name with quotes
+    if (t == CQT) {
+        int c = jsn[pos];
+        tok->type = JERROR;
+        tok->pos = ++pos;
+        tok->len = 0;
+        for (; pos < len; pos++, tok->len++) {
+            if (jsn[pos] == c && jsn[pos - 1] != '\\') {
+                tok->type = JSTR;
+                pos++;
+                break;
+            }
+        }
+        for (; pos < len; pos++) {
+            t = ct[jsn[pos]];
+            if (t != CBL)
+                break;
+        }
+        if (pos >= len)
+            goto exit;
+        if (t == CCL) {
+            tok->type = JNAME;
+            pos++;
+        }
+        goto exit;
+    }
+
+    // check for 'null'
     if ((t == CLT) && (pos + 4 <= len) && jp_cmpi(jsn + pos, "null")) {
         tok->type = JNULL;
         tok->pos = pos;
@@ -1320,630 +2653,5497 @@ static void jp_next(jparser_t *jp)
         goto exit;
     }
 
-    // check for 'true'
-    if ((t == CLT) && (pos + 4 <= len) && jp_cmpi(jsn + pos, "true")) {
-        tok->type = JBOOL;
-        tok->pos = pos;
-        tok->len = 4;
-        pos += 4;
-        goto exit;
+    // check for 'true'
+    if ((t == CLT) && (pos + 4 <= len) && jp_cmpi(jsn + pos, "true")) {
+        tok->type = JBOOL;
+        tok->pos = pos;
+        tok->len = 4;
+        pos += 4;
+        goto exit;
+    }
+
+    // check for 'false'
+    if ((t == CLT) && (pos + 5 <= len) && jp_cmpi(jsn + pos, "false")) {
+        tok->type = JBOOL;
+        tok->pos = pos;
+        tok->len = 5;
+        pos += 5;
+        goto exit;
+    }
+
+    // check for object attribute name without quotes
+    if (t == CLT) {
+        tok->type = JNAME;
+        tok->pos = pos++;
+        tok->len = 1;
+        for (; pos < len; pos++) {
+            t = ct[jsn[pos]];
+            if (t != CLT && t != CNM)
+                break;
+            tok->len++;
+        }
+        for (; pos < len; pos++) {
+            t = ct[jsn[pos]];
+            if (t != CBL)
+                break;
+        }
+        if (pos >= len)
+            goto error;
+        if (t != CCL)
+            goto error;
+        goto exit1;
+    }
+
+    // if none of the above than error
+    goto error;
+
+exit1:
+    pos++;
+exit:
+    jp->pos = pos;
+    return;
+
+error:
+    tok->type = JERROR;
+    tok->pos = pos; // position where error is found
+    return;
+}
+
+// Unescape json string.
+// Destination buffer must have size of at least 'ssize + 1' bytes.
+static uint jp_unescape(char *d, const char *s, uint ssize)
+{
+    uint si, di;
+    for (si = di = 0; si < ssize; si++) {
+        // check for escape character
+        char c = s[si];
+        if (c != '\\' || si + 1 >= ssize) {
+            d[di++] = c;
+            continue;
+        }
+
+        // do unescaping
+        c = s[++si];
+        if (c == '"')
+            d[di++] = '"';
+        else if (c == '\\')
+            d[di++] = '\\';
+        else if (c == '/')
+            d[di++] = '/';
+        else if (c == 'b')
+            d[di++] = '\b';
+        else if (c == 'f')
+            d[di++] = '\f';
+        else if (c == 'n')
+            d[di++] = '\n';
+        else if (c == 'r')
+            d[di++] = '\r';
+        else if (c == 't')
+            d[di++] = '\t';
+        else {
+            d[di++] = '\\';
+            d[di++] = c;
+        }
+    }
+
+    d[di] = 0;
+    return di;
+}
+
+// Copy string from json to C.
+static const char *jp_read_str(jparser_t *jp, int *len)
+{
+    uint ssize = jp->tokc.len; // src string size
+    const char *s = jp->start + jp->tokc.pos; // src string
+
+    // search for equal string in table of interned strings
+    if (jp->vst && ssize <= JSON_INTERN_MAX && jp->vst->an_cnt < ANI_MAX) {
+        char buf[JSON_INTERN_MAX + 1];
+        uint bl = jp_unescape(buf, s, ssize);
+        int i = ant_add(jp->vst, buf, bl);
+        if (i < 0)
+            return NULL;
+        *len = (int)bl;
+        return jp->vst->an[i];
+    }
+
+    // unescaped string is never longer than escaped one
+    char *d = marena_alloc(jp->smem, ssize + 1); // dst string
+    if (d == NULL)
+        return NULL;
+    *len = (int)jp_unescape(d, s, ssize);
+    return d;
+}
+
+
+// Convert number token to decimal value.
+static int jp_read_dec(jparser_t *jp, jnode_t *n)
+{
+    const char *s = jp->start + jp->tokc.pos;
+    const char *p = s;
+    const char *e = s + jp->tokc.len;
+    uint64_t m = 0;
+    int exp = 0;
+
+    bool neg = (p < e && *p == '-');
+    if (neg)
+        p++;
+
+    // mantissa digits (exponent is decreased for fraction digits)
+    for (bool frac = false; p < e; p++) {
+        if (*p == '.') {
+            frac = true;
+            continue;
+        }
+        if (ct[(uchar)*p] != CNM)
+            break;
+        uint d = (uint)(*p - '0');
+        if (m > ((uint64_t)INT64_MAX - d) / 10)
+            goto overflow;
+        m = m * 10 + d;
+        exp -= frac;
+    }
+
+    // exponent
+    if (p < e) {
+        bool eneg = (*++p == '-');
+        if (*p == '-' || *p == '+')
+            p++;
+        int x = 0;
+        for (; p < e; p++) {
+            x = x * 10 + (*p - '0');
+            if (x > 100000)
+                goto overflow;
+        }
+        exp += eneg ? -x : x;
+    }
+
+    n->dec_val.mant = neg ? -(int64_t)m : (int64_t)m;
+    n->dec_val.exp = exp;
+    return 0;
+
+overflow:
+    n->dec_val.mant = 0;
+    n->dec_val.exp = 0;
+    n->flags |= NF_DECTXT;
+    n->num_txt = jp_read_txt(jp);
+    return n->num_txt ? 0 : -1;
+}
+
+// Copy token text from json to C.
+static const char *jp_read_txt(jparser_t *jp)
+{
+    char *txt = marena_alloc(jp->smem, jp->tokc.len + 1);
+    if (txt == NULL) {
+        ERROR("no memory");
+        return NULL;
+    }
+    memcpy(txt, jp->start + jp->tokc.pos, jp->tokc.len);
+    txt[jp->tokc.len] = 0;
+    return txt;
+}
+
+
+/*****************************************************************************
+* Json writer data and functions.
+*****************************************************************************/
+
+// Stack element of json writer.
+typedef struct {
+    jctx ctx; // parsing context
+    jtt tt; // current token type
+    uint pp; // pretty-print flag
+} jwstk;
+
+// Json writer object.
+struct _jwriter_t {
+    char *start; // json string start
+    uint len; // json string length
+    uint pos; // current position in json string
+    int err; // error flag
+
+    jwstk *stack; // stack
+    uint ssize; // stack size
+    uint sidx; // stack index
+
+    uint ppd; // pretty-print depth
+    uint ppm; // pretty-print margin size (in spaces)
+};
+
+// Write zero-terminated string to json buffer.
+static void jw_strz(jwriter_t *jw, const char *str)
+{
+    for (;;) {
+        char c = *str++;
+        if (c == 0)
+            break;
+        if (jw->pos >= jw->len - 1) {
+            jw->len *= 2;
+            jw->start = realloc(jw->start, jw->len);
+        }
+        jw->start[jw->pos++] = c;
+    }
+}
+
+// Write zero-terminated string to json buffer using format string.
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+static void jw_printf(jwriter_t *jw, const char *fmt, ...)
+{
+    va_list v;
+    va_start(v, fmt);
+
+    while (!jw->err) {
+        bool grow = false;
+        char *buf = jw->start + jw->pos;
+        size_t size = jw->len - jw->pos - 1;
+        int res = vsnprintf(buf, size, fmt, v);
+        if (res < 0) {
+            if (errno == ERANGE) {
+                grow = true;
+            } else {
+                ERROR("vsnprintf() error %d '%s'", errno, strerror(errno));
+                jw->err = 1;
+            }
+        } else {
+            if ((size_t)res > size) {
+                grow = true;
+            } else {
+                jw->pos += (uint)res;
+                break;
+            }
+        }
+        if (grow) {
+            jw->len *= 2;
+            jw->start = realloc(jw->start, jw->len);
+        }
+    }
+
+    va_end(v);
+}
+#pragma GCC diagnostic warning "-Wformat-nonliteral"
+
+// Write margin to json buffer.
+static void jw_margin(jwriter_t *jw)
+{
+    jwstk *s = jw->stack + jw->sidx;
+    if (!s->pp)
+        return;
+
+    if (jw->pos >= jw->len - 1) {
+        jw->len *= 2;
+        jw->start = realloc(jw->start, jw->len);
+    }
+    jw->start[jw->pos++] = '\n';
+
+    for (uint i=0; i < jw->sidx; i++) {
+        for (uint j=0; j < jw->ppm; j++) {
+            if (jw->pos >= jw->len - 1) {
+                jw->len *= 2;
+                jw->start = realloc(jw->start, jw->len);
+            }
+            jw->start[jw->pos++] = ' ';
+        }
+    }
+}
+
+// Prepare for writing a value to json string.
+static int jw_prepv(jwriter_t *jw, const char *name)
+{
+    if (!jw || jw->err)
+        return -1;
+
+    jwstk *s = jw->stack + jw->sidx;
+
+    if (s->ctx == CTXOBJ && name == NULL) {
+        ERROR("need attribute name");
+        jw->err = 1;
+        return -1;
+    } else if (s->ctx != CTXOBJ && name != NULL) {
+        ERROR("attribute name should be NULL");
+        jw->err = 1;
+        return -1;
+    }
+
+    if (s->ctx == CTXVAL) { // value
+        if (s->tt != JINSTART) {
+            jw->err = 1;
+        }
+    } else if (s->ctx == CTXARR) { // array
+        if (s->tt != JASTART) {
+            jw_strz(jw, ",");
+        }
+        if (s->pp) {
+            jw_margin(jw);
+        }
+    } else { // object
+        if (s->tt != JOSTART) {
+            jw_strz(jw, ",");
+        }
+        if (s->pp) {
+            jw_margin(jw);
+        }
+        jw_printf(jw, (s->pp ? "\"%s\": " : "\"%s\":"), name);
+    }
+
+    return jw->err;
+}
+
+/* Create json writer object.
+ *
+ * In:
+ *      jw[out] - address of ptr to json writer object
+ *      mem - initial amount of memory to be used for writing;
+ *            if 0, then default value is used
+ *      stack - stack depth; this value controls maximum nesting in json;
+ *              if 0 then default value is used
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jw_create(jwriter_t **jw, size_t mem, size_t stack)
+{
+    int ret = 1;
+
+    // adjust input values
+    if (mem < JSON_MEM_MIN)
+        mem = JSON_MEM_MIN;
+    if (stack < JSON_STACK_MIN)
+        stack = JSON_STACK_MIN;
+
+    // get memory for writer object
+    jwriter_t *p = malloc(sizeof(*p));
+    if (!p)
+        goto enomem;
+    memset(p, 0, sizeof(*p));
+
+    // get memory for stack
+    p->stack = malloc(stack * sizeof(p->stack[0]));
+    if (!p->stack)
+        goto enomem;
+    p->ssize = (uint)stack;
+
+    // get memory for json string
+    p->start = malloc(mem);
+    if (!p->start)
+        goto enomem;
+    p->len = (uint)mem;
+
+    *jw = p;
+    ret = 0;
+
+exit:
+    return ret;
+
+enomem:
+    ERROR("no memory");
+    if (p) {
+        free(p->stack);
+        free(p);
+    }
+    goto exit;
+}
+
+/* Destroy json writer object.
+ *
+ * In:
+ *      jw - ptr to json writer object
+ */
+void jw_destroy(jwriter_t *jw)
+{
+    if (!jw)
+        return;
+
+    free(jw->start);
+    free(jw->stack);
+    free(jw);
+}
+
+/* Set pretty-print parameters.
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      depth - only nodes with level value up to this number will be aligned
+ *      margin - number of space character per margin
+ */
+void jw_pretty_print(jwriter_t *jw, int depth, int margin)
+{
+    if (!jw)
+        return;
+
+    jw->ppd = depth < 0 ? 0 : depth;
+    jw->ppm = margin < 0 ? 0 : margin;
+}
+
+/* Begin json writing.
+ * Previously written json string is discarded.
+ *
+ * In:
+ *      jw - ptr to json writer object
+ */
+void jw_begin(jwriter_t *jw)
+{
+    if (!jw)
+        return;
+
+    jw->pos = 0;
+    jw->err = 0;
+    jw->sidx = 0;
+
+    jwstk *s = jw->stack + jw->sidx;
+    s->ctx = CTXVAL;
+    s->tt = JINSTART;
+}
+
+/* Get written json string.
+ * String is zero terminated. String is located in json writer object
+ * memory and need not to be freed manually.
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      str[out] - address of json string start
+ *      size[out] - address of json string size
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jw_get(jwriter_t *jw, char **str, size_t *size)
+{
+    if (!jw)
+        return -1;
+    if (jw->pos >= jw->len)
+        return -1;
+    if (jw->stack[jw->sidx].ctx != CTXVAL)
+        return -1;
+
+    jw->start[jw->pos] = 0;
+    *str = jw->start;
+    if (size)
+        *size = jw->pos;
+
+    return jw->err;
+}
+
+/* Write null value to json writer.
+ * Possible errors are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ */
+void jw_null(jwriter_t *jw, const char *name)
+{
+    if (jw_prepv(jw, name))
+        return;
+    jw_strz(jw, "null");
+    jw->stack[jw->sidx].tt = JNULL;
+}
+
+/* Write boolean value to json writer.
+ * Possible errors are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      val - boolean value
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ */
+void jw_bool(jwriter_t *jw, bool val, const char *name)
+{
+    if (jw_prepv(jw, name))
+        return;
+    jw_strz(jw, (val ? "true" : "false"));
+    jw->stack[jw->sidx].tt = JBOOL;
+}
+
+/* Write integer value to json writer.
+ * Possible errors are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      val - integer value
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ */
+void jw_int(jwriter_t *jw, int val, const char *name)
+{
+    if (jw_prepv(jw, name))
+        return;
+    jw_printf(jw, "%d", val);
+    jw->stack[jw->sidx].tt = JINT;
+}
+
+// Format decimal number to buffer of at least 64 bytes.
+static char *jw_fmt_dec(char *buf, int64_t mant, int exp)
+{
+    char dig[24]; // digits in reverse order
+    int n = 0;
+    uint64_t m = (mant < 0) ? -(uint64_t)mant : (uint64_t)mant;
+    do {
+        dig[n++] = (char)('0' + m % 10);
+        m /= 10;
+    } while (m);
+
+    char *p = buf;
+    if (mant < 0)
+        *p++ = '-';
+
+    if (exp >= 0 || exp < -20) { // digits and exponent
+        while (n)
+            *p++ = dig[--n];
+        if (exp != 0)
+            p += sprintf(p, "e%d", exp);
+    } else { // digits with decimal point
+        int frac = -exp;
+        if (n <= frac) {
+            *p++ = '0';
+            *p++ = '.';
+            for (int i = n; i < frac; i++)
+                *p++ = '0';
+        } else {
+            while (n > frac)
+                *p++ = dig[--n];
+            *p++ = '.';
+        }
+        while (n)
+            *p++ = dig[--n];
+    }
+
+    *p = 0;
+    return buf;
+}
+
+/* Write decimal value to json writer.
+ * Value is written exactly as mant * 10^exp without floating point
+ * conversions, e.g. mant=150, exp=-2 is written as 1.50.
+ * Possible errors are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      mant - mantissa
+ *      exp - decimal exponent
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ */
+void jw_decimal(jwriter_t *jw, int64_t mant, int exp, const char *name)
+{
+    if (jw_prepv(jw, name))
+        return;
+    char buf[64];
+    jw_strz(jw, jw_fmt_dec(buf, mant, exp));
+    jw->stack[jw->sidx].tt = JDBL;
+}
+
+#if JSON_DOUBLE == 1
+/* Write double value to json writer.
+ * Possible errors are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      val - double value
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ */
+void jw_dbl(jwriter_t *jw, double val, const char *name)
+{
+    if (jw_prepv(jw, name))
+        return;
+    jw_printf(jw, "%f", val);
+    jw->stack[jw->sidx].tt = JDBL;
+}
+
+/* Write double value with specified precision to json writer.
+ * Possible errors are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      val - double value
+ *      prec - precision
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ */
+void jw_dbl_prec(jwriter_t *jw, double val, int prec, const char *name)
+{
+    if (jw_prepv(jw, name))
+        return;
+    jw_printf(jw, "%.*f", prec, val);
+    jw->stack[jw->sidx].tt = JDBL;
+}
+#endif
+
+/* Write string value to json writer.
+ * Possible errors are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      val - string value
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ */
+void jw_str(jwriter_t *jw, const char *str, const char *name)
+{
+    if (jw_prepv(jw, name))
+        return;
+
+    jw_strz(jw, "\"");
+    for (char c = *str; c; c = *(++str)) {
+        // do escaping
+        if (c == '"')
+            jw_strz(jw, "\\\"");
+        else if (c == '\\')
+            jw_strz(jw, "\\\\");
+        else if (c == '/')
+            jw_strz(jw, "\\/");
+        else if (c == '\b')
+            jw_strz(jw, "\\b");
+        else if (c == '\f')
+            jw_strz(jw, "\\f");
+        else if (c == '\n')
+            jw_strz(jw, "\\n");
+        else if (c == '\r')
+            jw_strz(jw, "\\r");
+        else if (c == '\t')
+            jw_strz(jw, "\\t");
+        else {
+            if (jw->pos >= jw->len - 1) {
+                jw->len *= 2;
+                jw->start = realloc(jw->start, jw->len);
+            }
+            jw->start[jw->pos++] = c;
+        }
+    }
+    jw_strz(jw, "\"");
+
+    jw->stack[jw->sidx].tt = JSTR;
+}
+
+/* Begin writing of array value to json writer.
+ * Possible errors are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ */
+void jw_abegin(jwriter_t *jw, const char *name)
+{
+    if (jw_prepv(jw, name))
+        return;
+
+    jw_strz(jw, "[");
+
+    if (jw->sidx >= jw->ssize - 1) {
+        jw->err = 1;
+        return;
+    }
+    jw->sidx++;
+
+    jwstk *s = jw->stack + jw->sidx;
+    s->ctx = CTXARR;
+    s->tt = JASTART;
+    s->pp = (jw->ppd > jw->sidx);
+}
+
+/* End writing of array value to json writer.
+ * Possible errors are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ */
+void jw_aend(jwriter_t *jw)
+{
+    if (!jw || jw->err)
+        return;
+
+    if (jw->sidx == 0) {
+        jw->err = 1;
+        return;
+    }
+    jw->sidx--;
+
+    if (jw->stack[jw->sidx].pp && jw->stack[jw->sidx+1].pp) {
+        jw_margin(jw);
+    }
+    jw_strz(jw, "]");
+
+    jw->stack[jw->sidx].tt = JAEND;
+}
+
+/* Begin writing of object value to json writer.
+ * Possible errors are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ */
+void jw_obegin(jwriter_t *jw, const char *name)
+{
+    if (jw_prepv(jw, name))
+        return;
+
+    jw_strz(jw, "{");
+
+    if (jw->sidx >= jw->ssize - 1) {
+        jw->err = 1;
+        return;
+    }
+    jw->sidx++;
+
+    jwstk *s = jw->stack + jw->sidx;
+    s->ctx = CTXOBJ;
+    s->tt = JOSTART;
+    s->pp = (jw->ppd > jw->sidx);
+}
+
+/* End writing of object value to json writer.
+ * Possible errors are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ */
+void jw_oend(jwriter_t *jw)
+{
+    if (!jw || jw->err)
+        return;
+
+    if (jw->sidx == 0) {
+        jw->err = 1;
+        return;
+    }
+    jw->sidx--;
+
+    if (jw->stack[jw->sidx].pp && jw->stack[jw->sidx+1].pp) {
+        jw_margin(jw);
+    }
+    jw_strz(jw, "}");
+
+    jw->stack[jw->sidx].tt = JOEND;
+}
+
+// Write number text to json writer.
+static void jw_num_txt(jwriter_t *jw, const char *txt, const char *name)
+{
+    if (jw_prepv(jw, name))
+        return;
+    jw_strz(jw, txt);
+    jw->stack[jw->sidx].tt = JDBL;
+}
+
+// Write packed array values to json writer.
+static void jw_packed(jwriter_t *jw, jtype_t type, const void *data,
+    int ndim, const int *shape, const char *name)
+{
+    size_t rs = 1;
+    for (int i = 1; i < ndim; i++)
+        rs *= (size_t)shape[i];
+
+    jw_abegin(jw, name);
+    for (int i = 0; i < shape[0]; i++) {
+        if (ndim > 1) {
+            const char *row = (const char*)data
+                + (size_t)i * rs * jn_val_size(type);
+            jw_packed(jw, type, row, ndim - 1, shape + 1, NULL);
+#if JSON_DOUBLE == 1
+        } else if (type == JT_DBL) {
+            jw_dbl(jw, ((const double*)data)[i], NULL);
+#endif
+        } else {
+            jw_int(jw, ((const int*)data)[i], NULL);
+        }
+    }
+    jw_aend(jw);
+}
+
+/* Write json node with all its content to json writer.
+ * Only numbers having original text (see JP_RAWNUM) keep their source
+ * text; strings are escaped again and layout follows writer settings, so
+ * output is not a copy of parsed json.
+ * Absent value (JT_NONE) is not written.
+ * Possible errors are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      node - json node
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ */
+void jw_node(jwriter_t *jw, jnode_t *node, const char *name)
+{
+    switch (node->type) {
+    case JT_NONE:
+        break;
+    case JT_NULL:
+        jw_null(jw, name);
+        break;
+    case JT_BOOL:
+        jw_bool(jw, node->bool_val, name);
+        break;
+    case JT_INT:
+        if (node->num_txt)
+            jw_num_txt(jw, node->num_txt, name);
+        else
+            jw_int(jw, node->int_val, name);
+        break;
+#if JSON_DOUBLE == 1
+    case JT_DBL:
+        if (node->num_txt)
+            jw_num_txt(jw, node->num_txt, name);
+        else
+            jw_dbl(jw, node->dbl_val, name);
+        break;
+#endif
+    case JT_DEC:
+        if (node->num_txt)
+            jw_num_txt(jw, node->num_txt, name);
+        else
+            jw_decimal(jw, node->dec_val.mant, node->dec_val.exp, name);
+        break;
+    case JT_STR:
+        jw_str(jw, node->str_val, name);
+        break;
+    case JT_ARR:
+        if (node->elts.packed != JT_NONE) {
+            jnode_arr_t *narr = (jnode_arr_t*)node;
+            jw_packed(jw, node->elts.packed, node->elts.ints,
+                narr->ndim, narr->shape, name);
+            break;
+        }
+        jw_abegin(jw, name);
+        for (int i = 0; i < node->elts.count; i++)
+            jw_node(jw, node->elts.values[i], NULL);
+        jw_aend(jw);
+        break;
+    case JT_OBJ:
+        jw_obegin(jw, name);
+        for (int i = 0; i < node->attrs.count; i++)
+            jw_node(jw, node->attrs.values[i], node->attrs.names[i]);
+        jw_oend(jw);
+        break;
+    }
+}
+
+
+/*****************************************************************************
+* Base64 data in json strings.
+*****************************************************************************/
+
+// Base64 alphabet.
+static const char b64enc[64] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Invalid base64 character.
+#define XXX 0xFF
+
+// Base64 character values.
+static const uchar b64dec[256] = {
+    //0    1    2    3    4    5    6    7    8    9    A    B    C    D    E    F  //
+    XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, // 00
+    XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, // 10
+    XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX,  62, XXX, XXX, XXX,  63, // 20
+     52,  53,  54,  55,  56,  57,  58,  59,  60,  61, XXX, XXX, XXX, XXX, XXX, XXX, // 30
+    XXX,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14, // 40
+     15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, XXX, XXX, XXX, XXX, XXX, // 50
+    XXX,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40, // 60
+     41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, XXX, XXX, XXX, XXX, XXX, // 70
+    XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, // 80
+    XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, // 90
+    XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, // A0
+    XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, // B0
+    XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, // C0
+    XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, // D0
+    XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, // E0
+    XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX, XXX  // F0
+};
+
+#undef XXX
+
+// Decode base64 string skipping blanks.
+static int b64_decode_slow(uchar *d, size_t size, const uchar *s, size_t len)
+{
+    size_t di = 0;
+    uint acc = 0;
+    int bits = 0;
+
+    size_t i;
+    for (i = 0; i < len; i++) {
+        uchar c = s[i];
+        if (c == '=')
+            break;
+        uint v = b64dec[c];
+        if (v == 0xFF) {
+            if (ct[c] == CBL)
+                continue;
+            return -1;
+        }
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (di >= size)
+                return -1;
+            d[di++] = (uchar)(acc >> bits);
+        }
+    }
+
+    // padding completes last quantum and only blanks can follow it
+    int pad = 0;
+    for (; i < len; i++) {
+        if (s[i] == '=')
+            pad++;
+        else if (ct[s[i]] != CBL)
+            return -1;
+    }
+    if (bits == 6 || (pad && pad != bits / 2) || (acc & ((1u << bits) - 1)))
+        return -1;
+
+    return (int)di;
+}
+
+/* Decode base64 data from string node.
+ * Padding is optional, but if present it must complete the last
+ * quantum. Blank characters are skipped.
+ * Size of decoded data is not more than (node->str_len * 3 / 4) bytes.
+ *
+ * In:
+ *      node - json node of type JT_STR
+ *      buf[out] - buffer for decoded data
+ *      size - buffer size
+ * Return:
+ *      size of decoded data or
+ *      -1 if node is not a string, string is not valid base64 or
+ *      buffer is too small
+ */
+int jn_base64_decode(jnode_t *node, void *buf, size_t size)
+{
+    if (node->type != JT_STR)
+        return -1;
+
+    const uchar *s = (const uchar*)node->str_val;
+    size_t len = (size_t)node->str_len;
+    uchar *d = buf;
+    size_t di = 0;
+    size_t i = 0;
+
+    // decode blocks of 16 characters to 12 bytes; invalid characters
+    // are detected once per block by OR-ing of all character values
+    for (; i + 16 <= len && di + 12 <= size; i += 16, di += 12) {
+        uint v[16];
+        uint bad = 0;
+        for (int k = 0; k < 16; k++) {
+            v[k] = b64dec[s[i + k]];
+            bad |= v[k];
+        }
+        if (bad & 0xC0)
+            break;
+        for (int k = 0; k < 4; k++) {
+            uint w = v[4*k] << 18 | v[4*k+1] << 12 | v[4*k+2] << 6 | v[4*k+3];
+            d[di + 3*k] = (uchar)(w >> 16);
+            d[di + 3*k + 1] = (uchar)(w >> 8);
+            d[di + 3*k + 2] = (uchar)w;
+        }
+    }
+
+    // decode the rest (tail, padding or blanks)
+    int res = b64_decode_slow(d + di, size - di, s + i, len - i);
+    if (res < 0)
+        return -1;
+    return (int)di + res;
+}
+
+/* Write binary data to json writer as base64 string.
+ * Data is encoded directly into json buffer.
+ * Possible errors are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      data - ptr to data
+ *      len - data size
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ */
+void jw_base64(jwriter_t *jw, const void *data, size_t len, const char *name)
+{
+    if (jw_prepv(jw, name))
+        return;
+
+    // make enough room for encoded string and quotes
+    size_t need = (len + 2) / 3 * 4 + 3;
+    while (jw->len - jw->pos <= need) {
+        jw->len *= 2;
+        jw->start = realloc(jw->start, jw->len);
+    }
+
+    const uchar *s = data;
+    char *d = jw->start + jw->pos;
+    size_t i = 0;
+
+    *d++ = '"';
+
+    // encode blocks of 12 bytes to 16 characters
+    for (; i + 12 <= len; i += 12, d += 16) {
+        for (int k = 0; k < 4; k++) {
+            uint w = (uint)s[i + 3*k] << 16 | (uint)s[i + 3*k + 1] << 8
+                | s[i + 3*k + 2];
+            d[4*k] = b64enc[w >> 18];
+            d[4*k + 1] = b64enc[(w >> 12) & 0x3F];
+            d[4*k + 2] = b64enc[(w >> 6) & 0x3F];
+            d[4*k + 3] = b64enc[w & 0x3F];
+        }
+    }
+
+    // encode the rest
+    for (; i < len; i += 3, d += 4) {
+        uint w = (uint)s[i] << 16;
+        if (i + 1 < len)
+            w |= (uint)s[i + 1] << 8;
+        if (i + 2 < len)
+            w |= s[i + 2];
+        d[0] = b64enc[w >> 18];
+        d[1] = b64enc[(w >> 12) & 0x3F];
+        d[2] = (i + 1 < len) ? b64enc[(w >> 6) & 0x3F] : '=';
+        d[3] = (i + 2 < len) ? b64enc[w & 0x3F] : '=';
+    }
+
+    *d++ = '"';
+    jw->pos = (uint)(d - jw->start);
+    jw->stack[jw->sidx].tt = JSTR;
+}
+
+
+/*****************************************************************************
+* Json tree walker.
+*****************************************************************************/
+
+// Number of walker stack elements that do not need heap memory.
+#define JSON_WALK_DEPTH 32
+
+// Distance (in elements) of prefetching of child nodes.
+#define JSON_WALK_PREFETCH 4
+
+// Prefetching of memory that will be needed soon.
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)(p))
+#endif
+
+// Stack element of tree walker.
+typedef struct {
+    jnode_t *node; // array or object node
+    jnode_t **values; // child nodes
+    int count; // child nodes count
+    int i; // index of next child node
+} jnstk;
+
+// Get array of child nodes (NULL for scalar or empty nodes).
+static jnode_t **jn_children(jnode_t *node)
+{
+    if (node->type == JT_OBJ)
+        return node->attrs.values;
+    if (node->type != JT_ARR || node->elts.count == 0)
+        return NULL;
+
+    // packed array gets element nodes on first access
+    if (node->elts.values == NULL && jn_elt(node, 0) == &none)
+        return NULL;
+    return node->elts.values;
+}
+
+/* Walk tree of json nodes in depth-first order.
+ * Walking is iterative, so deeply nested trees do not exhaust C stack.
+ * Child nodes are prefetched ahead of visiting.
+ * Callbacks return one of JN_WALK_xxx values:
+ *      JN_WALK_NEXT - continue walking
+ *      JN_WALK_SKIP - do not visit children of node (pre callback only)
+ *      JN_WALK_STOP - stop walking
+ *
+ * In:
+ *      node - root node of tree
+ *      pre - callback called for every node before its children;
+ *            may be NULL
+ *      post - callback called for array and object nodes after their
+ *             children; may be NULL
+ *      ctx - user context passed to callbacks
+ * Return:
+ *      0 - all nodes were visited
+ *      1 - walking was stopped by callback
+ *      -1 - error
+ */
+int jn_walk(jnode_t *node, jn_visit_t pre, jn_visit_t post, void *ctx)
+{
+    jnstk buf[JSON_WALK_DEPTH];
+    jnstk *stk = buf;
+    int size = JSON_WALK_DEPTH;
+    int depth = 0;
+    const char *name = NULL;
+    int ret = 0;
+    int act;
+
+    for (;;) {
+        // visit node before its children
+        act = pre ? pre(node, name, depth, ctx) : JN_WALK_NEXT;
+        if (act == JN_WALK_STOP)
+            goto stop;
+
+        if (node->type == JT_ARR || node->type == JT_OBJ) {
+            if (act != JN_WALK_SKIP) {
+                if (depth >= size) {
+                    // grow stack
+                    size *= 2;
+                    jnstk *p = malloc((size_t)size * sizeof(p[0]));
+                    if (p == NULL)
+                        goto enomem;
+                    memcpy(p, stk, (size_t)depth * sizeof(p[0]));
+                    if (stk != buf)
+                        free(stk);
+                    stk = p;
+                }
+                jnstk *s = &stk[depth++];
+                s->node = node;
+                s->count = node->type == JT_OBJ ?
+                    node->attrs.count : node->elts.count;
+                s->values = jn_children(node);
+                s->i = 0;
+                if (s->values == NULL && s->count > 0)
+                    goto enomem;
+                if (s->count > 0)
+                    PREFETCH(s->values[0]);
+            } else {
+                act = post ? post(node, name, depth, ctx) : JN_WALK_NEXT;
+                if (act == JN_WALK_STOP)
+                    goto stop;
+            }
+        }
+
+        // find next node to visit
+        for (;;) {
+            if (depth == 0)
+                goto exit;
+
+            jnstk *s = &stk[depth - 1];
+            jnode_t *p = s->node;
+            if (s->i < s->count) {
+                int i = s->i++;
+                if (i + JSON_WALK_PREFETCH < s->count)
+                    PREFETCH(s->values[i + JSON_WALK_PREFETCH]);
+                node = s->values[i];
+                name = p->type == JT_OBJ ? p->attrs.names[i] : NULL;
+                break;
+            }
+
+            // visit node after its children
+            depth--;
+            name = NULL;
+            if (depth > 0 && s[-1].node->type == JT_OBJ)
+                name = s[-1].node->attrs.names[s[-1].i - 1];
+            act = post ? post(p, name, depth, ctx) : JN_WALK_NEXT;
+            if (act == JN_WALK_STOP)
+                goto stop;
+        }
+    }
+
+stop:
+    ret = 1;
+
+exit:
+    if (stk != buf)
+        free(stk);
+    return ret;
+
+enomem:
+    ERROR("no memory");
+    ret = -1;
+    goto exit;
+}
+
+
+/*****************************************************************************
+* Json diff and patch (RFC 6902 and RFC 7396).
+*****************************************************************************/
+
+// Json diff state.
+typedef struct {
+    jwriter_t *jw; // writer of patch operations
+    char *path; // json pointer to current node
+    size_t len; // length of json pointer
+    size_t cap; // capacity of json pointer buffer
+} jdiff;
+
+// Append reference token to json pointer of diff.
+// Return previous length of json pointer or -1 on error.
+static int jd_push(jdiff *d, const char *tok)
+{
+    size_t len = strlen(tok);
+
+    // escaping can make token twice longer
+    size_t need = d->len + 2 * len + 2;
+    if (need > d->cap) {
+        size_t cap = d->cap;
+        while (cap < need)
+            cap *= 2;
+        char *p = realloc(d->path, cap);
+        if (p == NULL) {
+            ERROR("no memory");
+            return -1;
+        }
+        d->path = p;
+        d->cap = cap;
+    }
+
+    int ret = (int)d->len;
+    char *p = d->path + d->len;
+    *p++ = '/';
+    for (size_t i = 0; i < len; i++) {
+        if (tok[i] == '~') {
+            *p++ = '~';
+            *p++ = '0';
+        } else if (tok[i] == '/') {
+            *p++ = '~';
+            *p++ = '1';
+        } else {
+            *p++ = tok[i];
+        }
+    }
+    *p = 0;
+    d->len = (size_t)(p - d->path);
+    return ret;
+}
+
+// Append array index to json pointer of diff.
+static int jd_push_idx(jdiff *d, int i)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", i);
+    return jd_push(d, buf);
+}
+
+// Restore previous length of json pointer of diff.
+static inline void jd_pop(jdiff *d, int len)
+{
+    d->len = (size_t)len;
+    d->path[len] = 0;
+}
+
+// Write patch operation for current json pointer.
+static void jd_op(jdiff *d, const char *op, jnode_t *value)
+{
+    jw_obegin(d->jw, NULL);
+    jw_str(d->jw, op, "op");
+    jw_str(d->jw, d->path, "path");
+    if (value)
+        jw_node(d->jw, value, "value");
+    jw_oend(d->jw);
+}
+
+static int jd_node(jdiff *d, jnode_t *a, jnode_t *b);
+
+// Write patch operations for object nodes.
+static int jd_obj(jdiff *d, jnode_t *a, jnode_t *b)
+{
+    // changed and removed attributes
+    for (int i = 0; i < a->attrs.count; i++) {
+        const char *name = a->attrs.names[i];
+        int len = jd_push(d, name);
+        if (len < 0)
+            return -1;
+        int j = jn_attr_idx(b, name);
+        if (j < 0)
+            jd_op(d, "remove", NULL);
+        else if (jd_node(d, a->attrs.values[i], b->attrs.values[j]))
+            return -1;
+        jd_pop(d, len);
+    }
+
+    // added attributes
+    for (int j = 0; j < b->attrs.count; j++) {
+        const char *name = b->attrs.names[j];
+        if (jn_attr_idx(a, name) >= 0)
+            continue;
+        int len = jd_push(d, name);
+        if (len < 0)
+            return -1;
+        jd_op(d, "add", b->attrs.values[j]);
+        jd_pop(d, len);
+    }
+
+    return 0;
+}
+
+// Write patch operations for array nodes.
+static int jd_arr(jdiff *d, jnode_t *a, jnode_t *b)
+{
+    int na = a->elts.count;
+    int nb = b->elts.count;
+
+    // skip equal elements at start and at end
+    int p = 0;
+    while (p < na && p < nb && jn_equal_node(jn_elt(a, p), jn_elt(b, p)))
+        p++;
+    int s = 0;
+    while (s < na - p && s < nb - p
+            && jn_equal_node(jn_elt(a, na - 1 - s), jn_elt(b, nb - 1 - s)))
+        s++;
+
+    // pairwise changed elements
+    int m = (na < nb ? na : nb) - p - s;
+    for (int i = p; i < p + m; i++) {
+        int len = jd_push_idx(d, i);
+        if (len < 0)
+            return -1;
+        if (jd_node(d, jn_elt(a, i), jn_elt(b, i)))
+            return -1;
+        jd_pop(d, len);
+    }
+
+    // removed elements
+    for (int i = p + m; i < na - s; i++) {
+        int len = jd_push_idx(d, p + m);
+        if (len < 0)
+            return -1;
+        jd_op(d, "remove", NULL);
+        jd_pop(d, len);
+    }
+
+    // added elements
+    for (int i = p + m; i < nb - s; i++) {
+        int len = jd_push_idx(d, i);
+        if (len < 0)
+            return -1;
+        jd_op(d, "add", jn_elt(b, i));
+        jd_pop(d, len);
+    }
+
+    return 0;
+}
+
+// Write patch operations for json nodes.
+static int jd_node(jdiff *d, jnode_t *a, jnode_t *b)
+{
+    if (jn_equal_node(a, b))
+        return 0;
+
+    if (a->type == JT_OBJ && b->type == JT_OBJ)
+        return jd_obj(d, a, b);
+    if (a->type == JT_ARR && b->type == JT_ARR)
+        return jd_arr(d, a, b);
+
+    if (a->type == JT_NONE)
+        jd_op(d, "add", b);
+    else if (b->type == JT_NONE)
+        jd_op(d, "remove", NULL);
+    else
+        jd_op(d, "replace", b);
+    return 0;
+}
+
+/* Write difference between json trees as json patch (RFC 6902).
+ * Structural hashes of subtrees are cached in nodes, so equal subtrees
+ * are skipped fast. Arrays are compared element by element after
+ * skipping equal elements at start and at end.
+ * Possible errors of writing are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      a - source json node
+ *      b - target json node
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jn_diff(jwriter_t *jw, jnode_t *a, jnode_t *b, const char *name)
+{
+    jdiff d = {jw, NULL, 0, 64};
+
+    d.path = malloc(d.cap);
+    if (d.path == NULL) {
+        ERROR("no memory");
+        return -1;
+    }
+    d.path[0] = 0;
+
+    // calculate hashes of all objects once
+    jn_hash_node(a);
+    jn_hash_node(b);
+
+    jw_abegin(jw, name);
+    int ret = jd_node(&d, a, b);
+    jw_aend(jw);
+
+    free(d.path);
+    return ret;
+}
+
+// Create empty editable array or object node.
+static jnode_t *jn_edit_new(marena_t *mem, jtype_t type)
+{
+    jnode_t *n = marena_alloc(mem, sizeof(jnode_obj_t));
+    if (n == NULL) {
+        ERROR("no memory");
+        return NULL;
+    }
+    memset(n, 0, sizeof(jnode_obj_t));
+    n->type = type;
+    n->flags = NF_EDIT;
+    return n;
+}
+
+// Insert child node into editable node.
+static int jn_edit_insert(marena_t *mem, jnode_t *n, int i,
+    const char *name, jnode_t *v)
+{
+    bool obj = (n->type == JT_OBJ);
+    int cnt = obj ? n->attrs.count : n->elts.count;
+
+    // arrays grow by powers of two
+    size_t cap = JSON_CAP_MIN;
+    while (cap < (size_t)cnt + 1)
+        cap *= 2;
+
+    jnode_t **values = marena_realloc_rt(mem,
+        obj ? n->attrs.values : n->elts.values, cap * sizeof(values[0]));
+    if (values == NULL)
+        goto enomem;
+    memmove(values + i + 1, values + i, (size_t)(cnt - i) * sizeof(values[0]));
+    values[i] = v;
+
+    if (!obj) {
+        n->elts.values = values;
+        n->elts.count++;
+        return 0;
+    }
+
+    const char **names = marena_realloc_rt(mem, n->attrs.names,
+        cap * sizeof(names[0]));
+    if (names == NULL)
+        goto enomem;
+    memmove(names + i + 1, names + i, (size_t)(cnt - i) * sizeof(names[0]));
+    names[i] = name;
+
+    n->attrs.values = values;
+    n->attrs.names = names;
+    n->attrs.count++;
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    return -1;
+}
+
+// Remove child node from editable node.
+static void jn_edit_remove(jnode_t *n, int i)
+{
+    if (n->type == JT_OBJ) {
+        int cnt = --n->attrs.count;
+        memmove(n->attrs.values + i, n->attrs.values + i + 1,
+            (size_t)(cnt - i) * sizeof(n->attrs.values[0]));
+        memmove(n->attrs.names + i, n->attrs.names + i + 1,
+            (size_t)(cnt - i) * sizeof(n->attrs.names[0]));
+    } else {
+        int cnt = --n->elts.count;
+        memmove(n->elts.values + i, n->elts.values + i + 1,
+            (size_t)(cnt - i) * sizeof(n->elts.values[0]));
+    }
+}
+
+// Create editable copy of array or object node.
+// Child nodes are shared with original node.
+static jnode_t *jn_edit_copy(marena_t *mem, jnode_t *n)
+{
+    int cnt = (n->type == JT_OBJ) ? n->attrs.count : n->elts.count;
+    jnode_t **values = jn_children(n);
+    if (values == NULL && cnt > 0)
+        return NULL;
+
+    jnode_t *e = jn_edit_new(mem, n->type);
+    if (e == NULL)
+        return NULL;
+    for (int i = 0; i < cnt; i++) {
+        const char *name = (n->type == JT_OBJ) ? n->attrs.names[i] : NULL;
+        if (jn_edit_insert(mem, e, i, name, values[i]))
+            return NULL;
+    }
+    return e;
+}
+
+// Get editable version of array or object node.
+static inline jnode_t *jn_edit(marena_t *mem, jnode_t *n)
+{
+    return (n->flags & NF_EDIT) ? n : jn_edit_copy(mem, n);
+}
+
+// Copy editable nodes of tree, so that they are not shared.
+static jnode_t *jn_edit_clone(marena_t *mem, jnode_t *n)
+{
+    if (!(n->flags & NF_EDIT))
+        return n;
+
+    jnode_t *c = jn_edit_copy(mem, n);
+    if (c == NULL)
+        return NULL;
+    jnode_t **values = jn_children(c);
+    int cnt = (c->type == JT_OBJ) ? c->attrs.count : c->elts.count;
+    for (int i = 0; i < cnt; i++) {
+        values[i] = jn_edit_clone(mem, values[i]);
+        if (values[i] == NULL)
+            return NULL;
+    }
+    return c;
+}
+
+// Get next reference token of json pointer (ptr points to '/').
+// Token is unescaped and stored in arena.
+static char *jn_ptr_tok(marena_t *mem, const char **ptr)
+{
+    const char *s = *ptr + 1;
+    const char *e = strchr(s, '/');
+    if (e == NULL)
+        e = s + strlen(s);
+
+    char *tok = marena_alloc(mem, (size_t)(e - s) + 1);
+    if (tok == NULL) {
+        ERROR("no memory");
+        return NULL;
+    }
+
+    char *d = tok;
+    for (; s < e; s++) {
+        if (s[0] == '~' && s + 1 < e && (s[1] == '0' || s[1] == '1'))
+            *d++ = (*++s == '0') ? '~' : '/';
+        else
+            *d++ = *s;
+    }
+    *d = 0;
+
+    *ptr = e;
+    return tok;
+}
+
+// Get array index from reference token ('-' means index after last).
+// Return -1 if token is not an index.
+static int jn_ptr_idx(const char *tok, int cnt)
+{
+    if (0 == strcmp(tok, "-"))
+        return cnt;
+    if (tok[0] == 0 || (tok[0] == '0' && tok[1]))
+        return -1;
+
+    int i = 0;
+    for (; *tok; tok++) {
+        if (ct[(uchar)*tok] != CNM || i > (INT32_MAX - 9) / 10)
+            return -1;
+        i = i * 10 + (*tok - '0');
+    }
+    return i;
+}
+
+// Get index of child node by reference token (-1 if there is none).
+static int jn_ptr_child(jnode_t *n, const char *tok)
+{
+    if (n->type == JT_OBJ)
+        return jn_attr_idx(n, tok);
+    if (n->type != JT_ARR)
+        return -1;
+
+    int i = jn_ptr_idx(tok, n->elts.count);
+    return (i < n->elts.count) ? i : -1;
+}
+
+// Get node by json pointer (NULL if there is none).
+static jnode_t *jn_ptr_get(marena_t *mem, jnode_t *root, const char *ptr)
+{
+    jnode_t *n = root;
+    while (*ptr == '/') {
+        char *tok = jn_ptr_tok(mem, &ptr);
+        if (tok == NULL)
+            return NULL;
+        int i = jn_ptr_child(n, tok);
+        if (i < 0)
+            return NULL;
+        n = jn_children(n)[i];
+    }
+    return *ptr ? NULL : n;
+}
+
+// Make nodes on json pointer path editable and get parent of target node.
+// Last reference token of json pointer is returned in 'tok'.
+static jnode_t *jn_ptr_edit(marena_t *mem, jnode_t **root, const char *ptr,
+    char **tok)
+{
+    jnode_t **pn = root;
+    if (*ptr != '/')
+        return NULL;
+
+    for (;;) {
+        jnode_t *n = *pn;
+        if (n->type != JT_ARR && n->type != JT_OBJ)
+            return NULL;
+        n = jn_edit(mem, n);
+        if (n == NULL)
+            return NULL;
+        *pn = n;
+
+        *tok = jn_ptr_tok(mem, &ptr);
+        if (*tok == NULL)
+            return NULL;
+        if (*ptr == 0)
+            return n;
+
+        int i = jn_ptr_child(n, *tok);
+        if (i < 0)
+            return NULL;
+        pn = (n->type == JT_OBJ) ? &n->attrs.values[i] : &n->elts.values[i];
+    }
+}
+
+// Patch operation 'add'.
+static int jn_op_add(marena_t *mem, jnode_t **root, const char *path,
+    jnode_t *v)
+{
+    if (*path == 0) {
+        *root = v;
+        return 0;
+    }
+
+    char *tok;
+    jnode_t *p = jn_ptr_edit(mem, root, path, &tok);
+    if (p == NULL)
+        return -1;
+
+    if (p->type == JT_OBJ) {
+        int i = jn_attr_idx(p, tok);
+        if (i >= 0) {
+            p->attrs.values[i] = v;
+            return 0;
+        }
+        return jn_edit_insert(mem, p, p->attrs.count, tok, v);
+    }
+
+    int i = jn_ptr_idx(tok, p->elts.count);
+    if (i < 0 || i > p->elts.count)
+        return -1;
+    return jn_edit_insert(mem, p, i, NULL, v);
+}
+
+// Patch operation 'remove' (removed node is returned in 'v').
+static int jn_op_remove(marena_t *mem, jnode_t **root, const char *path,
+    jnode_t **v)
+{
+    char *tok;
+    jnode_t *p = jn_ptr_edit(mem, root, path, &tok);
+    if (p == NULL)
+        return -1;
+
+    int i = jn_ptr_child(p, tok);
+    if (i < 0)
+        return -1;
+    *v = jn_children(p)[i];
+    jn_edit_remove(p, i);
+    return 0;
+}
+
+// Patch operation 'replace'.
+static int jn_op_replace(marena_t *mem, jnode_t **root, const char *path,
+    jnode_t *v)
+{
+    if (*path == 0) {
+        *root = v;
+        return 0;
+    }
+
+    char *tok;
+    jnode_t *p = jn_ptr_edit(mem, root, path, &tok);
+    if (p == NULL)
+        return -1;
+
+    int i = jn_ptr_child(p, tok);
+    if (i < 0)
+        return -1;
+    jn_children(p)[i] = v;
+    return 0;
+}
+
+// Patch operation 'move'.
+static int jn_op_move(marena_t *mem, jnode_t **root, const char *path,
+    const char *from)
+{
+    // node can not be moved into itself
+    size_t len = strlen(from);
+    if (0 == strncmp(path, from, len) && path[len] == '/')
+        return -1;
+
+    jnode_t *v;
+    if (jn_op_remove(mem, root, from, &v))
+        return -1;
+    return jn_op_add(mem, root, path, v);
+}
+
+// Patch operation 'copy'.
+static int jn_op_copy(marena_t *mem, jnode_t **root, const char *path,
+    const char *from)
+{
+    jnode_t *v = jn_ptr_get(mem, *root, from);
+    if (v == NULL)
+        return -1;
+    v = jn_edit_clone(mem, v);
+    if (v == NULL)
+        return -1;
+    return jn_op_add(mem, root, path, v);
+}
+
+// Check if node is a number.
+static inline bool jn_is_num(jnode_t *n)
+{
+    return (n->type == JT_INT
+#if JSON_DOUBLE == 1
+        || n->type == JT_DBL
+#endif
+        || n->type == JT_DEC);
+}
+
+// Compare numbers of any types by value.
+static bool jn_equal_num(jnode_t *a, jnode_t *b)
+{
+    if (a->type == JT_INT && b->type == JT_INT)
+        return (a->int_val == b->int_val);
+
+    // ints and decimals are compared exactly
+    bool exact = (!jn_dec_txt(a) && !jn_dec_txt(b));
+#if JSON_DOUBLE == 1
+    exact &= (a->type != JT_DBL && b->type != JT_DBL);
+#endif
+    if (exact) {
+        int64_t ma = (a->type == JT_INT) ? a->int_val : a->dec_val.mant;
+        int64_t mb = (b->type == JT_INT) ? b->int_val : b->dec_val.mant;
+        int ea = (a->type == JT_INT) ? 0 : a->dec_val.exp;
+        int eb = (b->type == JT_INT) ? 0 : b->dec_val.exp;
+        jn_dec_norm(&ma, &ea);
+        jn_dec_norm(&mb, &eb);
+        return (ma == mb && ea == eb);
+    }
+    return (js_num(a) == js_num(b));
+}
+
+// Compare json nodes for equality as RFC 6902 defines it for 'test':
+// numbers are compared by value, order of attributes is not significant.
+static bool jn_equal_test(jnode_t *a, jnode_t *b)
+{
+    if (jn_is_num(a) && jn_is_num(b))
+        return jn_equal_num(a, b);
+    if (a->type != b->type)
+        return false;
+
+    if (a->type == JT_OBJ) {
+        if (a->attrs.count != b->attrs.count)
+            return false;
+        for (int i = 0; i < a->attrs.count; i++) {
+            int j = jn_attr_idx(b, a->attrs.names[i]);
+            if (j < 0 || !jn_equal_test(a->attrs.values[i],
+                    b->attrs.values[j]))
+                return false;
+        }
+        return true;
+    }
+
+    if (a->type == JT_ARR) {
+        if (a->elts.count != b->elts.count)
+            return false;
+        for (int i = 0; i < a->elts.count; i++) {
+            jnode_arr_t ta, tb;
+            if (!jn_equal_test(jn_elt_tmp(a, i, &ta), jn_elt_tmp(b, i, &tb)))
+                return false;
+        }
+        return true;
+    }
+
+    return jn_equal_node(a, b);
+}
+
+// Patch operation 'test' (1 if value differs).
+static int jn_op_test(marena_t *mem, jnode_t **root, const char *path,
+    jnode_t *v)
+{
+    jnode_t *n = jn_ptr_get(mem, *root, path);
+    if (n == NULL)
+        return -1;
+    return jn_equal_test(n, v) ? 0 : 1;
+}
+
+/* Apply json patch (RFC 6902) to json tree and write result.
+ * Source tree is not changed: changed parts of tree are copied and
+ * unchanged subtrees are shared with source tree. If some operation
+ * fails, nothing is written.
+ * Possible errors of writing are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      doc - source json node
+ *      patch - json node of type JT_ARR with patch operations
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ * Return:
+ *      0 - success
+ *      1 - value of operation 'test' differs (it is not reported as
+ *          error)
+ *      -1 - error (invalid patch, failed operation or no memory)
+ */
+int jn_patch(jwriter_t *jw, jnode_t *doc, jnode_t *patch, const char *name)
+{
+    int ret = -1;
+    marena_t *mem = NULL;
+
+    if (patch->type != JT_ARR) {
+        ERROR("patch is not an array");
+        goto exit;
+    }
+
+    mem = marena_create(JSON_MEM_MIN);
+    if (mem == NULL) {
+        ERROR("no memory");
+        goto exit;
+    }
+
+    jnode_t *root = doc;
+    for (int i = 0; i < patch->elts.count; i++) {
+        jnode_t *op = jn_elt(patch, i);
+        jnode_t *o = jn_attr(op, "op");
+        jnode_t *p = jn_attr(op, "path");
+        jnode_t *v = jn_attr(op, "value");
+        jnode_t *f = jn_attr(op, "from");
+        if (o->type != JT_STR || p->type != JT_STR) {
+            ERROR("invalid patch operation %d", i);
+            goto exit;
+        }
+
+        int res = -1;
+        const char *path = p->str_val;
+        if (v->type != JT_NONE && 0 == strcmp(o->str_val, "add"))
+            res = jn_op_add(mem, &root, path, v);
+        else if (0 == strcmp(o->str_val, "remove"))
+            res = jn_op_remove(mem, &root, path, &v);
+        else if (v->type != JT_NONE && 0 == strcmp(o->str_val, "replace"))
+            res = jn_op_replace(mem, &root, path, v);
+        else if (f->type == JT_STR && 0 == strcmp(o->str_val, "move"))
+            res = jn_op_move(mem, &root, path, f->str_val);
+        else if (f->type == JT_STR && 0 == strcmp(o->str_val, "copy"))
+            res = jn_op_copy(mem, &root, path, f->str_val);
+        else if (v->type != JT_NONE && 0 == strcmp(o->str_val, "test")) {
+            // different value is expected result, not error
+            res = jn_op_test(mem, &root, path, v);
+            if (res > 0) {
+                ret = 1;
+                goto exit;
+            }
+        }
+        if (res) {
+            ERROR("patch operation %d (%s '%s') failed", i, o->str_val, path);
+            goto exit;
+        }
+    }
+
+    jw_node(jw, root, name);
+    ret = 0;
+
+exit:
+    if (mem)
+        marena_destroy(mem);
+    return ret;
+}
+
+// Apply merge patch to json node.
+static jnode_t *jn_merge(marena_t *mem, jnode_t *n, jnode_t *patch)
+{
+    if (patch->type != JT_OBJ)
+        return patch;
+
+    n = (n->type == JT_OBJ) ? jn_edit(mem, n) : jn_edit_new(mem, JT_OBJ);
+    if (n == NULL)
+        return NULL;
+
+    for (int i = 0; i < patch->attrs.count; i++) {
+        const char *name = patch->attrs.names[i];
+        jnode_t *v = patch->attrs.values[i];
+        int j = jn_attr_idx(n, name);
+
+        // null removes attribute
+        if (v->type == JT_NULL) {
+            if (j >= 0)
+                jn_edit_remove(n, j);
+            continue;
+        }
+
+        v = jn_merge(mem, (j >= 0) ? n->attrs.values[j] : &none, v);
+        if (v == NULL)
+            return NULL;
+        if (j >= 0)
+            n->attrs.values[j] = v;
+        else if (jn_edit_insert(mem, n, n->attrs.count, name, v))
+            return NULL;
+    }
+
+    return n;
+}
+
+/* Apply json merge patch (RFC 7396) to json tree and write result.
+ * Source tree is not changed: changed parts of tree are copied and
+ * unchanged subtrees are shared with source tree.
+ * Possible errors of writing are not reported until call to jw_get().
+ *
+ * In:
+ *      jw - ptr to json writer object
+ *      doc - source json node
+ *      patch - json node with merge patch
+ *      name - object attribute name if writing is done inside object context;
+ *             must be NULL if writing is done inside array context
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jn_merge_patch(jwriter_t *jw, jnode_t *doc, jnode_t *patch,
+    const char *name)
+{
+    marena_t *mem = marena_create(JSON_MEM_MIN);
+    if (mem == NULL) {
+        ERROR("no memory");
+        return -1;
+    }
+
+    jnode_t *root = jn_merge(mem, doc, patch);
+    if (root)
+        jw_node(jw, root, name);
+
+    marena_destroy(mem);
+    return root ? 0 : -1;
+}
+
+
+/*****************************************************************************
+* Json documents (trees copied out of parser memory).
+*****************************************************************************/
+
+// Json document object.
+struct _jdoc_t {
+    marena_t *mem; // memory allocator for nodes and their arrays
+    marena_t *smem; // memory allocator for strings
+    marena_t *amem; // memory allocator for application data
+    ant_t *ant; // attribute names table
+    jnode_t *root; // root node of parsed document
+    int refs; // reference count
+
+    // edited documents (see jp_reparse())
+    char *text; // json text
+    size_t tlen; // length of text
+    size_t tcap; // capacity of text buffer
+    struct _jspan_t *span; // span of root array or object
+    size_t dead; // length of text of replaced subtrees
+};
+
+/* Create json document object.
+ * Document keeps copies of json nodes (see jn_clone()) until it is
+ * destroyed. Its memory does not depend on parser memory.
+ *
+ * In:
+ *      jd[out] - address of ptr to json document object
+ *      mem - size of memory chunks used for nodes and for strings;
+ *            if 0, then default value is used
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jdoc_create(jdoc_t **jd, size_t mem)
+{
+    if (mem < JSON_MEM_MIN)
+        mem = JSON_MEM_MIN;
+
+    jdoc_t *d = malloc(sizeof(*d));
+    if (!d)
+        goto enomem;
+    memset(d, 0, sizeof(*d));
+
+    d->mem = marena_create(mem);
+    if (!d->mem)
+        goto enomem;
+    d->smem = marena_create(mem);
+    if (!d->smem)
+        goto enomem;
+    d->ant = ant_create(d->mem, d->smem);
+    if (!d->ant)
+        goto enomem;
+    d->root = &none;
+    d->refs = 1;
+
+    *jd = d;
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    jdoc_destroy(d);
+    return -1;
+}
+
+/* Destroy json document object and release all its nodes.
+ * If document is shared (see jdoc_ref()), then only one reference
+ * is released.
+ *
+ * In:
+ *      jd - ptr to json document object
+ */
+void jdoc_destroy(jdoc_t *jd)
+{
+    if (jd == NULL || --jd->refs > 0)
+        return;
+
+    if (jd->mem)
+        marena_destroy(jd->mem);
+    if (jd->smem)
+        marena_destroy(jd->smem);
+    if (jd->amem)
+        marena_destroy(jd->amem);
+    free(jd->text);
+    free(jd);
+}
+
+/* Add reference to json document.
+ * Every reference is released by jdoc_destroy().
+ *
+ * In:
+ *      jd - ptr to json document object
+ * Return:
+ *      ptr to json document object
+ */
+jdoc_t *jdoc_ref(jdoc_t *jd)
+{
+    jd->refs++;
+    return jd;
+}
+
+// Take memory of parsed tree from parser; parser gets new memory.
+static int jdoc_take(jdoc_t *jd, jparser_t *jp)
+{
+    marena_t *mem = marena_create(jp->mem->chunk_size);
+    marena_t *smem = marena_create(jp->smem->chunk_size);
+    if (mem == NULL || smem == NULL) {
+        if (mem)
+            marena_destroy(mem);
+        if (smem)
+            marena_destroy(smem);
+        return -1;
+    }
+
+    if (jd->mem)
+        marena_destroy(jd->mem);
+    if (jd->smem)
+        marena_destroy(jd->smem);
+    jd->mem = jp->mem;
+    jd->smem = jp->smem;
+    jd->ant = jp->ant;
+    jp->mem = mem;
+    jp->smem = smem;
+    jp->ant = NULL;
+    jp->vst = NULL;
+    jp->nt = NULL;
+    return 0;
+}
+
+/* Parse json string into new json document.
+ * Memory of parsed tree is taken from parser without copying, and
+ * parser gets new memory for next call to jp_parse().
+ *
+ * In:
+ *      jd[out] - address of ptr to json document object
+ *      jp - ptr to json parser object
+ *      json - ptr to json string
+ *      len - length of json string
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jdoc_parse(jdoc_t **jd, jparser_t *jp, const char *json, size_t len)
+{
+    jnode_t *root;
+    if (jp_parse(jp, &root, json, len))
+        return -1;
+
+    jdoc_t *d = malloc(sizeof(*d));
+    if (d == NULL)
+        goto enomem;
+    memset(d, 0, sizeof(*d));
+    if (jdoc_take(d, jp))
+        goto enomem;
+    d->root = root;
+    d->refs = 1;
+
+    *jd = d;
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    free(d);
+    return -1;
+}
+
+/* Get root node of json document made by jdoc_parse().
+ *
+ * In:
+ *      jd - ptr to json document object
+ * Return:
+ *      root node (JT_NONE for documents made by jdoc_create())
+ */
+jnode_t *jdoc_root(jdoc_t *jd)
+{
+    return jd->root;
+}
+
+// Copy string to document memory.
+static const char *jdoc_str(jdoc_t *jd, const char *s, size_t len)
+{
+    char *d = marena_alloc(jd->smem, len + 1);
+    if (d == NULL)
+        return NULL;
+    memcpy(d, s, len);
+    d[len] = 0;
+    return d;
+}
+
+// Copy json node with all its content to document memory.
+static jnode_t *jdoc_node(jdoc_t *jd, jnode_t *n)
+{
+    if (n->type == JT_NONE)
+        return &none;
+
+    bool inl = (n->type == JT_STR && n->str_len <= JSON_STR_INLINE);
+    bool packed = (n->type == JT_ARR && n->elts.packed != JT_NONE);
+
+    size_t ns = sizeof(jnode_t);
+    if (n->type == JT_OBJ)
+        ns = sizeof(jnode_obj_t);
+    else if (packed)
+        ns = sizeof(jnode_arr_t);
+    else if (inl)
+        ns = sizeof(jnode_str_t);
+    jnode_t *c = marena_alloc(jd->mem, ns);
+    if (c == NULL)
+        return NULL;
+    memset(c, 0, ns);
+    c->type = n->type;
+
+    if (inl) {
+        jnode_str_t *cstr = (jnode_str_t*)c;
+        memcpy(cstr->buf, n->str_val, (size_t)n->str_len + 1);
+        c->str_val = cstr->buf;
+        c->str_len = n->str_len;
+    } else if (n->type == JT_STR) {
+        c->str_val = jdoc_str(jd, n->str_val, (size_t)n->str_len);
+        if (c->str_val == NULL)
+            return NULL;
+        c->str_len = n->str_len;
+    } else if (packed) {
+        // only packed values are copied, element nodes are made on demand
+        jnode_arr_t *narr = (jnode_arr_t*)n;
+        jnode_arr_t *carr = (jnode_arr_t*)c;
+        size_t size = jn_row_size(narr) * (size_t)n->elts.count
+            * jn_val_size(n->elts.packed);
+        c->elts.ints = marena_alloc(jd->mem, size);
+        if (c->elts.ints == NULL)
+            return NULL;
+        memcpy(c->elts.ints, n->elts.ints, size);
+        c->flags = NF_ARR;
+        c->elts.count = n->elts.count;
+        c->elts.packed = n->elts.packed;
+        carr->mem = jd->mem;
+        carr->ndim = narr->ndim;
+        memcpy(carr->shape, narr->shape, sizeof(carr->shape));
+        carr->hash = narr->hash;
+    } else if (n->type == JT_ARR) {
+        int cnt = n->elts.count;
+        c->elts.count = cnt;
+        c->elts.values = marena_alloc(jd->mem,
+            (size_t)cnt * sizeof(c->elts.values[0]));
+        if (c->elts.values == NULL)
+            return NULL;
+        for (int i = 0; i < cnt; i++) {
+            c->elts.values[i] = jdoc_node(jd, n->elts.values[i]);
+            if (c->elts.values[i] == NULL)
+                return NULL;
+        }
+    } else if (n->type == JT_OBJ) {
+        // attribute names are added to name table of document
+        jnode_obj_t *cobj = (jnode_obj_t*)c;
+        int cnt = n->attrs.count;
+        c->attrs.count = cnt;
+        c->attrs.names = marena_alloc(jd->mem,
+            (size_t)cnt * sizeof(c->attrs.names[0]));
+        c->attrs.values = marena_alloc(jd->mem,
+            (size_t)cnt * sizeof(c->attrs.values[0]));
+        cobj->ant = jd->ant;
+        cobj->ht = ht_create(jd->mem, cnt);
+        if (!c->attrs.names || !c->attrs.values || !cobj->ht)
+            return NULL;
+        for (int i = 0; i < cnt; i++) {
+            const char *name = n->attrs.names[i];
+            int ani = ant_add(jd->ant, name, (uint)strlen(name));
+            if (ani < 0)
+                return NULL;
+            c->attrs.names[i] = jd->ant->an[ani];
+            ht_set(cobj->ht, (ani_t)ani, i);
+            c->attrs.values[i] = jdoc_node(jd, n->attrs.values[i]);
+            if (c->attrs.values[i] == NULL)
+                return NULL;
+        }
+        cobj->hash = ((jnode_obj_t*)n)->hash;
+    } else {
+        // scalar values
+        *c = *n;
+        c->flags = n->flags & NF_DECTXT;
+        if (n->num_txt) {
+            c->num_txt = jdoc_str(jd, n->num_txt, strlen(n->num_txt));
+            if (c->num_txt == NULL)
+                return NULL;
+        }
+    }
+
+    return c;
+}
+
+/* Copy json node with all its content to json document.
+ * Copy does not depend on memory of source node, so it stays valid
+ * after next call to jp_parse() or destruction of parser. Attribute
+ * names are stored in name table of document once per document.
+ *
+ * In:
+ *      jd - ptr to json document object
+ *      node - json node
+ * Return:
+ *      copy of json node or NULL on error
+ */
+jnode_t *jn_clone(jdoc_t *jd, jnode_t *node)
+{
+    jnode_t *c = jdoc_node(jd, node);
+    if (c == NULL)
+        ERROR("no memory");
+    return c;
+}
+
+
+/*****************************************************************************
+* Memory arenas for application data.
+*****************************************************************************/
+
+/* Create memory arena object.
+ * Arena allocates memory from big chunks, so allocation is fast and
+ * all memory is released at once by jarena_reset() or jarena_destroy().
+ *
+ * In:
+ *      size - size of memory chunks; if 0, then default value is used
+ * Return:
+ *      ptr to arena object or NULL on error
+ */
+jarena_t *jarena_create(size_t size)
+{
+    if (size < JSON_MEM_MIN)
+        size = JSON_MEM_MIN;
+
+    jarena_t *ja = marena_create(size);
+    if (ja == NULL)
+        ERROR("no memory");
+    return ja;
+}
+
+/* Destroy memory arena object and release all its memory.
+ * Must not be called for arenas of parser or document.
+ *
+ * In:
+ *      ja - ptr to arena object
+ */
+void jarena_destroy(jarena_t *ja)
+{
+    if (ja == NULL)
+        return;
+
+    marena_destroy(ja);
+}
+
+/* Release all memory allocated from arena.
+ * Must not be called for arenas of parser or document.
+ *
+ * In:
+ *      ja - ptr to arena object
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jarena_reset(jarena_t *ja)
+{
+    if (!marena_reset(ja, JSON_MEM_MIN)) {
+        ERROR("no memory");
+        return -1;
+    }
+    return 0;
+}
+
+/* Allocate memory from arena.
+ * Memory is aligned to size of pointer and need not to be freed.
+ *
+ * In:
+ *      ja - ptr to arena object
+ *      size - size of memory block
+ * Return:
+ *      ptr to memory block or NULL on error
+ */
+void *jarena_alloc(jarena_t *ja, size_t size)
+{
+    void *p = marena_alloc(ja, size);
+    if (p == NULL)
+        ERROR("no memory");
+    return p;
+}
+
+/* Copy string to memory allocated from arena.
+ *
+ * In:
+ *      ja - ptr to arena object
+ *      str - zero terminated string
+ * Return:
+ *      ptr to copy of string or NULL on error
+ */
+char *jarena_strdup(jarena_t *ja, const char *str)
+{
+    size_t len = strlen(str);
+    char *p = jarena_alloc(ja, len + 1);
+    if (p)
+        memcpy(p, str, len + 1);
+    return p;
+}
+
+/* Get memory arena of parser for application data.
+ * Memory allocated from it is released on next call to jp_parse(),
+ * together with parsed json nodes. Arena is separate from memory of
+ * json nodes, so it stays with parser when parsed tree is taken by
+ * jdoc_parse() and it is not released by jp_iter_next(), so data can
+ * be kept for all elements of iterated array.
+ *
+ * In:
+ *      jp - ptr to json parser object
+ * Return:
+ *      ptr to arena object
+ */
+jarena_t *jp_arena(jparser_t *jp)
+{
+    return jp->amem;
+}
+
+/* Get memory arena of document for application data.
+ * Memory allocated from it is released when document is destroyed.
+ * Arena is separate from memory of json nodes, so it is not changed
+ * when document is parsed again by jp_reparse().
+ *
+ * In:
+ *      jd - ptr to json document object
+ * Return:
+ *      ptr to arena object or NULL on error
+ */
+jarena_t *jdoc_arena(jdoc_t *jd)
+{
+    if (jd->amem == NULL) {
+        jd->amem = marena_create(JSON_MEM_MIN);
+        if (jd->amem == NULL)
+            ERROR("no memory");
+    }
+    return jd->amem;
+}
+
+
+/*****************************************************************************
+* Hash index on field of array of objects.
+*****************************************************************************/
+
+// Json index object.
+struct _jindex_t {
+    jnode_t *arr; // indexed array
+    jnode_t **keys; // key of each element (NULL if element has no key)
+    int *next; // next element with equal key for each element (-1 - none)
+    int *heads; // hash table of first elements with key (-1 - empty)
+    uint mask; // hash table size minus 1
+};
+
+// Get hash table slot of key (slot is empty if key is not in table).
+static uint jn_index_slot(jindex_t *ji, jnode_t *key)
+{
+    uint i = jn_hash_node(key) & ji->mask;
+    while (ji->heads[i] >= 0) {
+        if (jn_equal_node(ji->keys[ji->heads[i]], key))
+            break;
+        i = (i + 1) & ji->mask;
+    }
+    return i;
+}
+
+/* Build hash index of array of objects by value of object attribute.
+ * Index is allocated from memory arena and lives as long as its memory.
+ * Elements without attribute are not indexed. Keys are compared
+ * as by jn_equal() with significant order of attributes.
+ *
+ * In:
+ *      ja - ptr to arena object (see jp_arena(), jdoc_arena())
+ *      arr - json node of type JT_ARR
+ *      field - attribute name
+ * Return:
+ *      ptr to index object or NULL on error
+ */
+jindex_t *jn_index_build(jarena_t *ja, jnode_t *arr, const char *field)
+{
+    if (arr->type != JT_ARR) {
+        ERROR("node is not an array");
+        return NULL;
+    }
+
+    int cnt = arr->elts.count;
+    uint size = 16;
+    while (size < 2 * (uint)cnt)
+        size *= 2;
+
+    jindex_t *ji = marena_alloc(ja, sizeof(*ji));
+    if (ji == NULL)
+        goto enomem;
+    ji->arr = arr;
+    ji->mask = size - 1;
+    ji->keys = marena_alloc(ja, (size_t)cnt * sizeof(ji->keys[0]));
+    ji->next = marena_alloc(ja, (size_t)cnt * sizeof(ji->next[0]));
+    ji->heads = marena_alloc(ja, size * sizeof(ji->heads[0]));
+    if (!ji->keys || !ji->next || !ji->heads)
+        goto enomem;
+    memset(ji->heads, -1, size * sizeof(ji->heads[0]));
+
+    // elements are added from last one, so chains keep array order
+    for (int i = cnt - 1; i >= 0; i--) {
+        jnode_t *key = jn_attr(jn_elt(arr, i), field);
+        ji->next[i] = -1;
+        ji->keys[i] = NULL;
+        if (key->type == JT_NONE)
+            continue;
+        ji->keys[i] = key;
+        uint s = jn_index_slot(ji, key);
+        ji->next[i] = ji->heads[s];
+        ji->heads[s] = i;
+    }
+
+    return ji;
+
+enomem:
+    ERROR("no memory");
+    return NULL;
+}
+
+/* Find first element of indexed array with given key.
+ * Key of scalar type can be given by json node made by caller.
+ *
+ * In:
+ *      ji - ptr to index object
+ *      key - json node with key value
+ * Return:
+ *      index of element in array or -1 if there is none
+ */
+int jn_index_find(jindex_t *ji, jnode_t *key)
+{
+    return ji->heads[jn_index_slot(ji, key)];
+}
+
+/* Find next element of indexed array with the same key.
+ *
+ * In:
+ *      ji - ptr to index object
+ *      i - index of element found by jn_index_find() or jn_index_next()
+ * Return:
+ *      index of element in array or -1 if there is none
+ */
+int jn_index_next(jindex_t *ji, int i)
+{
+    return ji->next[i];
+}
+
+/* Join elements of array of objects with elements of indexed array.
+ * Callback is called for every pair of elements having equal keys.
+ * Elements of array go in array order and matching elements of
+ * indexed array go in their array order.
+ *
+ * In:
+ *      ji - ptr to index object (right side of join)
+ *      arr - json node of type JT_ARR (left side of join)
+ *      field - attribute name of key in elements of 'arr'
+ *      cb - callback; returns 0 to continue or !0 to stop joining
+ *      ctx - user context passed to callback
+ * Return:
+ *      0 - all pairs were joined
+ *      !0 - value returned by callback that stopped joining
+ */
+int jn_index_join(jindex_t *ji, jnode_t *arr, const char *field,
+    jn_join_t cb, void *ctx)
+{
+    if (arr->type != JT_ARR)
+        return 0;
+
+    for (int i = 0; i < arr->elts.count; i++) {
+        jnode_t *a = jn_elt(arr, i);
+        jnode_t *key = jn_attr(a, field);
+        if (key->type == JT_NONE)
+            continue;
+        for (int j = jn_index_find(ji, key); j >= 0; j = ji->next[j]) {
+            int ret = cb(a, jn_elt(ji->arr, j), ctx);
+            if (ret)
+                return ret;
+        }
+    }
+    return 0;
+}
+
+
+/*****************************************************************************
+* Sorting of arrays by keys.
+*****************************************************************************/
+
+// Ranks of sort key types (keys of different types are ordered by rank).
+enum {
+    JS_NONE, // absent value
+    JS_NULL, // null
+    JS_BOOL, // boolean
+    JS_NUM, // number
+    JS_STR, // string
+    JS_ARR, // array
+    JS_OBJ // object
+};
+
+// Sort key of array element.
+typedef struct {
+    union {
+        int i; // int or boolean key
+        double d; // number key
+        const char *s; // string key
+    };
+    int rank; // rank of key type
+    int idx; // element index
+} jskey;
+
+// Sort key comparison function.
+typedef int (*jscmp_t)(const jskey *a, const jskey *b);
+
+// Compare number keys.
+static int js_cmp_num(const jskey *a, const jskey *b)
+{
+    return (a->d > b->d) - (a->d < b->d);
+}
+
+// Compare string keys.
+static int js_cmp_str(const jskey *a, const jskey *b)
+{
+    return strcmp(a->s, b->s);
+}
+
+// Compare keys of any types.
+static int js_cmp_any(const jskey *a, const jskey *b)
+{
+    if (a->rank != b->rank)
+        return a->rank - b->rank;
+    if (a->rank == JS_BOOL)
+        return a->i - b->i;
+    if (a->rank == JS_NUM)
+        return js_cmp_num(a, b);
+    if (a->rank == JS_STR)
+        return js_cmp_str(a, b);
+    return 0;
+}
+
+// Convert number node to double.
+static double js_num(jnode_t *n)
+{
+    if (n->type == JT_INT)
+        return n->int_val;
+#if JSON_DOUBLE == 1
+    if (n->type == JT_DBL)
+        return n->dbl_val;
+#endif
+    if (jn_dec_txt(n))
+        return strtod(n->num_txt, NULL);
+
+    double d = (double)n->dec_val.mant;
+    for (int e = n->dec_val.exp; e > 0 && d != 0 && d < 1e308; e--)
+        d *= 10;
+    for (int e = n->dec_val.exp; e < 0 && d != 0; e++)
+        d /= 10;
+    return d;
+}
+
+// Make sort key from key node.
+static void js_key(jskey *k, jnode_t *n)
+{
+    switch (n->type) {
+    case JT_NONE:
+        k->rank = JS_NONE;
+        break;
+    case JT_NULL:
+        k->rank = JS_NULL;
+        break;
+    case JT_BOOL:
+        k->rank = JS_BOOL;
+        k->i = n->bool_val;
+        break;
+    case JT_INT:
+#if JSON_DOUBLE == 1
+    case JT_DBL:
+#endif
+    case JT_DEC:
+        k->rank = JS_NUM;
+        k->d = js_num(n);
+        break;
+    case JT_STR:
+        k->rank = JS_STR;
+        k->s = n->str_val;
+        break;
+    case JT_ARR:
+        k->rank = JS_ARR;
+        break;
+    case JT_OBJ:
+        k->rank = JS_OBJ;
+        break;
+    }
+}
+
+// Stable radix sort of int keys.
+static jskey *js_sort_int(jskey *k, jskey *tmp, int cnt, bool desc)
+{
+    for (int shift = 0; shift < 32; shift += 8) {
+        int pos[256] = {0};
+        for (int i = 0; i < cnt; i++) {
+            uint u = (uint)k[i].i ^ 0x80000000u;
+            pos[((desc ? ~u : u) >> shift) & 0xFF]++;
+        }
+
+        // pass is not needed if all keys have the same digit
+        bool skip = false;
+        for (int b = 0, sum = 0; b < 256; b++) {
+            skip |= (pos[b] == cnt);
+            int c = pos[b];
+            pos[b] = sum;
+            sum += c;
+        }
+        if (skip)
+            continue;
+
+        for (int i = 0; i < cnt; i++) {
+            uint u = (uint)k[i].i ^ 0x80000000u;
+            tmp[pos[((desc ? ~u : u) >> shift) & 0xFF]++] = k[i];
+        }
+        jskey *t = k;
+        k = tmp;
+        tmp = t;
+    }
+    return k;
+}
+
+// Stable merge sort of keys.
+static jskey *js_sort_cmp(jskey *k, jskey *tmp, int cnt, jscmp_t cmp,
+    bool desc)
+{
+    int dir = desc ? -1 : 1;
+
+    for (int w = 1; w < cnt; w *= 2) {
+        for (int lo = 0; lo < cnt; lo += 2 * w) {
+            int mid = (lo + w < cnt) ? lo + w : cnt;
+            int hi = (lo + 2 * w < cnt) ? lo + 2 * w : cnt;
+            int i = lo, j = mid, o = lo;
+            while (i < mid && j < hi)
+                tmp[o++] = (dir * cmp(&k[j], &k[i]) < 0) ? k[j++] : k[i++];
+            while (i < mid)
+                tmp[o++] = k[i++];
+            while (j < hi)
+                tmp[o++] = k[j++];
+        }
+        jskey *t = k;
+        k = tmp;
+        tmp = t;
+    }
+    return k;
+}
+
+// Move packed values of array node and of its rows to new place.
+static void jn_rebase(jnode_t *n, char *data)
+{
+    jnode_arr_t *narr = (jnode_arr_t*)n;
+    n->elts.ints = (int*)(void*)data;
+    if (narr->ndim > 1 && n->elts.values) {
+        size_t rs = jn_row_size(narr) * jn_val_size(n->elts.packed);
+        for (int i = 0; i < n->elts.count; i++)
+            jn_rebase(n->elts.values[i], data + (size_t)i * rs);
+    }
+}
+
+// Clear structural hash cached in object or array node.
+static void jn_hash_clear(jnode_t *n)
+{
+    if (n->type == JT_OBJ)
+        ((jnode_obj_t*)n)->hash = 0;
+    else if (n->type == JT_ARR && (n->flags & NF_ARR))
+        ((jnode_arr_t*)n)->hash = 0;
+}
+
+/* Sort array by keys taken from its elements.
+ * Keys are extracted once and sorted by algorithm chosen by their type:
+ * ints are sorted by radix sort, other keys by merge sort. Sorting is
+ * stable. Keys of different types are ordered as: absent, null,
+ * boolean, number, string, array, object; arrays and objects are
+ * not compared with each other.
+ * Array is changed in place: element nodes (rows of matrix too) are
+ * kept and only reordered, hashes cached in array and in nodes on the
+ * path to it are cleared. Array shared by several parents (see
+ * JP_DEDUP) is not sorted.
+ *
+ * In:
+ *      root - root node of tree
+ *      apath - json pointer to array relative to root; empty string
+ *              means root itself
+ *      path - json pointer to key relative to element ("/price",
+ *             "/meta/date"); empty string means element itself
+ *      flags - combination of JN_xxx values:
+ *          JN_DESC - sort in descending order
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jn_sort(jnode_t *root, const char *apath, const char *path, int flags)
+{
+    int ret = -1;
+    marena_t *mem = NULL;
+
+    if (*apath && *apath != '/') {
+        ERROR("invalid array path '%s'", apath);
+        goto exit;
+    }
+    if (*path && *path != '/') {
+        ERROR("invalid key path '%s'", path);
+        goto exit;
+    }
+
+    mem = marena_create(JSON_MEM_MIN);
+    if (mem == NULL)
+        goto enomem;
+
+    // find array and nodes on path to it
+    int depth = 0;
+    for (const char *p = apath; *p; p++)
+        depth += (*p == '/');
+    jnode_t **anc = marena_alloc(mem, (size_t)(depth + 1) * sizeof(anc[0]));
+    if (anc == NULL)
+        goto enomem;
+    anc[0] = root;
+    const char *ap = apath;
+    for (int d = 0; d < depth; d++) {
+        char *tok = jn_ptr_tok(mem, &ap);
+        if (tok == NULL)
+            goto exit;
+        int c = jn_ptr_child(anc[d], tok);
+        if (c < 0) {
+            ERROR("no array at '%s'", apath);
+            goto exit;
+        }
+        anc[d + 1] = jn_children(anc[d])[c];
+    }
+    for (int d = 0; d <= depth; d++) {
+        if (anc[d]->flags & NF_SHARED) {
+            ERROR("array is shared");
+            goto exit;
+        }
+    }
+
+    jnode_t *arr = anc[depth];
+    if (arr->type != JT_ARR) {
+        ERROR("node is not an array");
+        goto exit;
+    }
+
+    int cnt = arr->elts.count;
+    if (cnt < 2) {
+        ret = 0;
+        goto exit;
+    }
+
+    // plain packed array is sorted without making element nodes
+    jnode_t **values = arr->elts.values;
+    bool lazy = (values == NULL && arr->elts.packed != JT_NONE
+        && ((jnode_arr_t*)arr)->ndim == 1);
+    if (!lazy && (values = jn_children(arr)) == NULL)
+        goto exit;
+
+    // split key path to reference tokens
+    int ntok = 0;
+    for (const char *p = path; *p; p++)
+        ntok += (*p == '/');
+    char **toks = marena_alloc(mem, (size_t)ntok * sizeof(toks[0]));
+    if (toks == NULL)
+        goto enomem;
+    for (int t = 0; t < ntok; t++)
+        if ((toks[t] = jn_ptr_tok(mem, &path)) == NULL)
+            goto exit;
+
+    // extract keys
+    jskey *keys = marena_alloc(mem, 2 * (size_t)cnt * sizeof(keys[0]));
+    if (keys == NULL)
+        goto enomem;
+    bool ints = true, nums = true, strs = true;
+    for (int i = 0; i < cnt; i++) {
+        jnode_t e = {.type = arr->elts.packed};
+        if (lazy) {
+#if JSON_DOUBLE == 1
+            if (e.type == JT_DBL)
+                e.dbl_val = arr->elts.dbls[i];
+            else
+#endif
+                e.int_val = arr->elts.ints[i];
+        }
+        jnode_t *n = lazy ? &e : values[i];
+        for (int t = 0; t < ntok && n->type != JT_NONE; t++) {
+            int c = jn_ptr_child(n, toks[t]);
+            n = (c < 0) ? &none : jn_children(n)[c];
+        }
+        js_key(&keys[i], n);
+        keys[i].idx = i;
+        ints &= (n->type == JT_INT);
+        nums &= (keys[i].rank == JS_NUM);
+        strs &= (keys[i].rank == JS_STR);
+    }
+
+    // sort keys
+    bool desc = (flags & JN_DESC);
+    jskey *res;
+    if (ints) {
+        for (int i = 0; i < cnt; i++)
+            keys[i].i = (int)keys[i].d;
+        res = js_sort_int(keys, keys + cnt, cnt, desc);
+    } else {
+        jscmp_t cmp = nums ? js_cmp_num : strs ? js_cmp_str : js_cmp_any;
+        res = js_sort_cmp(keys, keys + cnt, cnt, cmp, desc);
+    }
+
+    // hashes of array and of its ancestors are changed
+    for (int d = 0; d <= depth; d++)
+        jn_hash_clear(anc[d]);
+
+    // reorder element nodes
+    if (!lazy) {
+        jnode_t **sorted = marena_alloc(mem, (size_t)cnt * sizeof(sorted[0]));
+        if (sorted == NULL)
+            goto enomem;
+        for (int i = 0; i < cnt; i++)
+            sorted[i] = values[res[i].idx];
+        memcpy(values, sorted, (size_t)cnt * sizeof(values[0]));
+    }
+
+    // reorder packed values
+    if (arr->elts.packed != JT_NONE) {
+        jnode_arr_t *narr = (jnode_arr_t*)arr;
+        size_t rs = jn_row_size(narr) * jn_val_size(arr->elts.packed);
+        char *data = (char*)arr->elts.ints;
+        char *buf = marena_alloc(mem, (size_t)cnt * rs);
+        if (buf == NULL)
+            goto enomem;
+        for (int i = 0; i < cnt; i++)
+            memcpy(buf + (size_t)i * rs, data + (size_t)res[i].idx * rs, rs);
+        memcpy(data, buf, (size_t)cnt * rs);
+
+        // rows of matrix point to packed values
+        if (narr->ndim > 1) {
+            for (int i = 0; i < cnt; i++)
+                jn_rebase(values[i], data + (size_t)i * rs);
+        }
+    }
+
+    ret = 0;
+
+exit:
+    if (mem)
+        marena_destroy(mem);
+    return ret;
+
+enomem:
+    ERROR("no memory");
+    goto exit;
+}
+
+
+/*****************************************************************************
+* Json scanner (reading of json tokens without building of nodes).
+*****************************************************************************/
+
+// Initial depth of scanner stack.
+#define JSON_SCAN_DEPTH 32
+
+// Scanner events.
+enum {
+    JSE_BEGIN, // array or object begins (token is '[' or '{')
+    JSE_END, // array or object ends
+    JSE_VALUE // scalar value (token is value)
+};
+
+// Stack element of scanner (describes path to current value).
+typedef struct {
+    jctx ctx; // context (array or object)
+    int idx; // index of current element
+    const char *name; // name of current attribute (not zero terminated)
+    uint nlen; // length of name
+    uint64_t match; // bit mask of paths matching path to container
+    uint plen; // length of path text of container
+} jsstk;
+
+// Json scanner object.
+typedef struct _jscan_t jscan_t;
+struct _jscan_t {
+    jparser_t jp; // tokenizer state
+    jsstk *stack; // stack
+    uint ssize; // stack size
+    uint depth; // current depth (0 - root value)
+    uint64_t match; // bit mask of paths matching current container
+    uint plen; // length of path text of current container
+    int stop; // event that stopped scanning plus 1 (0 - not stopped)
+    int (*cb)(jscan_t *js, int ev); // event callback (>0 - stop, <0 - error)
+    void *ctx; // user context
+};
+
+// Prepare scanner for scanning of json string.
+static void js_init(jscan_t *js, const char *json, size_t len)
+{
+    memset(&js->jp, 0, sizeof(js->jp));
+    js->jp.start = json;
+    js->jp.len = (uint)len;
+    js->depth = 0;
+    js->match = 0;
+    js->plen = 0;
+    js->stop = 0;
+}
+
+// Release scanner memory.
+static void js_free(jscan_t *js)
+{
+    free(js->stack);
+    js->stack = NULL;
+    js->ssize = 0;
+}
+
+/* Scan json string calling callback for every value.
+ * Any number of root values can follow each other (like in NDJSON).
+ * For events JSE_BEGIN and JSE_VALUE stack describes path to value,
+ * for JSE_END - path to array or object that ends. Before JSE_BEGIN
+ * callback sets 'match' and 'plen' of scanner for array or object that
+ * begins. If callback stops scanning (returns positive value), next call
+ * of js_scan() resumes it with the same event. Negative value returned
+ * by callback is error (callback reports it).
+ *
+ * Return:
+ *      0 - success
+ *      1 - scanning was stopped by callback
+ *      -1 - error
+ */
+static int js_scan(jscan_t *js)
+{
+    jparser_t *jp = &js->jp;
+    jtok *tok = &jp->tokc;
+    jsstk *s = js->depth ? &js->stack[js->depth - 1] : NULL;
+    int res;
+
+    // resume stopped scanning
+    int ev = js->stop - 1;
+    js->stop = 0;
+    if (ev == JSE_BEGIN)
+        goto begin;
+    if (ev == JSE_VALUE)
+        goto scalar;
+    if (ev == JSE_END)
+        goto end_cb;
+
+    jp_next(jp);
+
+value:
+    if (js->depth == 0 && tok->type == JINEND)
+        return 0;
+
+    // attribute name
+    if (s && s->ctx == CTXOBJ) {
+        if (tok->type != JNAME)
+            goto error;
+        s->name = jp->start + tok->pos;
+        s->nlen = tok->len;
+        jp_next(jp);
+    }
+
+    // array or object
+    if (tok->type == JASTART || tok->type == JOSTART) {
+begin:
+        js->match = 0;
+        js->plen = 0;
+        ev = JSE_BEGIN;
+        if ((res = js->cb(js, ev)) != 0)
+            goto stop;
+        if (js->depth >= js->ssize) {
+            uint size = js->ssize ? js->ssize * 2 : JSON_SCAN_DEPTH;
+            jsstk *p = realloc(js->stack, size * sizeof(p[0]));
+            if (p == NULL) {
+                ERROR("no memory");
+                return -1;
+            }
+            js->stack = p;
+            js->ssize = size;
+        }
+        s = &js->stack[js->depth++];
+        s->ctx = (tok->type == JASTART) ? CTXARR : CTXOBJ;
+        s->idx = 0;
+        s->name = NULL;
+        s->nlen = 0;
+        s->match = js->match;
+        s->plen = js->plen;
+        jp_next(jp);
+        if (tok->type == (s->ctx == CTXARR ? JAEND : JOEND))
+            goto end;
+        goto value;
+    }
+
+    // scalar value
+    if (tok->type < JNULL || tok->type > JSTR)
+        goto error;
+scalar:
+    ev = JSE_VALUE;
+    if ((res = js->cb(js, ev)) != 0)
+        goto stop;
+
+next:
+    jp_next(jp);
+    if (js->depth == 0)
+        goto value;
+    if (tok->type == JCOMMA) {
+        s->idx++;
+        jp_next(jp);
+        goto value;
+    }
+    if (tok->type != (s->ctx == CTXARR ? JAEND : JOEND))
+        goto error;
+
+end:
+    js->depth--;
+    s = js->depth ? &js->stack[js->depth - 1] : NULL;
+end_cb:
+    ev = JSE_END;
+    if ((res = js->cb(js, ev)) != 0)
+        goto stop;
+    goto next;
+
+stop:
+    if (res < 0)
+        return -1;
+    js->stop = ev + 1;
+    return 1;
+
+error:
+    ERROR("unexpected token at position %u", jp->pos);
+    return -1;
+}
+
+// Check if path token matches current element of stack.
+static bool js_tok_match(jsstk *s, const char *tok)
+{
+    if (tok[0] == '*' && tok[1] == 0)
+        return true;
+
+    if (s->ctx == CTXARR) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d", s->idx);
+        return 0 == strcmp(buf, tok);
+    }
+
+    // names with escapes are compared after unescaping
+    const char *name = s->name;
+    uint len = s->nlen;
+    char buf[256];
+    if (memchr(name, '\\', len) && len < sizeof(buf)) {
+        len = jp_unescape(buf, name, len);
+        name = buf;
+    }
+    return (0 == strncmp(name, tok, len) && tok[len] == 0);
+}
+
+// Read number token of scanner.
+// Json string need not be zero terminated, so token text is copied.
+static double js_tok_num(jscan_t *js)
+{
+    jtok *tok = &js->jp.tokc;
+    char buf[64];
+    char *p = (tok->len < sizeof(buf)) ? buf : malloc(tok->len + 1);
+    if (p == NULL) {
+        ERROR("no memory");
+        return 0;
+    }
+    memcpy(p, js->jp.start + tok->pos, tok->len);
+    p[tok->len] = 0;
+
+    double v = (tok->type == JINT) ? atoi(p) : strtod(p, NULL);
+    if (p != buf)
+        free(p);
+    return v;
+}
+
+
+/*****************************************************************************
+* Streaming aggregations.
+*****************************************************************************/
+
+// Maximum number of aggregated paths.
+#define JSON_AGG_MAX 64
+
+// Aggregated path.
+typedef struct {
+    char **toks; // reference tokens of path
+    int ntok; // number of tokens
+    int ops; // aggregate operators (JAGG_xxx)
+
+    // results
+    double count; // count of numbers
+    double sum; // sum of numbers
+    double min; // minimal number
+    double max; // maximal number
+
+    // histogram
+    long *bins; // counts of numbers in bins
+    int nbins; // number of bins
+    double lo; // low bound of first bin
+    double hi; // high bound of last bin
+} jagg_path;
+
+// Aggregation object.
+struct _jagg_t {
+    marena_t *mem; // memory allocator
+    jscan_t js; // json scanner
+    jagg_path paths[JSON_AGG_MAX]; // aggregated paths
+    int cnt; // number of paths
+};
+
+/* Create aggregation object.
+ * Aggregation computes statistics of numbers found at given paths
+ * while json is tokenized; json tree is not built.
+ *
+ * In:
+ *      ja[out] - address of ptr to aggregation object
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jagg_create(jagg_t **ja)
+{
+    jagg_t *a = malloc(sizeof(*a));
+    if (a == NULL)
+        goto enomem;
+    memset(a, 0, sizeof(*a));
+
+    a->mem = marena_create(JSON_MEM_MIN);
+    if (a->mem == NULL)
+        goto enomem;
+
+    *ja = a;
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    free(a);
+    return -1;
+}
+
+/* Destroy aggregation object.
+ *
+ * In:
+ *      ja - ptr to aggregation object
+ */
+void jagg_destroy(jagg_t *ja)
+{
+    if (ja == NULL)
+        return;
+
+    js_free(&ja->js);
+    marena_destroy(ja->mem);
+    free(ja);
+}
+
+/* Add path to aggregation.
+ * Path is a json pointer where reference token "*" matches any array
+ * element or object attribute. Empty path matches root values.
+ *
+ * In:
+ *      ja - ptr to aggregation object
+ *      path - json pointer to numbers
+ *      ops - combination of aggregate operators JAGG_xxx
+ * Return:
+ *      path id (>= 0) or -1 on error
+ */
+int jagg_add(jagg_t *ja, const char *path, int ops)
+{
+    if (ja->cnt >= JSON_AGG_MAX) {
+        ERROR("too many paths");
+        return -1;
+    }
+    if (*path && *path != '/') {
+        ERROR("invalid path '%s'", path);
+        return -1;
+    }
+
+    jagg_path *p = &ja->paths[ja->cnt];
+    memset(p, 0, sizeof(*p));
+    p->ops = ops;
+    for (const char *s = path; *s; s++)
+        p->ntok += (*s == '/');
+    p->toks = marena_alloc(ja->mem, (size_t)p->ntok * sizeof(p->toks[0]));
+    if (p->toks == NULL)
+        goto enomem;
+    for (int i = 0; i < p->ntok; i++)
+        if ((p->toks[i] = jn_ptr_tok(ja->mem, &path)) == NULL)
+            return -1;
+
+    return ja->cnt++;
+
+enomem:
+    ERROR("no memory");
+    return -1;
+}
+
+/* Set histogram bins of aggregated path (JAGG_HIST operator).
+ * Range [lo, hi) is split into bins of equal width; numbers out of range
+ * are counted in first or last bin.
+ *
+ * In:
+ *      ja - ptr to aggregation object
+ *      id - path id
+ *      lo, hi - range of histogram
+ *      bins - number of bins
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jagg_hist(jagg_t *ja, int id, double lo, double hi, int bins)
+{
+    if (id < 0 || id >= ja->cnt || bins <= 0 || !(lo < hi)) {
+        ERROR("invalid histogram");
+        return -1;
+    }
+
+    jagg_path *p = &ja->paths[id];
+    p->bins = marena_alloc(ja->mem, (size_t)bins * sizeof(p->bins[0]));
+    if (p->bins == NULL) {
+        ERROR("no memory");
+        return -1;
+    }
+    memset(p->bins, 0, (size_t)bins * sizeof(p->bins[0]));
+    p->nbins = bins;
+    p->lo = lo;
+    p->hi = hi;
+    p->ops |= JAGG_HIST;
+    return 0;
+}
+
+// Get bit mask of paths matching path to current value of scanner.
+static uint64_t jagg_match(jagg_t *ja)
+{
+    jscan_t *js = &ja->js;
+    if (js->depth == 0)
+        return ~(uint64_t)0;
+
+    jsstk *s = &js->stack[js->depth - 1];
+    uint64_t m = s->match;
+    for (int i = 0; i < ja->cnt; i++) {
+        uint64_t b = (uint64_t)1 << i;
+        if ((m & b) && (ja->paths[i].ntok < (int)js->depth
+                || !js_tok_match(s, ja->paths[i].toks[js->depth - 1])))
+            m &= ~b;
+    }
+    return m;
+}
+
+// Add number to aggregated path.
+static void jagg_num(jagg_path *p, double v)
+{
+    if (p->count == 0 || v < p->min)
+        p->min = v;
+    if (p->count == 0 || v > p->max)
+        p->max = v;
+    p->count++;
+    p->sum += v;
+
+    if (p->nbins) {
+        double w = (p->hi - p->lo) / p->nbins;
+        int b = (v < p->lo) ? 0 : (int)((v - p->lo) / w);
+        if (b >= p->nbins)
+            b = p->nbins - 1;
+        p->bins[b]++;
+    }
+}
+
+// Scanner callback of aggregation.
+static int jagg_cb(jscan_t *js, int ev)
+{
+    jagg_t *ja = js->ctx;
+
+    if (ev == JSE_BEGIN) {
+        js->match = jagg_match(ja);
+        return 0;
+    }
+
+    // only numbers at matching paths are converted
+    if (ev != JSE_VALUE || (js->jp.tokc.type != JINT
+            && js->jp.tokc.type != JDBL))
+        return 0;
+    uint64_t m = jagg_match(ja);
+    if (m == 0)
+        return 0;
+
+    double v = js_tok_num(js);
+    for (int i = 0; i < ja->cnt; i++)
+        if ((m & ((uint64_t)1 << i)) && ja->paths[i].ntok == (int)js->depth)
+            jagg_num(&ja->paths[i], v);
+    return 0;
+}
+
+/* Aggregate numbers of json string.
+ * Results are accumulated over all calls. String can contain any
+ * number of json values (like NDJSON), so big input can be given
+ * by parts consisting of whole values.
+ *
+ * In:
+ *      ja - ptr to aggregation object
+ *      json - ptr to json string
+ *      len - length of json string
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jagg_run(jagg_t *ja, const char *json, size_t len)
+{
+    js_init(&ja->js, json, len);
+    ja->js.cb = jagg_cb;
+    ja->js.ctx = ja;
+    return js_scan(&ja->js);
+}
+
+/* Get result of aggregate operator.
+ *
+ * In:
+ *      ja - ptr to aggregation object
+ *      id - path id
+ *      op - one of JAGG_COUNT, JAGG_SUM, JAGG_MIN, JAGG_MAX, JAGG_AVG
+ * Return:
+ *      result or 0 if there were no numbers or operator was not requested
+ */
+double jagg_get(jagg_t *ja, int id, int op)
+{
+    if (id < 0 || id >= ja->cnt)
+        return 0;
+
+    jagg_path *p = &ja->paths[id];
+    if (!(p->ops & op) || p->count == 0)
+        return 0;
+    if (op == JAGG_COUNT)
+        return p->count;
+    if (op == JAGG_SUM)
+        return p->sum;
+    if (op == JAGG_MIN)
+        return p->min;
+    if (op == JAGG_MAX)
+        return p->max;
+    if (op == JAGG_AVG)
+        return p->sum / p->count;
+    return 0;
+}
+
+/* Get histogram of aggregated path.
+ *
+ * In:
+ *      ja - ptr to aggregation object
+ *      id - path id
+ *      bins[out] - number of bins
+ * Return:
+ *      ptr to counts of numbers in bins or NULL if there is no histogram
+ */
+const long *jagg_bins(jagg_t *ja, int id, int *bins)
+{
+    if (id < 0 || id >= ja->cnt || ja->paths[id].nbins == 0)
+        return NULL;
+
+    *bins = ja->paths[id].nbins;
+    return ja->paths[id].bins;
+}
+
+/* Clear results of aggregation.
+ *
+ * In:
+ *      ja - ptr to aggregation object
+ */
+void jagg_reset(jagg_t *ja)
+{
+    for (int i = 0; i < ja->cnt; i++) {
+        jagg_path *p = &ja->paths[i];
+        p->count = p->sum = p->min = p->max = 0;
+        if (p->nbins)
+            memset(p->bins, 0, (size_t)p->nbins * sizeof(p->bins[0]));
+    }
+}
+
+
+/*****************************************************************************
+* Pre-filter of json by attribute value.
+*****************************************************************************/
+
+// Json filter object.
+struct _jfilter_t {
+    char *key; // attribute name with quotes
+    size_t klen; // length of key
+    size_t anchor; // offset of the rarest character of key
+    char *val; // json text of value (NULL - any value)
+    size_t vlen; // length of value
+};
+
+// Get rough frequency class of character in json text (1 - rare).
+static int jfilter_freq(uchar c)
+{
+    if (c == '"' || c == ' ' || c == ':' || c == ',')
+        return 4;
+    if (c >= 'a' && c <= 'z')
+        return strchr("etaoinsrlcdhu", c) ? 3 : 2;
+    if (c >= '0' && c <= '9')
+        return 2;
+    return 1;
+}
+
+/* Create json filter object.
+ * Filter finds json having attribute with given name and value without
+ * parsing of json. Name and value are compared with json text as is,
+ * so they must be written the same way as in json (value 5 does not
+ * match 5.0, name or string with escapes must be escaped the same way).
+ *
+ * In:
+ *      jf[out] - address of ptr to json filter object
+ *      name - attribute name (without quotes)
+ *      value - json text of attribute value (for example "\"error\"",
+ *              "5", "true"); if NULL, then any value matches
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jfilter_create(jfilter_t **jf, const char *name, const char *value)
+{
+    jfilter_t *f = malloc(sizeof(*f));
+    if (f == NULL)
+        goto enomem;
+    memset(f, 0, sizeof(*f));
+
+    f->klen = strlen(name) + 2;
+    f->key = malloc(f->klen + 1);
+    if (f->key == NULL)
+        goto enomem;
+    snprintf(f->key, f->klen + 1, "\"%s\"", name);
+
+    // search is anchored on the rarest character of name
+    f->anchor = 1;
+    for (size_t i = 2; i + 1 < f->klen; i++) {
+        int r = jfilter_freq((uchar)f->key[i]);
+        if (r < jfilter_freq((uchar)f->key[f->anchor]))
+            f->anchor = i;
+    }
+
+    if (value) {
+        f->vlen = strlen(value);
+        f->val = malloc(f->vlen + 1);
+        if (f->val == NULL)
+            goto enomem;
+        memcpy(f->val, value, f->vlen + 1);
+    }
+
+    *jf = f;
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    jfilter_destroy(f);
+    return -1;
+}
+
+/* Destroy json filter object.
+ *
+ * In:
+ *      jf - ptr to json filter object
+ */
+void jfilter_destroy(jfilter_t *jf)
+{
+    if (jf == NULL)
+        return;
+
+    free(jf->key);
+    free(jf->val);
+    free(jf);
+}
+
+// Check that key found in json is attribute name with required value.
+static bool jfilter_check(jfilter_t *jf, const char *json, const char *k,
+    const char *e)
+{
+    // quote must not be escaped
+    const char *p = k;
+    while (p > json && p[-1] == '\\')
+        p--;
+    if ((k - p) & 1)
+        return false;
+
+    // attribute name follows object start or comma
+    p = k;
+    while (p > json && ct[(uchar)p[-1]] == CBL)
+        p--;
+    if (p == json || (p[-1] != '{' && p[-1] != ','))
+        return false;
+
+    // colon follows attribute name
+    p = k + jf->klen;
+    while (p < e && ct[(uchar)*p] == CBL)
+        p++;
+    if (p >= e || *p != ':')
+        return false;
+    for (p++; p < e && ct[(uchar)*p] == CBL; p++)
+        ;
+
+    // value
+    if (jf->val == NULL)
+        return true;
+    if ((size_t)(e - p) < jf->vlen || memcmp(p, jf->val, jf->vlen))
+        return false;
+
+    // value that is not string must not continue
+    p += jf->vlen;
+    if (jf->val[0] == '"' || p >= e)
+        return true;
+    int t = ct[(uchar)*p];
+    return (t != CNM && t != CLT && t != CPT && t != CMN);
+}
+
+/* Check if json has attribute with name and value given by filter.
+ * Candidate positions are found by fast search of the rarest character
+ * of attribute name (memchr() is vectorized in common C libraries), so
+ * few of them are checked for the whole quoted name and text around it.
+ * Attributes are found at any nesting level. Json is not validated, so
+ * this function is meant as pre-filter before jp_parse().
+ *
+ * In:
+ *      jf - ptr to json filter object
+ *      json - ptr to json string
+ *      len - length of json string
+ * Return:
+ *      true if json has such attribute
+ */
+bool jfilter_match(jfilter_t *jf, const char *json, size_t len)
+{
+    const char *e = json + len;
+    const char *p = json + jf->anchor;
+    char c = jf->key[jf->anchor];
+
+    while (p < e) {
+        p = memchr(p, c, (size_t)(e - p));
+        if (p == NULL)
+            break;
+
+        const char *k = p - jf->anchor;
+        if ((size_t)(e - k) >= jf->klen
+                && 0 == memcmp(k, jf->key, jf->klen)
+                && jfilter_check(jf, json, k, e))
+            return true;
+        p++;
+    }
+
+    return false;
+}
+
+
+/*****************************************************************************
+* Flattening of json into path/value pairs.
+*****************************************************************************/
+
+// Json flattener object.
+struct _jflat_t {
+    jscan_t js; // json scanner
+    int flags; // flattener flags (JFLAT_xxx)
+    char *sep; // path separator
+    uint slen; // length of path separator
+    int done; // scanning result (1 - not finished yet)
+    int prev; // previous scanner event
+
+    // path of current value
+    char *path; // path text
+    uint len; // path length
+    uint cap; // capacity of path buffer
+
+    // caller buffers
+    jleaf_t *leaves; // leaves
+    int cnt; // count of filled leaves
+    int max; // capacity of leaves
+    char *buf; // text buffer
+    size_t used; // used size of text buffer
+    size_t size; // size of text buffer
+};
+
+/* Create json flattener object.
+ * Flattener reads json without building of nodes and gives every leaf
+ * value (scalar, empty array or empty object) with its path. Path
+ * consists of attribute names and array indexes joined by separator,
+ * for example "items.0.price" or "items[0].price" (JFLAT_BRACKETS).
+ *
+ * In:
+ *      jf[out] - address of ptr to json flattener object
+ *      sep - path separator; if NULL, then "." is used
+ *      flags - combination of JFLAT_xxx values:
+ *          JFLAT_BRACKETS - array indexes are written as "[i]"
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jflat_create(jflat_t **jf, const char *sep, int flags)
+{
+    if (sep == NULL)
+        sep = ".";
+
+    jflat_t *f = malloc(sizeof(*f));
+    if (f == NULL)
+        goto enomem;
+    memset(f, 0, sizeof(*f));
+    f->flags = flags;
+
+    f->slen = (uint)strlen(sep);
+    f->sep = malloc(f->slen + 1);
+    if (f->sep == NULL)
+        goto enomem;
+    memcpy(f->sep, sep, f->slen + 1);
+
+    f->cap = 256;
+    f->path = malloc(f->cap);
+    if (f->path == NULL)
+        goto enomem;
+
+    *jf = f;
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    jflat_destroy(f);
+    return -1;
+}
+
+/* Destroy json flattener object.
+ *
+ * In:
+ *      jf - ptr to json flattener object
+ */
+void jflat_destroy(jflat_t *jf)
+{
+    if (jf == NULL)
+        return;
+
+    js_free(&jf->js);
+    free(jf->sep);
+    free(jf->path);
+    free(jf);
+}
+
+// Write array index in decimal form.
+static char *jflat_idx(char *p, int i)
+{
+    char buf[16];
+    int n = 0;
+    do {
+        buf[n++] = (char)('0' + i % 10);
+        i /= 10;
+    } while (i);
+    while (n)
+        *p++ = buf[--n];
+    return p;
+}
+
+// Make path of current value from path of its container.
+static int jflat_path(jflat_t *jf)
+{
+    jscan_t *js = &jf->js;
+    if (js->depth == 0) {
+        jf->len = 0;
+        jf->path[0] = 0;
+        return 0;
+    }
+
+    jsstk *s = &js->stack[js->depth - 1];
+    uint need = s->plen + jf->slen + s->nlen + 16;
+    if (need > jf->cap) {
+        uint cap = jf->cap;
+        while (cap < need)
+            cap *= 2;
+        char *p = realloc(jf->path, cap);
+        if (p == NULL) {
+            ERROR("no memory");
+            return -1;
+        }
+        jf->path = p;
+        jf->cap = cap;
+    }
+
+    // path of container is kept, only last component is changed
+    char *p = jf->path + s->plen;
+    if (s->ctx == CTXARR && (jf->flags & JFLAT_BRACKETS)) {
+        *p++ = '[';
+        p = jflat_idx(p, s->idx);
+        *p++ = ']';
+    } else {
+        if (s->plen) {
+            memcpy(p, jf->sep, jf->slen);
+            p += jf->slen;
+        }
+        if (s->ctx == CTXARR)
+            p = jflat_idx(p, s->idx);
+        else
+            p += jp_unescape(p, s->name, s->nlen);
+    }
+    *p = 0;
+    jf->len = (uint)(p - jf->path);
+    return 0;
+}
+
+// Store leaf with current path to caller buffers.
+// Return 1 if there is no room for leaf.
+static int jflat_leaf(jflat_t *jf, jtype_t type)
+{
+    jtok *tok = &jf->js.jp.tokc;
+    const char *txt = jf->js.jp.start + tok->pos;
+
+    size_t need = jf->len + 1;
+    if (type == JT_STR || type == JT_DEC)
+        need += tok->len + 1;
+    if (jf->cnt >= jf->max || jf->used + need > jf->size)
+        return 1;
+
+    jleaf_t *l = &jf->leaves[jf->cnt++];
+    char *p = jf->buf + jf->used;
+    jf->used += need;
+    memcpy(p, jf->path, jf->len + 1);
+    l->path = p;
+    l->path_len = (int)jf->len;
+    p += jf->len + 1;
+
+    jnode_t *v = &l->value;
+    memset(v, 0, sizeof(*v));
+    v->type = type;
+    if (type == JT_BOOL) {
+        v->bool_val = ((*txt | 0x20) == 't');
+    } else if (type == JT_INT) {
+        v->int_val = (int)js_tok_num(&jf->js);
+#if JSON_DOUBLE == 1
+    } else if (type == JT_DBL) {
+        v->dbl_val = js_tok_num(&jf->js);
+#endif
+    } else if (type == JT_DEC) {
+        // number out of int range is given by text
+        memcpy(p, txt, tok->len);
+        p[tok->len] = 0;
+        v->num_txt = p;
+        v->flags = NF_DECTXT;
+    } else if (type == JT_STR) {
+        v->str_len = (int)jp_unescape(p, txt, tok->len);
+        v->str_val = p;
+    }
+    return 0;
+}
+
+// Scanner callback of flattener.
+// Return 1 if buffers are full (scanning is resumed by next call of
+// jflat_next()) or -1 on error (flattening is finished).
+static int jflat_cb(jscan_t *js, int ev)
+{
+    jflat_t *jf = js->ctx;
+
+    if (ev == JSE_BEGIN) {
+        if (jflat_path(jf))
+            return -1;
+        js->plen = jf->len;
+    } else if (ev == JSE_END) {
+        // empty array or object is a leaf
+        if (jf->prev == JSE_BEGIN) {
+            jsstk *s = &js->stack[js->depth];
+            jf->len = s->plen;
+            jf->path[jf->len] = 0;
+            if (jflat_leaf(jf, s->ctx == CTXARR ? JT_ARR : JT_OBJ))
+                return 1;
+        }
+    } else {
+        static const jtype_t types[] = {
+            [JNULL] = JT_NULL,
+            [JBOOL] = JT_BOOL,
+            [JINT] = JT_INT,
+#if JSON_DOUBLE == 1
+            [JDBL] = JT_DBL,
+#else
+            [JDBL] = JT_DEC,
+#endif
+            [JSTR] = JT_STR
+        };
+        if (jflat_path(jf))
+            return -1;
+        if (jflat_leaf(jf, types[js->jp.tokc.type]))
+            return 1;
+    }
+
+    jf->prev = ev;
+    return 0;
+}
+
+/* Start flattening of json string.
+ * String can contain any number of json values (like NDJSON).
+ * String must not be changed until flattening is finished.
+ *
+ * In:
+ *      jf - ptr to json flattener object
+ *      json - ptr to json string
+ *      len - length of json string
+ */
+void jflat_begin(jflat_t *jf, const char *json, size_t len)
+{
+    js_init(&jf->js, json, len);
+    jf->js.cb = jflat_cb;
+    jf->js.ctx = jf;
+    jf->done = 1;
+    jf->prev = JSE_VALUE;
+    jf->len = 0;
+    jf->path[0] = 0;
+}
+
+/* Get next leaves of json being flattened.
+ * Leaves are stored to caller buffers: paths and string values are
+ * stored in text buffer and are zero terminated. Buffers are filled
+ * as much as possible; next call continues from next leaf.
+ *
+ * In:
+ *      jf - ptr to json flattener object
+ *      leaves - buffer for leaves
+ *      cnt - capacity of buffer for leaves
+ *      buf - text buffer
+ *      size - size of text buffer
+ * Return:
+ *      number of stored leaves (0 - json is finished) or -1 on error
+ */
+int jflat_next(jflat_t *jf, jleaf_t *leaves, int cnt, char *buf, size_t size)
+{
+    if (jf->done <= 0)
+        return jf->done;
+
+    jf->leaves = leaves;
+    jf->cnt = 0;
+    jf->max = cnt;
+    jf->buf = buf;
+    jf->used = 0;
+    jf->size = size;
+
+    int res = js_scan(&jf->js);
+    if (res > 0 && jf->cnt == 0) {
+        ERROR("buffers are too small");
+        res = -1;
+    }
+    if (res <= 0)
+        jf->done = res;
+
+    // leaves before error are given first
+    return jf->cnt ? jf->cnt : jf->done;
+}
+
+
+/*****************************************************************************
+* Conversion of json to CSV.
+*****************************************************************************/
+
+// Maximum number of CSV columns.
+#define JSON_CSV_MAX 64
+
+// CSV column.
+typedef struct {
+    const char *name; // column name (path without leading '/')
+    char **toks; // reference tokens of path
+    int ntok; // number of tokens
+
+    // cell of current row
+    const char *txt; // value text in json string
+    uint len; // length of value text
+    jtt type; // value token type (JINSTART - no value)
+    uint depth; // depth of container that is not finished yet (0 - none)
+} jcsv_col;
+
+// CSV converter object.
+struct _jcsv_t {
+    marena_t *mem; // memory allocator
+    jscan_t js; // json scanner
+    jcsv_col cols[JSON_CSV_MAX]; // columns
+    int cnt; // number of columns
+    char sep; // field separator
+    int flags; // converter flags (JCSV_xxx)
+    int done; // scanning result (1 - not finished yet)
+    bool hdr; // header is not written yet
+    uint rdepth; // depth of values of current row (0 - not in row)
+    int open; // number of unfinished container cells
+    char *tmp; // buffer for unescaped strings
+    uint tsize; // size of buffer for unescaped strings
+
+    // output buffer
+    char *buf; // buffer
+    size_t used; // used size
+    size_t size; // size
+};
+
+/* Create CSV converter object.
+ * Converter reads arrays of objects (or sequences of objects like in
+ * NDJSON) and writes one CSV row per object without building of json
+ * tree. Columns are given by paths relative to row objects.
+ *
+ * In:
+ *      jc[out] - address of ptr to CSV converter object
+ *      sep - field separator (',' for CSV, '\t' for TSV)
+ *      flags - combination of JCSV_xxx values:
+ *          JCSV_HEADER - first row contains column names
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jcsv_create(jcsv_t **jc, char sep, int flags)
+{
+    jcsv_t *c = malloc(sizeof(*c));
+    if (c == NULL)
+        goto enomem;
+    memset(c, 0, sizeof(*c));
+    c->sep = sep;
+    c->flags = flags;
+
+    c->mem = marena_create(JSON_MEM_MIN);
+    if (c->mem == NULL)
+        goto enomem;
+
+    *jc = c;
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    free(c);
+    return -1;
+}
+
+/* Destroy CSV converter object.
+ *
+ * In:
+ *      jc - ptr to CSV converter object
+ */
+void jcsv_destroy(jcsv_t *jc)
+{
+    if (jc == NULL)
+        return;
+
+    js_free(&jc->js);
+    marena_destroy(jc->mem);
+    free(jc->tmp);
+    free(jc);
+}
+
+/* Add column to CSV converter.
+ * Path is a json pointer relative to row object. Arrays and objects
+ * found at path are written as json text.
+ *
+ * In:
+ *      jc - ptr to CSV converter object
+ *      path - json pointer to column value
+ * Return:
+ *      column index (>= 0) or -1 on error
+ */
+int jcsv_add(jcsv_t *jc, const char *path)
+{
+    if (jc->cnt >= JSON_CSV_MAX) {
+        ERROR("too many columns");
+        return -1;
+    }
+    if (*path != '/') {
+        ERROR("invalid path '%s'", path);
+        return -1;
+    }
+
+    jcsv_col *c = &jc->cols[jc->cnt];
+    memset(c, 0, sizeof(*c));
+    c->name = jarena_strdup(jc->mem, path + 1);
+    if (c->name == NULL)
+        goto enomem;
+    for (const char *s = path; *s; s++)
+        c->ntok += (*s == '/');
+    c->toks = marena_alloc(jc->mem, (size_t)c->ntok * sizeof(c->toks[0]));
+    if (c->toks == NULL)
+        goto enomem;
+    for (int i = 0; i < c->ntok; i++)
+        if ((c->toks[i] = jn_ptr_tok(jc->mem, &path)) == NULL)
+            return -1;
+
+    return jc->cnt++;
+
+enomem:
+    ERROR("no memory");
+    return -1;
+}
+
+// Write CSV field to output buffer.
+// Return false if there is no room for field.
+static bool jcsv_field(jcsv_t *jc, const char *s, uint len)
+{
+    // check if field needs quoting
+    bool quote = false;
+    uint nq = 0;
+    for (uint i = 0; i < len; i++) {
+        char c = s[i];
+        if (c == '"' || c == jc->sep || c == '\n' || c == '\r') {
+            quote = true;
+            nq += (c == '"');
+        }
+    }
+
+    size_t need = len + nq + (quote ? 2 : 0);
+    if (jc->used + need > jc->size)
+        return false;
+
+    char *d = jc->buf + jc->used;
+    if (quote)
+        *d++ = '"';
+    if (nq == 0) {
+        memcpy(d, s, len);
+        d += len;
+    } else {
+        for (uint i = 0; i < len; i++) {
+            if (s[i] == '"')
+                *d++ = '"';
+            *d++ = s[i];
+        }
     }
+    if (quote)
+        *d++ = '"';
+    jc->used = (size_t)(d - jc->buf);
+    return true;
+}
 
-    // check for 'false'
-    if ((t == CLT) && (pos + 5 <= len) && jp_cmpi(jsn + pos, "false")) {
-        tok->type = JBOOL;
-        tok->pos = pos;
-        tok->len = 5;
-        pos += 5;
-        goto exit;
+// Write string value with json escapes to output buffer.
+static bool jcsv_str(jcsv_t *jc, const char *s, uint len)
+{
+    if (len + 1 > jc->tsize) {
+        char *t = realloc(jc->tmp, len + 1);
+        if (t == NULL)
+            return false;
+        jc->tmp = t;
+        jc->tsize = len + 1;
     }
+    len = jp_unescape(jc->tmp, s, len);
+    return jcsv_field(jc, jc->tmp, len);
+}
 
-    // check for object attribute name without quotes
-    if (t == CLT) {
-        tok->type = JNAME;
-        tok->pos = pos++;
-        tok->len = 1;
-        for (; pos < len; pos++) {
-            t = ct[jsn[pos]];
-            if (t != CLT && t != CNM)
-                break;
-            tok->len++;
-        }
-        for (; pos < len; pos++) {
-            t = ct[jsn[pos]];
-            if (t != CBL)
-                break;
+// Write current row (or header) to output buffer.
+// Return false if there is no room for row.
+static bool jcsv_row(jcsv_t *jc, bool hdr)
+{
+    size_t used = jc->used;
+    for (int i = 0; i < jc->cnt; i++) {
+        jcsv_col *c = &jc->cols[i];
+        if (i) {
+            if (jc->used >= jc->size)
+                goto nospace;
+            jc->buf[jc->used++] = jc->sep;
         }
-        if (pos >= len)
-            goto error;
-        if (t != CCL)
-            goto error;
-        goto exit1;
-    }
 
-    // if none of the above than error
-    goto error;
+        bool ok = true;
+        if (hdr)
+            ok = jcsv_field(jc, c->name, (uint)strlen(c->name));
+        else if (c->type == JSTR && memchr(c->txt, '\\', c->len))
+            ok = jcsv_str(jc, c->txt, c->len);
+        else if (c->type != JINSTART && c->type != JNULL)
+            ok = jcsv_field(jc, c->txt, c->len);
+        if (!ok)
+            goto nospace;
+    }
+    if (jc->used >= jc->size)
+        goto nospace;
+    jc->buf[jc->used++] = '\n';
+    return true;
 
-exit1:
-    pos++;
-exit:
-    jp->pos = pos;
-    return;
+nospace:
+    jc->used = used;
+    return false;
+}
 
-error:
-    tok->type = JERROR;
-    return;
+// Get bit mask of columns matching path to current value of scanner.
+static uint64_t jcsv_match(jcsv_t *jc)
+{
+    jscan_t *js = &jc->js;
+    jsstk *s = &js->stack[js->depth - 1];
+    int t = (int)(js->depth - jc->rdepth);
+    uint64_t m = s->match;
+    for (int i = 0; i < jc->cnt; i++) {
+        uint64_t b = (uint64_t)1 << i;
+        if ((m & b) && (jc->cols[i].ntok <= t
+                || !js_tok_match(s, jc->cols[i].toks[t])))
+            m &= ~b;
+    }
+    return m;
 }
 
-// Copy string from json to C.
-static const char *jp_read_str(jparser_t *jp, int *len)
+// Set cells of columns which paths end at current value of scanner.
+static void jcsv_cell(jcsv_t *jc, uint64_t m)
 {
-    uint ssize = jp->tokc.len; // src string size
-    const char *s = jp->start + jp->tokc.pos; // src string
-    uint dsize = 8; // dst string size
-    char *d = marena_alloc_rt(jp->mem, dsize); // dst string
-    if (d == NULL)
-        return NULL;
+    jscan_t *js = &jc->js;
+    jtok *tok = &js->jp.tokc;
+    int t = (int)(js->depth - jc->rdepth) + 1;
+    for (int i = 0; i < jc->cnt; i++) {
+        jcsv_col *c = &jc->cols[i];
+        if (!(m & ((uint64_t)1 << i)) || c->ntok != t)
+            continue;
+        c->txt = js->jp.start + tok->pos;
+        c->len = tok->len;
+        c->type = tok->type;
+        if (tok->type == JASTART || tok->type == JOSTART) {
+            // position of punctuation token is not kept
+            c->txt = js->jp.start + js->jp.pos - 1;
+            c->depth = js->depth + 1;
+            jc->open++;
+        }
+    }
+}
 
-    uint si, di;
-    for (si = di = 0; si < ssize; si++) {
-        // realloc space for dst string if needed
-        if (di >= dsize - 1) {
-            dsize *= 2;
-            d = marena_realloc_rt(jp->mem, d, dsize);
-            if (d == NULL)
-                return NULL;
+// Scanner callback of CSV converter.
+static int jcsv_cb(jscan_t *js, int ev)
+{
+    jcsv_t *jc = js->ctx;
+    jtok *tok = &js->jp.tokc;
+
+    if (ev == JSE_BEGIN) {
+        if (jc->rdepth) {
+            uint64_t m = jcsv_match(jc);
+            jcsv_cell(jc, m);
+            js->match = m;
+            return 0;
         }
 
-        // check for escape character
-        char c = s[si];
-        if (c != '\\') {
-            d[di++] = c;
-            continue;
+        // row is object in root array or root object
+        if (tok->type == JOSTART && (js->depth == 0 || (js->depth == 1
+                && js->stack[0].ctx == CTXARR))) {
+            for (int i = 0; i < jc->cnt; i++) {
+                jc->cols[i].type = JINSTART;
+                jc->cols[i].depth = 0;
+            }
+            jc->open = 0;
+            jc->rdepth = js->depth + 1;
+            js->match = ~(uint64_t)0;
+            return 0;
         }
+        if (tok->type == JASTART && js->depth == 0)
+            return 0;
+        goto error;
+    }
 
-        // do unescaping
-        c = s[++si];
-        if (c == '"')
-            d[di++] = '"';
-        else if (c == '\\')
-            d[di++] = '\\';
-        else if (c == '/')
-            d[di++] = '/';
-        else if (c == 'b')
-            d[di++] = '\b';
-        else if (c == 'f')
-            d[di++] = '\f';
-        else if (c == 'n')
-            d[di++] = '\n';
-        else if (c == 'r')
-            d[di++] = '\r';
-        else if (c == 't')
-            d[di++] = '\t';
-        else {
-            d[di++] = '\\';
-            d[di++] = c;
+    if (ev == JSE_VALUE) {
+        if (jc->rdepth == 0)
+            goto error;
+        uint64_t m = jcsv_match(jc);
+        if (m)
+            jcsv_cell(jc, m);
+        return 0;
+    }
+
+    // end of row
+    if (jc->rdepth == js->depth + 1) {
+        if (!jcsv_row(jc, false))
+            return 1;
+        jc->rdepth = 0;
+        return 0;
+    }
+
+    // end of array or object of cell
+    for (int i = 0; jc->open && i < jc->cnt; i++) {
+        jcsv_col *c = &jc->cols[i];
+        if (c->depth == js->depth + 1) {
+            c->len = (uint)(js->jp.start + js->jp.pos - c->txt);
+            c->depth = 0;
+            jc->open--;
         }
     }
+    return 0;
 
-    d[di] = 0;
-    *len = (int)di;
-    return d;
+error:
+    ERROR("row is not an object at position %u", js->jp.pos);
+    return -1;
+}
+
+/* Start conversion of json string.
+ * String can contain arrays of objects or objects (like NDJSON).
+ * String must not be changed until conversion is finished.
+ *
+ * In:
+ *      jc - ptr to CSV converter object
+ *      json - ptr to json string
+ *      len - length of json string
+ */
+void jcsv_begin(jcsv_t *jc, const char *json, size_t len)
+{
+    js_init(&jc->js, json, len);
+    jc->js.cb = jcsv_cb;
+    jc->js.ctx = jc;
+    jc->done = 1;
+    jc->hdr = (jc->flags & JCSV_HEADER) != 0;
+    jc->rdepth = 0;
+}
+
+/* Get next CSV rows of json being converted.
+ * Buffer is filled with whole rows as much as possible; next call
+ * continues from next row.
+ *
+ * In:
+ *      jc - ptr to CSV converter object
+ *      buf - output buffer
+ *      size - size of output buffer
+ *      len[out] - length of written text
+ * Return:
+ *      1 - rows are written
+ *      0 - json is finished
+ *      -1 - error
+ */
+int jcsv_next(jcsv_t *jc, char *buf, size_t size, size_t *len)
+{
+    *len = 0;
+    if (jc->done <= 0)
+        return jc->done;
+
+    jc->buf = buf;
+    jc->used = 0;
+    jc->size = size;
+
+    int res = 1;
+    if (jc->hdr && !jcsv_row(jc, true))
+        goto small;
+    jc->hdr = false;
+
+    // callback fails with res 1 only if row does not fit into buffer
+    res = js_scan(&jc->js);
+    if (res > 0 && jc->used == 0)
+        goto small;
+    if (res <= 0)
+        jc->done = res;
+
+    // rows before error are given first
+    *len = jc->used;
+    return jc->used ? 1 : jc->done;
+
+small:
+    ERROR("buffer is too small");
+    jc->done = -1;
+    return -1;
 }
 
 
 /*****************************************************************************
-* Json writer data and functions.
+* Offset index of json elements.
 *****************************************************************************/
 
-// Stack element of json writer.
+// Version of offset index file format.
+#define JSON_OFFS_VERSION 2
+
+// Offset index object.
+struct _joffs_t {
+    uint64_t *offs; // offsets of elements
+    uint32_t *lens; // lengths of elements
+    size_t cnt; // number of elements
+    size_t cap; // capacity of arrays
+    uint64_t size; // size of indexed json
+    int64_t mtime; // modification time of indexed file (0 - unknown)
+};
+
+// Header of offset index file.
 typedef struct {
-    jctx ctx; // parsing context
-    jtt tt; // current token type
-    uint pp; // pretty-print flag
-} jwstk;
+    char magic[4]; // "JIDX"
+    uint32_t version; // file format version
+    uint64_t cnt; // number of elements
+    uint64_t size; // size of indexed json
+    int64_t mtime; // modification time of indexed file (0 - unknown)
+} joffs_hdr;
+
+// Allocate arrays of offset index.
+static int joffs_grow(joffs_t *jo, size_t cap)
+{
+    uint64_t *offs = realloc(jo->offs, cap * sizeof(jo->offs[0]));
+    if (offs == NULL)
+        return -1;
+    jo->offs = offs;
+    uint32_t *lens = realloc(jo->lens, cap * sizeof(jo->lens[0]));
+    if (lens == NULL)
+        return -1;
+    jo->lens = lens;
+    jo->cap = cap;
+    return 0;
+}
 
-// Json writer object.
-struct _jwriter_t {
-    char *start; // json string start
-    uint len; // json string length
-    uint pos; // current position in json string
-    int err; // error flag
+// Move tokenizer window to given position of json string.
+static void joffs_window(jparser_t *p, const char *start, const char *end)
+{
+    size_t len = (size_t)(end - start);
+    p->start = start;
+    p->len = (len > UINT_MAX) ? UINT_MAX : (uint)len;
+    p->pos = 0;
+}
 
-    jwstk *stack; // stack
-    uint ssize; // stack size
-    uint sidx; // stack index
+/* Build offset index of json string.
+ * If json is an array, then its elements are indexed, else every root
+ * value is indexed (like lines of NDJSON). Values are only tokenized,
+ * so index is built at tokenizer speed; invalid values are detected
+ * when they are parsed.
+ *
+ * In:
+ *      jo[out] - address of ptr to offset index object
+ *      json - ptr to json string
+ *      len - length of json string
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int joffs_build(joffs_t **jo, const char *json, size_t len)
+{
+    jparser_t p;
+    jtok *tok = &p.tokc;
+    const char *end = json + len;
 
-    uint ppd; // pretty-print depth
-    uint ppm; // pretty-print margin size (in spaces)
-};
+    joffs_t *o = malloc(sizeof(*o));
+    if (o == NULL)
+        goto enomem;
+    memset(o, 0, sizeof(*o));
+    o->size = len;
+    if (joffs_grow(o, 1024))
+        goto enomem;
+
+    memset(&p, 0, sizeof(p));
+    joffs_window(&p, json, end);
+    jp_next(&p);
+    bool arr = (tok->type == JASTART);
+    if (arr)
+        jp_next(&p);
 
-// Write zero-terminated string to json buffer.
-static void jw_strz(jwriter_t *jw, const char *str)
-{
     for (;;) {
-        char c = *str++;
-        if (c == 0)
+        if (arr && tok->type == JAEND) {
+            jp_next(&p);
+            if (tok->type != JINEND)
+                goto error;
             break;
-        if (jw->pos >= jw->len - 1) {
-            jw->len *= 2;
-            jw->start = realloc(jw->start, jw->len);
         }
-        jw->start[jw->pos++] = c;
-    }
-}
-
-// Write zero-terminated string to json buffer using format string.
-#pragma GCC diagnostic ignored "-Wformat-nonliteral"
-static void jw_printf(jwriter_t *jw, const char *fmt, ...)
-{
-    va_list v;
-    va_start(v, fmt);
+        if (!arr && tok->type == JINEND)
+            break;
 
-    while (!jw->err) {
-        bool grow = false;
-        char *buf = jw->start + jw->pos;
-        size_t size = jw->len - jw->pos - 1;
-        int res = vsnprintf(buf, size, fmt, v);
-        if (res < 0) {
-            if (errno == ERANGE) {
-                grow = true;
-            } else {
-                ERROR("vsnprintf() error %d '%s'", errno, strerror(errno));
-                jw->err = 1;
+        // span of value
+        uint vs, ve;
+        if (tok->type == JASTART || tok->type == JOSTART) {
+            vs = p.pos - 1;
+            for (int depth = 1; depth; ) {
+                jp_next(&p);
+                if (tok->type == JASTART || tok->type == JOSTART)
+                    depth++;
+                else if (tok->type == JAEND || tok->type == JOEND)
+                    depth--;
+                else if (tok->type == JINEND || tok->type == JERROR)
+                    goto error;
             }
+            ve = p.pos;
+        } else if (tok->type == JSTR) {
+            vs = tok->pos - 1;
+            ve = tok->pos + tok->len + 1;
+        } else if (tok->type >= JNULL && tok->type <= JDBL) {
+            vs = tok->pos;
+            ve = tok->pos + tok->len;
         } else {
-            if ((size_t)res > size) {
-                grow = true;
-            } else {
-                jw->pos += (uint)res;
-                break;
-            }
-        }
-        if (grow) {
-            jw->len *= 2;
-            jw->start = realloc(jw->start, jw->len);
+            goto error;
         }
+
+        if (o->cnt == o->cap && joffs_grow(o, o->cap * 2))
+            goto enomem;
+        o->offs[o->cnt] = (uint64_t)(p.start + vs - json);
+        o->lens[o->cnt++] = ve - vs;
+
+        // window starts after value, so json can be longer than 4 GB
+        joffs_window(&p, p.start + ve, end);
+        jp_next(&p);
+        if (arr && tok->type == JCOMMA)
+            jp_next(&p);
+        else if (arr && tok->type != JAEND)
+            goto error;
     }
 
-    va_end(v);
+    *jo = o;
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    joffs_destroy(o);
+    return -1;
+
+error:
+    ERROR("invalid json at position %zu", (size_t)(p.start - json) + p.pos);
+    joffs_destroy(o);
+    return -1;
 }
-#pragma GCC diagnostic warning "-Wformat-nonliteral"
 
-// Write margin to json buffer.
-static void jw_margin(jwriter_t *jw)
+/* Destroy offset index object.
+ *
+ * In:
+ *      jo - ptr to offset index object
+ */
+void joffs_destroy(joffs_t *jo)
+{
+    if (jo == NULL)
+        return;
+
+    free(jo->offs);
+    free(jo->lens);
+    free(jo);
+}
+
+/* Get number of indexed elements.
+ *
+ * In:
+ *      jo - ptr to offset index object
+ * Return:
+ *      number of elements
+ */
+size_t joffs_count(joffs_t *jo)
+{
+    return jo->cnt;
+}
+
+/* Get span of indexed element in json string.
+ * Element can be parsed by jp_parse() called for this span.
+ *
+ * In:
+ *      jo - ptr to offset index object
+ *      i - element index
+ *      pos[out] - offset of element
+ *      len[out] - length of element
+ * Return:
+ *      0 - success
+ *      !0 - error (no such element)
+ */
+int joffs_span(joffs_t *jo, size_t i, size_t *pos, size_t *len)
+{
+    if (i >= jo->cnt)
+        return -1;
+
+    *pos = (size_t)jo->offs[i];
+    *len = jo->lens[i];
+    return 0;
+}
+
+/* Save offset index to file.
+ * File is written in native byte order.
+ *
+ * In:
+ *      jo - ptr to offset index object
+ *      path - file path
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int joffs_save(joffs_t *jo, const char *path)
 {
-    jwstk *s = jw->stack + jw->sidx;
-    if (!s->pp)
-        return;
-
-    if (jw->pos >= jw->len - 1) {
-        jw->len *= 2;
-        jw->start = realloc(jw->start, jw->len);
+    joffs_hdr h = {{'J', 'I', 'D', 'X'}, JSON_OFFS_VERSION, jo->cnt, jo->size,
+        jo->mtime};
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+        goto error;
+    if (fwrite(&h, sizeof(h), 1, f) != 1
+            || fwrite(jo->offs, sizeof(jo->offs[0]), jo->cnt, f) != jo->cnt
+            || fwrite(jo->lens, sizeof(jo->lens[0]), jo->cnt, f) != jo->cnt) {
+        fclose(f);
+        goto error;
     }
-    jw->start[jw->pos++] = '\n';
+    if (fclose(f))
+        goto error;
+    return 0;
 
-    for (uint i=0; i < jw->sidx; i++) {
-        for (uint j=0; j < jw->ppm; j++) {
-            if (jw->pos >= jw->len - 1) {
-                jw->len *= 2;
-                jw->start = realloc(jw->start, jw->len);
-            }
-            jw->start[jw->pos++] = ' ';
-        }
-    }
+error:
+    ERROR("can not write '%s': %s", path, strerror(errno));
+    remove(path);
+    return -1;
 }
 
-// Prepare for writing a value to json string.
-static int jw_prepv(jwriter_t *jw, const char *name)
+// Read offset index file.
+static joffs_t *joffs_read(const char *path)
 {
-    if (!jw || jw->err)
-        return -1;
+    joffs_hdr h;
+    joffs_t *o = NULL;
 
-    jwstk *s = jw->stack + jw->sidx;
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return NULL;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, "JIDX", 4)
+            || h.version != JSON_OFFS_VERSION || h.cnt > SIZE_MAX / 8)
+        goto exit;
 
-    if (s->ctx == CTXOBJ && name == NULL) {
-        ERROR("need attribute name");
-        jw->err = 1;
-        return -1;
-    } else if (s->ctx != CTXOBJ && name != NULL) {
-        ERROR("attribute name should be NULL");
-        jw->err = 1;
-        return -1;
+    o = malloc(sizeof(*o));
+    if (o == NULL)
+        goto exit;
+    memset(o, 0, sizeof(*o));
+    size_t cnt = (size_t)h.cnt;
+    if (joffs_grow(o, cnt ? cnt : 1)
+            || fread(o->offs, sizeof(o->offs[0]), cnt, f) != cnt
+            || fread(o->lens, sizeof(o->lens[0]), cnt, f) != cnt) {
+        joffs_destroy(o);
+        o = NULL;
+        goto exit;
     }
-
-    if (s->ctx == CTXVAL) { // value
-        if (s->tt != JINSTART) {
-            jw->err = 1;
-        }
-    } else if (s->ctx == CTXARR) { // array
-        if (s->tt != JASTART) {
-            jw_strz(jw, ",");
-        }
-        if (s->pp) {
-            jw_margin(jw);
-        }
-    } else { // object
-        if (s->tt != JOSTART) {
-            jw_strz(jw, ",");
-        }
-        if (s->pp) {
-            jw_margin(jw);
+    o->cnt = cnt;
+    o->size = h.size;
+    o->mtime = h.mtime;
+
+    // spans out of indexed json would be read out of mapped file
+    for (size_t i = 0; i < cnt; i++) {
+        if (o->offs[i] > o->size || o->lens[i] > o->size - o->offs[i]) {
+            joffs_destroy(o);
+            o = NULL;
+            break;
         }
-        jw_printf(jw, (s->pp ? "\"%s\": " : "\"%s\":"), name);
     }
 
-    return jw->err;
+exit:
+    fclose(f);
+    return o;
 }
 
-/* Create json writer object.
+/* Load offset index from file.
  *
  * In:
- *      jw[out] - address of ptr to json writer object
- *      mem - initial amount of memory to be used for writing;
- *            if 0, then default value is used
- *      stack - stack depth; this value controls maximum nesting in json;
- *              if 0 then default value is used
+ *      jo[out] - address of ptr to offset index object
+ *      path - file path
+ *      size - size of indexed json (index of other size is stale);
+ *             if 0 then size is not checked
  * Return:
  *      0 - success
  *      !0 - error
  */
-int jw_create(jwriter_t **jw, size_t mem, size_t stack)
+int joffs_load(joffs_t **jo, const char *path, size_t size)
 {
-    int ret = 1;
+    joffs_t *o = joffs_read(path);
+    if (o == NULL) {
+        ERROR("can not read '%s'", path);
+        return -1;
+    }
+    if (size && o->size != size) {
+        ERROR("index '%s' is stale", path);
+        joffs_destroy(o);
+        return -1;
+    }
 
-    // adjust input values
-    if (mem < JSON_MEM_MIN)
-        mem = JSON_MEM_MIN;
-    if (stack < JSON_STACK_MIN)
-        stack = JSON_STACK_MIN;
+    *jo = o;
+    return 0;
+}
 
-    // get memory for writer object
-    jwriter_t *p = malloc(sizeof(*p));
-    if (!p)
-        goto enomem;
-    memset(p, 0, sizeof(*p));
+#if JSON_MMAP == 1
 
-    // get memory for stack
-    p->stack = malloc(stack * sizeof(p->stack[0]));
-    if (!p->stack)
+// Memory mapped json file.
+struct _jfile_t {
+    const char *data; // file contents
+    size_t size; // file size
+    joffs_t *jo; // offset index
+};
+
+/* Open json file for random access to its elements.
+ * File is memory mapped. Offset index is read from sidecar file with
+ * ".idx" suffix; if it is absent or stale (size or modification time
+ * of file differs), then index is built and saved.
+ *
+ * In:
+ *      jf[out] - address of ptr to json file object
+ *      path - file path
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jfile_open(jfile_t **jf, const char *path)
+{
+    char *ipath = NULL;
+
+    jfile_t *f = malloc(sizeof(*f));
+    if (f == NULL)
         goto enomem;
-    p->ssize = (uint)stack;
+    memset(f, 0, sizeof(*f));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        goto error;
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        goto error;
+    }
+    f->size = (size_t)st.st_size;
+    int64_t mtime = (int64_t)st.st_mtime;
+    if (f->size) {
+        void *p = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            goto error;
+        }
+        f->data = p;
+    }
+    close(fd);
 
-    // get memory for json string
-    p->start = malloc(mem);
-    if (!p->start)
+    size_t plen = strlen(path);
+    ipath = malloc(plen + 5);
+    if (ipath == NULL)
         goto enomem;
-    p->len = (uint)mem;
+    memcpy(ipath, path, plen);
+    memcpy(ipath + plen, ".idx", 5);
 
-    *jw = p;
-    ret = 0;
+    f->jo = joffs_read(ipath);
+    if (f->jo && (f->jo->size != f->size || f->jo->mtime != mtime)) {
+        joffs_destroy(f->jo);
+        f->jo = NULL;
+    }
+    if (f->jo == NULL) {
+        if (joffs_build(&f->jo, f->data, f->size))
+            goto exit;
+        f->jo->mtime = mtime;
+        // index that can not be saved is still usable
+        joffs_save(f->jo, ipath);
+    }
 
-exit:
-    return ret;
+    free(ipath);
+    *jf = f;
+    return 0;
 
 enomem:
     ERROR("no memory");
-    if (p) {
-        free(p->stack);
-        free(p);
-    }
     goto exit;
-}
 
-/* Destroy json writer object.
- *
- * In:
- *      jw - ptr to json writer object
- */
-void jw_destroy(jwriter_t *jw)
-{
-    if (!jw)
-        return;
+error:
+    ERROR("can not open '%s': %s", path, strerror(errno));
 
-    free(jw->start);
-    free(jw->stack);
-    free(jw);
+exit:
+    free(ipath);
+    jfile_close(f);
+    return -1;
 }
 
-/* Set pretty-print parameters.
+/* Close json file.
  *
  * In:
- *      jw - ptr to json writer object
- *      depth - only nodes with level value up to this number will be aligned
- *      margin - number of space character per margin
+ *      jf - ptr to json file object
  */
-void jw_pretty_print(jwriter_t *jw, int depth, int margin)
+void jfile_close(jfile_t *jf)
 {
-    if (!jw)
+    if (jf == NULL)
         return;
 
-    jw->ppd = depth < 0 ? 0 : depth;
-    jw->ppm = margin < 0 ? 0 : margin;
+    if (jf->data)
+        munmap((void*)jf->data, jf->size);
+    joffs_destroy(jf->jo);
+    free(jf);
 }
 
-/* Begin json writing.
- * Previously written json string is discarded.
+/* Get number of elements of json file.
  *
  * In:
- *      jw - ptr to json writer object
+ *      jf - ptr to json file object
+ * Return:
+ *      number of elements
  */
-void jw_begin(jwriter_t *jw)
+size_t jfile_count(jfile_t *jf)
 {
-    if (!jw)
-        return;
-
-    jw->pos = 0;
-    jw->err = 0;
-    jw->sidx = 0;
-
-    jwstk *s = jw->stack + jw->sidx;
-    s->ctx = CTXVAL;
-    s->tt = JINSTART;
+    return jf->jo->cnt;
 }
 
-/* Get written json string.
- * String is zero terminated. String is located in json writer object
- * memory and need not to be freed manually.
+/* Parse element of json file.
+ * Only span of element is read from file.
  *
  * In:
- *      jw - ptr to json writer object
- *      str[out] - address of json string start
- *      size[out] - address of json string size
+ *      jf - ptr to json file object
+ *      jp - ptr to json parser object
+ *      i - element index
+ *      elt[out] - address of ptr to element
  * Return:
  *      0 - success
  *      !0 - error
  */
-int jw_get(jwriter_t *jw, char **str, size_t *size)
+int jfile_parse(jfile_t *jf, jparser_t *jp, size_t i, jnode_t **elt)
 {
-    if (!jw)
-        return -1;
-    if (jw->pos >= jw->len)
-        return -1;
-    if (jw->stack[jw->sidx].ctx != CTXVAL)
+    size_t pos, len;
+    if (joffs_span(jf->jo, i, &pos, &len)) {
+        ERROR("no element %zu", i);
         return -1;
+    }
+    return jp_parse(jp, elt, jf->data + pos, len);
+}
 
-    jw->start[jw->pos] = 0;
-    *str = jw->start;
-    if (size)
-        *size = jw->pos;
+#endif
 
-    return jw->err;
+
+/*****************************************************************************
+* Cache of parsed documents.
+*****************************************************************************/
+
+// Initial size of hash table of cache.
+#define JSON_CACHE_HT 64
+
+// Cache entry.
+typedef struct _jcache_ent jcache_ent;
+struct _jcache_ent {
+    uint64_t hash; // hash of json string
+    size_t len; // length of json string
+    char *json; // copy of json string
+    int flags; // parser flags used for parsing
+    jdoc_t *jd; // parsed document
+    size_t bytes; // memory used by entry
+    jcache_ent *hnext; // next entry of hash table bucket
+    jcache_ent *prev; // previous entry of LRU list (more recently used)
+    jcache_ent *next; // next entry of LRU list (less recently used)
+};
+
+// Cache of parsed documents.
+struct _jcache_t {
+    jcache_ent **ht; // hash table
+    size_t hsize; // hash table size
+    size_t cnt; // number of entries
+    jcache_ent *head; // most recently used entry
+    jcache_ent *tail; // least recently used entry
+    size_t bytes; // memory used by entries
+    size_t max; // maximum memory used by entries
+};
+
+// Get size of memory taken by arena.
+static size_t marena_bytes(marena_t *ma)
+{
+    size_t size = sizeof(*ma);
+    for (marena_chunk_hdr_t *c = ma->first; c; c = c->next)
+        size += sizeof(*c) + c->size;
+    return size;
 }
 
-/* Write null value to json writer.
- * Possible errors are not reported until call to jw_get().
- *
- * In:
- *      jw - ptr to json writer object
- *      name - object attribute name if writing is done inside object context;
- *             must be NULL if writing is done inside array context
- */
-void jw_null(jwriter_t *jw, const char *name)
+// Calculate 64-bit hash of json string.
+static uint64_t jcache_hash(const char *s, size_t len)
 {
-    if (jw_prepv(jw, name))
-        return;
-    jw_strz(jw, "null");
-    jw->stack[jw->sidx].tt = JNULL;
+    const uint64_t m1 = 0x9E3779B97F4A7C15ull, m2 = 0xC2B2AE3D27D4EB4Full;
+    uint64_t h[4] = {len, m1, m2, m1 ^ m2};
+    size_t i = 0;
+
+    // four independent lanes hide multiplication latency
+    for (; i + 32 <= len; i += 32) {
+        for (int k = 0; k < 4; k++) {
+            uint64_t v;
+            memcpy(&v, s + i + k * 8, 8);
+            h[k] = (h[k] ^ v) * m2;
+            h[k] ^= h[k] >> 31;
+        }
+    }
+    uint64_t r = h[0] ^ (h[1] * m1) ^ (h[2] * m2) ^ ((h[3] << 1) * m1);
+    for (; i < len; i += 8) {
+        uint64_t v = 0;
+        memcpy(&v, s + i, (len - i < 8) ? len - i : 8);
+        r = (r ^ v) * m1;
+        r ^= r >> 29;
+    }
+    r ^= r >> 32;
+    r *= m2;
+    return r ^ (r >> 29);
 }
 
-/* Write boolean value to json writer.
- * Possible errors are not reported until call to jw_get().
+/* Create cache of parsed documents.
+ * Documents are found by contents of json string, so equal strings
+ * are parsed only once. Least recently used documents are evicted
+ * when memory used by cache exceeds given size.
  *
  * In:
- *      jw - ptr to json writer object
- *      val - boolean value
- *      name - object attribute name if writing is done inside object context;
- *             must be NULL if writing is done inside array context
+ *      jc[out] - address of ptr to cache object
+ *      size - maximum memory used by cached documents
+ * Return:
+ *      0 - success
+ *      !0 - error
  */
-void jw_bool(jwriter_t *jw, bool val, const char *name)
+int jcache_create(jcache_t **jc, size_t size)
 {
-    if (jw_prepv(jw, name))
-        return;
-    jw_strz(jw, (val ? "true" : "false"));
-    jw->stack[jw->sidx].tt = JBOOL;
+    jcache_t *c = malloc(sizeof(*c));
+    if (c == NULL)
+        goto enomem;
+    memset(c, 0, sizeof(*c));
+    c->max = size;
+
+    c->hsize = JSON_CACHE_HT;
+    c->ht = calloc(c->hsize, sizeof(c->ht[0]));
+    if (c->ht == NULL)
+        goto enomem;
+
+    *jc = c;
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    free(c);
+    return -1;
 }
 
-/* Write integer value to json writer.
- * Possible errors are not reported until call to jw_get().
- *
- * In:
- *      jw - ptr to json writer object
- *      val - integer value
- *      name - object attribute name if writing is done inside object context;
- *             must be NULL if writing is done inside array context
- */
-void jw_int(jwriter_t *jw, int val, const char *name)
+// Remove entry from LRU list.
+static void jcache_unlink(jcache_t *jc, jcache_ent *e)
 {
-    if (jw_prepv(jw, name))
-        return;
-    jw_printf(jw, "%d", val);
-    jw->stack[jw->sidx].tt = JINT;
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        jc->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        jc->tail = e->prev;
 }
 
-#if JSON_DOUBLE == 1
-/* Write double value to json writer.
- * Possible errors are not reported until call to jw_get().
- *
- * In:
- *      jw - ptr to json writer object
- *      val - double value
- *      name - object attribute name if writing is done inside object context;
- *             must be NULL if writing is done inside array context
- */
-void jw_dbl(jwriter_t *jw, double val, const char *name)
+// Insert entry to head of LRU list.
+static void jcache_link(jcache_t *jc, jcache_ent *e)
 {
-    if (jw_prepv(jw, name))
-        return;
-    jw_printf(jw, "%f", val);
-    jw->stack[jw->sidx].tt = JDBL;
+    e->prev = NULL;
+    e->next = jc->head;
+    if (jc->head)
+        jc->head->prev = e;
+    else
+        jc->tail = e;
+    jc->head = e;
+}
+
+// Remove entry from cache and release its document.
+static void jcache_evict(jcache_t *jc, jcache_ent *e)
+{
+    jcache_ent **p = &jc->ht[e->hash & (jc->hsize - 1)];
+    while (*p != e)
+        p = &(*p)->hnext;
+    *p = e->hnext;
+    jcache_unlink(jc, e);
+
+    jc->cnt--;
+    jc->bytes -= e->bytes;
+    jdoc_destroy(e->jd);
+    free(e->json);
+    free(e);
 }
 
-/* Write double value with specified precision to json writer.
- * Possible errors are not reported until call to jw_get().
+/* Destroy cache object.
+ * Documents that are used by application stay valid until they are
+ * released by jdoc_destroy().
  *
  * In:
- *      jw - ptr to json writer object
- *      val - double value
- *      prec - precision
- *      name - object attribute name if writing is done inside object context;
- *             must be NULL if writing is done inside array context
+ *      jc - ptr to cache object
  */
-void jw_dbl_prec(jwriter_t *jw, double val, int prec, const char *name)
+void jcache_destroy(jcache_t *jc)
 {
-    if (jw_prepv(jw, name))
+    if (jc == NULL)
         return;
-    jw_printf(jw, "%.*f", prec, val);
-    jw->stack[jw->sidx].tt = JDBL;
+
+    while (jc->tail)
+        jcache_evict(jc, jc->tail);
+    free(jc->ht);
+    free(jc);
 }
-#endif
 
-/* Write string value to json writer.
- * Possible errors are not reported until call to jw_get().
+// Double size of hash table.
+static void jcache_grow(jcache_t *jc)
+{
+    size_t size = jc->hsize * 2;
+    jcache_ent **ht = calloc(size, sizeof(ht[0]));
+    if (ht == NULL)
+        return; // longer chains are still correct
+
+    for (jcache_ent *e = jc->head; e; e = e->next) {
+        jcache_ent **p = &ht[e->hash & (size - 1)];
+        e->hnext = *p;
+        *p = e;
+    }
+    free(jc->ht);
+    jc->ht = ht;
+    jc->hsize = size;
+}
+
+/* Parse json string using cache.
+ * If equal string was parsed before with the same parser flags, then
+ * its document is returned without parsing. Documents are shared, so
+ * their nodes must not be modified. Structural hashes of cached
+ * documents are calculated beforehand, but reading still changes nodes
+ * (elements of packed arrays are made on first access) and reference
+ * counts are not atomic, so cache and its documents must be used by one
+ * thread at a time. Every returned document must be released by
+ * jdoc_destroy().
  *
  * In:
- *      jw - ptr to json writer object
- *      val - string value
- *      name - object attribute name if writing is done inside object context;
- *             must be NULL if writing is done inside array context
+ *      jc - ptr to cache object
+ *      jp - ptr to json parser object (used on cache miss)
+ *      jd[out] - address of ptr to json document object
+ *      json - ptr to json string
+ *      len - length of json string
+ * Return:
+ *      0 - success
+ *      !0 - error
  */
-void jw_str(jwriter_t *jw, const char *str, const char *name)
+int jcache_parse(jcache_t *jc, jparser_t *jp, jdoc_t **jd, const char *json,
+    size_t len)
 {
-    if (jw_prepv(jw, name))
-        return;
+    uint64_t h = jcache_hash(json, len);
+    for (jcache_ent *e = jc->ht[h & (jc->hsize - 1)]; e; e = e->hnext) {
+        if (e->hash == h && e->len == len && e->flags == jp->flags
+                && 0 == memcmp(e->json, json, len)) {
+            jcache_unlink(jc, e);
+            jcache_link(jc, e);
+            *jd = jdoc_ref(e->jd);
+            return 0;
+        }
+    }
 
-    jw_strz(jw, "\"");
-    for (char c = *str; c; c = *(++str)) {
-        // do escaping
-        if (c == '"')
-            jw_strz(jw, "\\\"");
-        else if (c == '\\')
-            jw_strz(jw, "\\\\");
-        else if (c == '/')
-            jw_strz(jw, "\\/");
-        else if (c == '\b')
-            jw_strz(jw, "\\b");
-        else if (c == '\f')
-            jw_strz(jw, "\\f");
-        else if (c == '\n')
-            jw_strz(jw, "\\n");
-        else if (c == '\r')
-            jw_strz(jw, "\\r");
-        else if (c == '\t')
-            jw_strz(jw, "\\t");
-        else {
-            if (jw->pos >= jw->len - 1) {
-                jw->len *= 2;
-                jw->start = realloc(jw->start, jw->len);
-            }
-            jw->start[jw->pos++] = c;
+    jdoc_t *d;
+    if (jdoc_parse(&d, jp, json, len))
+        return -1;
+    *jd = d;
+
+    // document bigger than cache is not cached
+    size_t bytes = sizeof(jcache_ent) + sizeof(jdoc_t) + len
+        + marena_bytes(d->mem) + marena_bytes(d->smem);
+    if (bytes > jc->max)
+        return 0;
+
+    jcache_ent *e = malloc(sizeof(*e));
+    char *copy = malloc(len ? len : 1);
+    if (e == NULL || copy == NULL) {
+        free(e);
+        free(copy);
+        return 0;
+    }
+    memcpy(copy, json, len);
+
+    // hashes are cached in nodes now, not when document is shared
+    jn_hash_node(d->root);
+
+    e->hash = h;
+    e->len = len;
+    e->json = copy;
+    e->flags = jp->flags;
+    e->jd = jdoc_ref(d);
+    e->bytes = bytes;
+
+    while (jc->bytes + bytes > jc->max)
+        jcache_evict(jc, jc->tail);
+    if (jc->cnt >= jc->hsize)
+        jcache_grow(jc);
+    jcache_ent **p = &jc->ht[h & (jc->hsize - 1)];
+    e->hnext = *p;
+    *p = e;
+    jcache_link(jc, e);
+    jc->cnt++;
+    jc->bytes += bytes;
+    return 0;
+}
+
+
+/*****************************************************************************
+* Incremental reparsing of edited documents.
+*****************************************************************************/
+
+// Span of array or object in text of document.
+typedef struct _jspan_t jspan_t;
+struct _jspan_t {
+    jnode_t *node; // array or object node
+    jspan_t *parent; // span of parent array or object (NULL for root)
+    int idx; // index of node in parent
+    size_t start; // offset from start of parent span (text start for root)
+    size_t len; // length of span including brackets
+    jspan_t **kids; // spans of child arrays and objects
+    int nkids; // number of child spans
+};
+
+// Build spans of array or object node by tokenizing its text.
+// Current token of tokenizer is the starting bracket of node.
+// Start of span is position in tokenizer window.
+static jspan_t *jspan_build(jdoc_t *jd, jparser_t *tk, jnode_t *n)
+{
+    jtok *tok = &tk->tokc;
+    jspan_t *sp = marena_alloc(jd->mem, sizeof(*sp));
+    if (sp == NULL)
+        return NULL;
+    memset(sp, 0, sizeof(*sp));
+    sp->node = n;
+    sp->start = tk->pos - 1;
+
+    if (n->type == JT_ARR && n->elts.packed != JT_NONE) {
+        // packed array has no child nodes
+        for (int depth = 1; depth; ) {
+            jp_next(tk);
+            if (tok->type == JASTART)
+                depth++;
+            else if (tok->type == JAEND)
+                depth--;
+            else if (tok->type == JINEND || tok->type == JERROR)
+                return NULL;
         }
+        sp->len = tk->pos - sp->start;
+        return sp;
     }
-    jw_strz(jw, "\"");
 
-    jw->stack[jw->sidx].tt = JSTR;
+    bool obj = (n->type == JT_OBJ);
+    int cnt = obj ? n->attrs.count : n->elts.count;
+    jnode_t **values = obj ? n->attrs.values : n->elts.values;
+    int nk = 0;
+    for (int i = 0; i < cnt; i++)
+        nk += (values[i]->type == JT_ARR || values[i]->type == JT_OBJ);
+    if (nk) {
+        sp->kids = marena_alloc(jd->mem, (size_t)nk * sizeof(sp->kids[0]));
+        if (sp->kids == NULL)
+            return NULL;
+    }
+
+    // tokens of values follow in the same order as nodes
+    for (int i = 0; i < cnt; i++) {
+        jp_next(tk);
+        if (obj)
+            jp_next(tk);
+        bool cont = (tok->type == JASTART || tok->type == JOSTART);
+        if (cont != (values[i]->type == JT_ARR || values[i]->type == JT_OBJ))
+            return NULL;
+        if (cont) {
+            jspan_t *k = jspan_build(jd, tk, values[i]);
+            if (k == NULL)
+                return NULL;
+            k->parent = sp;
+            k->idx = i;
+            k->start -= sp->start;
+            sp->kids[sp->nkids++] = k;
+        }
+        jp_next(tk);
+    }
+    if (cnt == 0)
+        jp_next(tk);
+
+    sp->len = tk->pos - sp->start;
+    return sp;
 }
 
-/* Begin writing of array value to json writer.
- * Possible errors are not reported until call to jw_get().
+// Build spans of document text part that is parsed into node.
+static jspan_t *jspan_text(jdoc_t *jd, jnode_t *n, size_t pos, size_t len)
+{
+    jparser_t tk;
+    memset(&tk, 0, sizeof(tk));
+    tk.start = jd->text + pos;
+    tk.len = (uint)len;
+    jp_next(&tk);
+    return jspan_build(jd, &tk, n);
+}
+
+// Parse whole text of document.
+static int jdoc_full(jdoc_t *jd, jparser_t *jp)
+{
+    jnode_t *root;
+
+    // shared nodes can not be replaced separately
+    int flags = jp->flags;
+    jp->flags &= ~JP_DEDUP;
+    int res = jp_parse(jp, &root, jd->text, jd->tlen);
+    jp->flags = flags;
+    if (res)
+        return -1;
+
+    if (jdoc_take(jd, jp))
+        goto enomem;
+    jd->root = root;
+    jd->span = NULL;
+    jd->dead = 0;
+    if (root->type == JT_ARR || root->type == JT_OBJ) {
+        jd->span = jspan_text(jd, root, 0, jd->tlen);
+        if (jd->span == NULL)
+            goto enomem;
+    }
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    return -1;
+}
+
+/* Parse json string into new json document that can be edited.
+ * Document keeps copy of json text and positions of arrays and objects,
+ * so after edit of text only the smallest array or object containing
+ * the edit is parsed again (see jp_reparse()). Flag JP_DEDUP is not
+ * used for such documents.
  *
  * In:
- *      jw - ptr to json writer object
- *      name - object attribute name if writing is done inside object context;
- *             must be NULL if writing is done inside array context
+ *      jd[out] - address of ptr to json document object
+ *      jp - ptr to json parser object
+ *      json - ptr to json string
+ *      len - length of json string
+ * Return:
+ *      0 - success
+ *      !0 - error
  */
-void jw_abegin(jwriter_t *jw, const char *name)
+int jdoc_parse_text(jdoc_t **jd, jparser_t *jp, const char *json, size_t len)
 {
-    if (jw_prepv(jw, name))
-        return;
+    jdoc_t *d = malloc(sizeof(*d));
+    if (d == NULL)
+        goto enomem;
+    memset(d, 0, sizeof(*d));
+    d->root = &none;
+    d->refs = 1;
 
-    jw_strz(jw, "[");
+    d->tcap = len + 1;
+    d->text = malloc(d->tcap);
+    if (d->text == NULL)
+        goto enomem;
+    memcpy(d->text, json, len);
+    d->text[len] = 0;
+    d->tlen = len;
 
-    if (jw->sidx >= jw->ssize - 1) {
-        jw->err = 1;
-        return;
+    if (jdoc_full(d, jp)) {
+        jdoc_destroy(d);
+        return -1;
     }
-    jw->sidx++;
 
-    jwstk *s = jw->stack + jw->sidx;
-    s->ctx = CTXARR;
-    s->tt = JASTART;
-    s->pp = (jw->ppd > jw->sidx);
+    *jd = d;
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    jdoc_destroy(d);
+    return -1;
 }
 
-/* End writing of array value to json writer.
- * Possible errors are not reported until call to jw_get().
+/* Get json text of document made by jdoc_parse_text().
  *
  * In:
- *      jw - ptr to json writer object
+ *      jd - ptr to json document object
+ *      len[out] - length of text
+ * Return:
+ *      text (zero terminated) or NULL if document has no text
  */
-void jw_aend(jwriter_t *jw)
+const char *jdoc_text(jdoc_t *jd, size_t *len)
 {
-    if (!jw || jw->err)
-        return;
+    *len = jd->tlen;
+    return jd->text;
+}
 
-    if (jw->sidx == 0) {
-        jw->err = 1;
-        return;
+// Replace part of document text.
+static int jdoc_edit(jdoc_t *jd, size_t off, size_t old_len, const char *text,
+    size_t len)
+{
+    size_t tlen = jd->tlen - old_len + len;
+    if (tlen + 1 > jd->tcap) {
+        size_t cap = jd->tcap * 2;
+        if (cap < tlen + 1)
+            cap = tlen + 1;
+        char *p = realloc(jd->text, cap);
+        if (p == NULL)
+            return -1;
+        jd->text = p;
+        jd->tcap = cap;
     }
-    jw->sidx--;
 
-    if (jw->stack[jw->sidx].pp && jw->stack[jw->sidx+1].pp) {
-        jw_margin(jw);
-    }
-    jw_strz(jw, "]");
+    memmove(jd->text + off + len, jd->text + off + old_len,
+        jd->tlen - off - old_len + 1);
+    memcpy(jd->text + off, text, len);
+    jd->tlen = tlen;
+    return 0;
+}
 
-    jw->stack[jw->sidx].tt = JAEND;
+// Parse again text of array or object (not root) and replace its subtree.
+// Position of span is given from text start.
+static int jspan_reparse(jparser_t *jp, jdoc_t *jd, jspan_t *sp, size_t pos,
+    size_t len)
+{
+    jnode_t *n;
+    if (jp_parse(jp, &n, jd->text + pos, len))
+        return 1;
+
+    // new nodes are copied to document, old nodes stay unused
+    // until the whole text is parsed again
+    jnode_t *c = jdoc_node(jd, n);
+    if (c == NULL)
+        return -1;
+    jspan_t *k = jspan_text(jd, c, pos, len);
+    if (k == NULL)
+        return -1;
+    k->start = sp->start;
+    k->parent = sp->parent;
+    k->idx = sp->idx;
+
+    jd->dead += sp->len;
+
+    jspan_t *p = sp->parent;
+    int i = 0;
+    while (p->kids[i] != sp)
+        i++;
+    p->kids[i] = k;
+    if (p->node->type == JT_OBJ)
+        p->node->attrs.values[k->idx] = c;
+    else
+        p->node->elts.values[k->idx] = c;
+
+    // lengths of parents and offsets of next spans are changed
+    ptrdiff_t delta = (ptrdiff_t)k->len - (ptrdiff_t)sp->len;
+    for (jspan_t *s = k; p; s = p, p = p->parent) {
+        p->len += (size_t)delta;
+        while (p->kids[i] != s)
+            i++;
+        for (i++; i < p->nkids; i++)
+            p->kids[i]->start += (size_t)delta;
+        i = 0;
+
+        // cached structural hashes are not valid any more
+        if (p->node->type == JT_OBJ)
+            ((jnode_obj_t*)p->node)->hash = 0;
+        else if (p->node->flags & NF_ARR)
+            ((jnode_arr_t*)p->node)->hash = 0;
+    }
+    return 0;
 }
 
-/* Begin writing of object value to json writer.
- * Possible errors are not reported until call to jw_get().
+/* Apply edit to text of document and update its tree.
+ * Only the smallest array or object containing edited part is parsed
+ * again; if it becomes invalid, then its parents are tried. Edit of
+ * root array or object parses the whole text. Memory of replaced nodes
+ * is released when the whole text is parsed, which is also done when
+ * replaced text becomes longer than the whole text, so nodes got from
+ * document before the call must not be used after it.
  *
  * In:
- *      jw - ptr to json writer object
- *      name - object attribute name if writing is done inside object context;
- *             must be NULL if writing is done inside array context
+ *      jp - ptr to json parser object
+ *      jd - ptr to json document made by jdoc_parse_text()
+ *      off - offset of edited part of text
+ *      old_len - length of edited part
+ *      text - new text of edited part
+ *      len - length of new text
+ * Return:
+ *      0 - success
+ *      !0 - error (document is not changed)
  */
-void jw_obegin(jwriter_t *jw, const char *name)
+int jp_reparse(jparser_t *jp, jdoc_t *jd, size_t off, size_t old_len,
+    const char *text, size_t len)
 {
-    if (jw_prepv(jw, name))
-        return;
+    if (jd->text == NULL || off > jd->tlen || old_len > jd->tlen - off) {
+        ERROR("invalid edit");
+        return -1;
+    }
 
-    jw_strz(jw, "{");
+    // find the smallest span with edit strictly inside of brackets
+    jspan_t *sp = NULL;
+    size_t pos = 0;
+    for (jspan_t *s = jd->span; s; ) {
+        size_t st = pos + s->start;
+        if (!(off > st && off + old_len < st + s->len))
+            break;
+        sp = s;
+        pos = st;
+
+        // last child starting before edit
+        int lo = 0, hi = s->nkids;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (st + s->kids[mid]->start < off)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        s = lo ? s->kids[lo - 1] : NULL;
+    }
 
-    if (jw->sidx >= jw->ssize - 1) {
-        jw->err = 1;
-        return;
+    // old text is kept to undo failed edit
+    char *old = malloc(old_len ? old_len : 1);
+    if (old == NULL)
+        goto enomem;
+    memcpy(old, jd->text + off, old_len);
+    if (jdoc_edit(jd, off, old_len, text, len))
+        goto enomem;
+
+    // root is parsed with the whole text to replace memory of all nodes
+    int res = 1;
+    while (sp && sp->parent && res > 0) {
+        res = jspan_reparse(jp, jd, sp, pos, sp->len - old_len + len);
+        pos -= sp->start;
+        sp = sp->parent;
     }
-    jw->sidx++;
+    if (res > 0)
+        res = jdoc_full(jd, jp);
 
-    jwstk *s = jw->stack + jw->sidx;
-    s->ctx = CTXOBJ;
-    s->tt = JOSTART;
-    s->pp = (jw->ppd > jw->sidx);
+    if (res) {
+        jdoc_edit(jd, off, len, old, old_len);
+        free(old);
+        return -1;
+    }
+    free(old);
+
+    // memory of replaced subtrees is released when it becomes bigger
+    // than memory of the tree (estimated by length of text); edit is
+    // already done, so failure only leaves the memory for later
+    if (jd->dead > jd->tlen)
+        jdoc_full(jd, jp);
+    return 0;
+
+enomem:
+    ERROR("no memory");
+    free(old);
+    return -1;
 }
 
-/* End writing of object value to json writer.
- * Possible errors are not reported until call to jw_get().
+
+/*****************************************************************************
+* Parsing of compressed json.
+*****************************************************************************/
+
+#if JSON_ZLIB == 1
+
+// Maximum size of compressed data given to zlib at once.
+#define JSON_ZLIB_IN (1u << 30)
+
+// State of gzip decompression.
+typedef struct {
+    z_stream z; // zlib stream
+    const char *in; // compressed data not given to zlib yet
+    size_t rest; // size of compressed data not given to zlib yet
+    bool end; // end of compressed stream is reached
+} jgzip;
+
+// Read next part of json from gzip stream.
+static size_t jp_read_gzip(void *ctx, char *buf, size_t size)
+{
+    jgzip *g = ctx;
+    z_stream *z = &g->z;
+    if (size > UINT_MAX)
+        size = UINT_MAX;
+    z->next_out = (Bytef*)buf;
+    z->avail_out = (uInt)size;
+
+    while (z->avail_out) {
+        if (z->avail_in == 0 && g->rest) {
+            z->next_in = (Bytef*)g->in;
+            z->avail_in = (uInt)(g->rest < JSON_ZLIB_IN ? g->rest : JSON_ZLIB_IN);
+            g->in += z->avail_in;
+            g->rest -= z->avail_in;
+        }
+        int r = inflate(z, Z_NO_FLUSH);
+        if (r == Z_STREAM_END) {
+            // gzip file can consist of several members
+            g->end = true;
+            if (z->avail_in == 0 && g->rest == 0)
+                break;
+            if (inflateReset(z) != Z_OK)
+                return (size_t)-1;
+            g->end = false;
+        } else if (r == Z_BUF_ERROR) {
+            break; // no more input
+        } else if (r != Z_OK) {
+            ERROR("gzip error: %s", z->msg ? z->msg : "unknown");
+            return (size_t)-1;
+        }
+    }
+
+    size_t n = size - z->avail_out;
+    if (n == 0 && !g->end) {
+        ERROR("gzip stream is truncated");
+        return (size_t)-1;
+    }
+    return n;
+}
+
+/* Parse gzip (or zlib) compressed json.
+ * Json is decompressed by parts while it is parsed, so decompressed json
+ * is never kept in memory as a whole (see jp_parse_read()).
  *
  * In:
- *      jw - ptr to json writer object
+ *      jp - ptr to json parser object
+ *      root[out] - address of ptr to root node
+ *      data - ptr to compressed data
+ *      len - length of compressed data
+ * Return:
+ *      0 - success
+ *      !0 - error
  */
-void jw_oend(jwriter_t *jw)
+int jp_parse_gzip(jparser_t *jp, jnode_t **root, const void *data, size_t len)
 {
-    if (!jw || jw->err)
-        return;
+    jgzip g;
+    memset(&g, 0, sizeof(g));
+    g.in = data;
+    g.rest = len;
 
-    if (jw->sidx == 0) {
-        jw->err = 1;
-        return;
+    // window bits 15 + 32 detect gzip or zlib header automatically
+    if (inflateInit2(&g.z, 15 + 32) != Z_OK) {
+        ERROR("no memory");
+        return -1;
     }
-    jw->sidx--;
+    int res = jp_parse_read(jp, root, jp_read_gzip, &g);
+    inflateEnd(&g.z);
+    return res;
+}
 
-    if (jw->stack[jw->sidx].pp && jw->stack[jw->sidx+1].pp) {
-        jw_margin(jw);
+#endif
+
+#if JSON_ZSTD == 1
+
+// State of zstd decompression.
+typedef struct {
+    ZSTD_DStream *ds; // zstd stream
+    ZSTD_inBuffer in; // compressed data
+    size_t hint; // result of last decompression (0 - frame is complete)
+} jzstd;
+
+// Read next part of json from zstd stream.
+static size_t jp_read_zstd(void *ctx, char *buf, size_t size)
+{
+    jzstd *z = ctx;
+    ZSTD_outBuffer out = {buf, size, 0};
+
+    while (out.pos < out.size) {
+        size_t opos = out.pos, ipos = z->in.pos;
+        size_t r = ZSTD_decompressStream(z->ds, &out, &z->in);
+        if (ZSTD_isError(r)) {
+            ERROR("zstd error: %s", ZSTD_getErrorName(r));
+            return (size_t)-1;
+        }
+        z->hint = r;
+        if (out.pos == opos && z->in.pos == ipos)
+            break; // no more input
     }
-    jw_strz(jw, "}");
 
-    jw->stack[jw->sidx].tt = JOEND;
+    if (out.pos == 0 && z->hint != 0) {
+        ERROR("zstd stream is truncated");
+        return (size_t)-1;
+    }
+    return out.pos;
+}
+
+/* Parse zstd compressed json.
+ * Json is decompressed by parts while it is parsed, so decompressed json
+ * is never kept in memory as a whole (see jp_parse_read()).
+ *
+ * In:
+ *      jp - ptr to json parser object
+ *      root[out] - address of ptr to root node
+ *      data - ptr to compressed data
+ *      len - length of compressed data
+ * Return:
+ *      0 - success
+ *      !0 - error
+ */
+int jp_parse_zstd(jparser_t *jp, jnode_t **root, const void *data, size_t len)
+{
+    jzstd z;
+    z.ds = ZSTD_createDStream();
+    if (z.ds == NULL) {
+        ERROR("no memory");
+        return -1;
+    }
+    ZSTD_initDStream(z.ds);
+    z.in.src = data;
+    z.in.size = len;
+    z.in.pos = 0;
+    z.hint = 0;
+
+    int res = jp_parse_read(jp, root, jp_read_zstd, &z);
+    ZSTD_freeDStream(z.ds);
+    return res;
 }
+
+#endif
@@ -2,12 +2,31 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /* Define JSON_DOUBLE as 1, if your json data contains floating point numbers
  * and your platform supports 'double' type.
  */
 #define JSON_DOUBLE 1
 
+/* Define JSON_MMAP as 1, if your platform supports memory mapped files
+ * (POSIX mmap()); it is needed for jfile_xxx methods.
+ */
+#define JSON_MMAP 1
+
+/* Define JSON_ZLIB (JSON_ZSTD) as 1 to parse gzip (zstd) compressed json;
+ * zlib (libzstd) library must be linked then.
+ */
+#ifndef JSON_ZLIB
+#define JSON_ZLIB 0
+#endif
+#ifndef JSON_ZSTD
+#define JSON_ZSTD 0
+#endif
+
+// Maximum number of dimensions of packed array (matrix).
+#define JSON_NDIM_MAX 4
+
 // Json value types.
 typedef enum _jtype_t {
     JT_NONE, // absent value
@@ -19,21 +38,34 @@ typedef enum _jtype_t {
 #endif
     JT_STR, // string (zero terminated)
     JT_ARR, // array
-    JT_OBJ // object
+    JT_OBJ, // object
+    JT_DEC // decimal
 } jtype_t;
 
 // Json node represent json value after parsing.
 typedef struct _jnode_t jnode_t;
 struct _jnode_t {
     jtype_t type; // json value type
+    unsigned int flags; // node flags (for internal use)
 
     union {
-        bool bool_val; // boolean value
-        int int_val; // int value
+        struct {
+            union {
+                bool bool_val; // boolean value
+                int int_val; // int value
 #if JSON_DOUBLE == 1
-        double dbl_val; // double value
+                double dbl_val; // double value
 #endif
 
+                // decimal value (mant * 10^exp)
+                struct {
+                    int64_t mant; // mantissa
+                    int exp; // exponent
+                } dec_val;
+            };
+            const char *num_txt; // original number text (if kept)
+        };
+
         struct {
             const char *str_val; // string (zero terminated)
             int str_len; // string length
@@ -43,6 +75,13 @@ struct _jnode_t {
         struct {
             jnode_t **values; // array of element values
             int count; // element count
+            jtype_t packed; // element type if array is packed, else JT_NONE
+            union {
+                int *ints; // packed int values
+#if JSON_DOUBLE == 1
+                double *dbls; // packed double values
+#endif
+            };
         } elts;
 
         // object attributes
@@ -54,20 +93,148 @@ struct _jnode_t {
     };
 };
 
+// Json parser flags.
+enum {
+    JP_PACK = 0x01, // store arrays of numbers of the same type packed
+    JP_MATRIX = 0x02, // store rectangular nested arrays of numbers packed
+    JP_INTERN = 0x04, // store equal short string values only once
+    JP_DEDUP = 0x08, // store equal objects and arrays only once
+    JP_DECIMAL = 0x10, // store floating point numbers as decimals
+    JP_RAWNUM = 0x20 // keep original text of numbers
+};
+
+// Json node comparison and sorting flags.
+enum {
+    JN_UNORDERED = 0x01, // order of object attributes is not significant
+    JN_DESC = 0x02 // sort in descending order
+};
+
+// Json tree walker actions (returned by visitor callbacks).
+enum {
+    JN_WALK_NEXT, // continue walking
+    JN_WALK_SKIP, // do not visit children of current node
+    JN_WALK_STOP // stop walking
+};
+
+// Json tree visitor callback (name is NULL for non-attribute nodes).
+typedef int (*jn_visit_t)(jnode_t *node, const char *name, int depth,
+    void *ctx);
+
+// Function reading next part of json (see jp_parse_read()).
+// Returns number of bytes read, 0 at the end or (size_t)-1 on error.
+typedef size_t (*jp_read_t)(void *ctx, char *buf, size_t size);
+
+// Aggregate operators.
+enum {
+    JAGG_COUNT = 0x01, // count of numbers
+    JAGG_SUM = 0x02, // sum of numbers
+    JAGG_MIN = 0x04, // minimal number
+    JAGG_MAX = 0x08, // maximal number
+    JAGG_AVG = 0x10, // average of numbers
+    JAGG_HIST = 0x20 // histogram (see jagg_hist())
+};
+
+// Json flattener flags.
+enum {
+    JFLAT_BRACKETS = 0x01 // array indexes are written as "[i]"
+};
+
+// Leaf value of flattened json.
+typedef struct {
+    const char *path; // path of value (zero terminated)
+    int path_len; // length of path
+    jnode_t value; // scalar value, empty array or empty object
+} jleaf_t;
+
+// CSV converter flags.
+enum {
+    JCSV_HEADER = 0x01 // first row contains column names
+};
+
 // Json parser opaque object.
 typedef struct _jparser_t jparser_t;
 
 // Json writer opaque object.
 typedef struct _jwriter_t jwriter_t;
 
+// Json document opaque object.
+typedef struct _jdoc_t jdoc_t;
+
+// Memory arena opaque object.
+typedef struct _marena_t jarena_t;
+
+// Aggregation opaque object.
+typedef struct _jagg_t jagg_t;
+
+// Json filter opaque object.
+typedef struct _jfilter_t jfilter_t;
+
+// Json flattener opaque object.
+typedef struct _jflat_t jflat_t;
+
+// CSV converter opaque object.
+typedef struct _jcsv_t jcsv_t;
+
+// Offset index opaque object.
+typedef struct _joffs_t joffs_t;
+
+#if JSON_MMAP == 1
+// Memory mapped json file opaque object.
+typedef struct _jfile_t jfile_t;
+#endif
+
+// Cache of parsed documents opaque object.
+typedef struct _jcache_t jcache_t;
+
+// Json index opaque object.
+typedef struct _jindex_t jindex_t;
+
+// Json join callback (called for pairs of elements with equal keys).
+typedef int (*jn_join_t)(jnode_t *a, jnode_t *b, void *ctx);
+
 // Json node methods.
 jnode_t *jn_elt(jnode_t *node, int i);
 jnode_t *jn_attr(jnode_t *node, const char *name);
+int *jn_ints(jnode_t *node);
+#if JSON_DOUBLE == 1
+double *jn_dbls(jnode_t *node);
+#endif
+int jn_matrix(jnode_t *node, int shape[JSON_NDIM_MAX]);
+int jn_base64_decode(jnode_t *node, void *buf, size_t size);
+unsigned int jn_hash(jnode_t *node, int flags);
+bool jn_equal(jnode_t *a, jnode_t *b, int flags);
+int jn_walk(jnode_t *node, jn_visit_t pre, jn_visit_t post, void *ctx);
+int jn_diff(jwriter_t *jw, jnode_t *a, jnode_t *b, const char *name);
+int jn_patch(jwriter_t *jw, jnode_t *doc, jnode_t *patch, const char *name);
+int jn_merge_patch(jwriter_t *jw, jnode_t *doc, jnode_t *patch,
+    const char *name);
+jnode_t *jn_clone(jdoc_t *jd, jnode_t *node);
+int jn_sort(jnode_t *root, const char *apath, const char *path, int flags);
+
+// Json index methods.
+jindex_t *jn_index_build(jarena_t *ja, jnode_t *arr, const char *field);
+int jn_index_find(jindex_t *ji, jnode_t *key);
+int jn_index_next(jindex_t *ji, int i);
+int jn_index_join(jindex_t *ji, jnode_t *arr, const char *field,
+    jn_join_t cb, void *ctx);
 
 // Json parser methods.
 int jp_create(jparser_t **jp, size_t mem, size_t stack);
 void jp_destroy(jparser_t *jp);
+void jp_set_flags(jparser_t *jp, int flags);
 int jp_parse(jparser_t *jp, jnode_t **root, const char *str, size_t len);
+int jp_parse_read(jparser_t *jp, jnode_t **root, jp_read_t read, void *ctx);
+#if JSON_ZLIB == 1
+int jp_parse_gzip(jparser_t *jp, jnode_t **root, const void *data, size_t len);
+#endif
+#if JSON_ZSTD == 1
+int jp_parse_zstd(jparser_t *jp, jnode_t **root, const void *data, size_t len);
+#endif
+jarena_t *jp_arena(jparser_t *jp);
+int jp_iter_begin(jparser_t *jp, const char *json, size_t len);
+int jp_iter_next(jparser_t *jp, jnode_t **elt);
+int jp_reparse(jparser_t *jp, jdoc_t *jd, size_t off, size_t old_len,
+    const char *text, size_t len);
 
 // Json writer methods.
 int jw_create(jwriter_t **jw, size_t mem, size_t stack);
@@ -85,10 +252,81 @@ void jw_dbl(jwriter_t *jw, double val, const char *name);
 void jw_dbl_prec(jwriter_t *jw, double val, int prec, const char *name);
 #endif
 void jw_int(jwriter_t *jw, int val, const char *name);
+void jw_decimal(jwriter_t *jw, int64_t mant, int exp, const char *name);
 void jw_str(jwriter_t *jw, const char *str, const char *name);
+void jw_base64(jwriter_t *jw, const void *data, size_t len, const char *name);
 
 void jw_abegin(jwriter_t *jw, const char *name);
 void jw_aend(jwriter_t *jw);
 
 void jw_obegin(jwriter_t *jw, const char *name);
 void jw_oend(jwriter_t *jw);
+
+void jw_node(jwriter_t *jw, jnode_t *node, const char *name);
+
+// Json document methods.
+int jdoc_create(jdoc_t **jd, size_t mem);
+void jdoc_destroy(jdoc_t *jd);
+jdoc_t *jdoc_ref(jdoc_t *jd);
+int jdoc_parse(jdoc_t **jd, jparser_t *jp, const char *json, size_t len);
+jnode_t *jdoc_root(jdoc_t *jd);
+int jdoc_parse_text(jdoc_t **jd, jparser_t *jp, const char *json, size_t len);
+const char *jdoc_text(jdoc_t *jd, size_t *len);
+jarena_t *jdoc_arena(jdoc_t *jd);
+
+// Memory arena methods.
+jarena_t *jarena_create(size_t size);
+void jarena_destroy(jarena_t *ja);
+int jarena_reset(jarena_t *ja);
+void *jarena_alloc(jarena_t *ja, size_t size);
+char *jarena_strdup(jarena_t *ja, const char *str);
+
+// Aggregation methods.
+int jagg_create(jagg_t **ja);
+void jagg_destroy(jagg_t *ja);
+int jagg_add(jagg_t *ja, const char *path, int ops);
+int jagg_hist(jagg_t *ja, int id, double lo, double hi, int bins);
+int jagg_run(jagg_t *ja, const char *json, size_t len);
+double jagg_get(jagg_t *ja, int id, int op);
+const long *jagg_bins(jagg_t *ja, int id, int *bins);
+void jagg_reset(jagg_t *ja);
+
+// Json filter methods.
+int jfilter_create(jfilter_t **jf, const char *name, const char *value);
+void jfilter_destroy(jfilter_t *jf);
+bool jfilter_match(jfilter_t *jf, const char *json, size_t len);
+
+// Json flattener methods.
+int jflat_create(jflat_t **jf, const char *sep, int flags);
+void jflat_destroy(jflat_t *jf);
+void jflat_begin(jflat_t *jf, const char *json, size_t len);
+int jflat_next(jflat_t *jf, jleaf_t *leaves, int cnt, char *buf, size_t size);
+
+// CSV converter methods.
+int jcsv_create(jcsv_t **jc, char sep, int flags);
+void jcsv_destroy(jcsv_t *jc);
+int jcsv_add(jcsv_t *jc, const char *path);
+void jcsv_begin(jcsv_t *jc, const char *json, size_t len);
+int jcsv_next(jcsv_t *jc, char *buf, size_t size, size_t *len);
+
+// Offset index methods.
+int joffs_build(joffs_t **jo, const char *json, size_t len);
+void joffs_destroy(joffs_t *jo);
+size_t joffs_count(joffs_t *jo);
+int joffs_span(joffs_t *jo, size_t i, size_t *pos, size_t *len);
+int joffs_save(joffs_t *jo, const char *path);
+int joffs_load(joffs_t **jo, const char *path, size_t size);
+
+#if JSON_MMAP == 1
+// Json file methods.
+int jfile_open(jfile_t **jf, const char *path);
+void jfile_close(jfile_t *jf);
+size_t jfile_count(jfile_t *jf);
+int jfile_parse(jfile_t *jf, jparser_t *jp, size_t i, jnode_t **elt);
+#endif
+
+// Cache methods.
+int jcache_create(jcache_t **jc, size_t size);
+void jcache_destroy(jcache_t *jc);
+int jcache_parse(jcache_t *jc, jparser_t *jp, jdoc_t **jd, const char *json,
+    size_t len);
@@ -4,6 +4,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#if JSON_MMAP == 1
+#include <utime.h>
+#endif
+#if JSON_ZLIB == 1
+#include <zlib.h>
+#endif
+#if JSON_ZSTD == 1
+#include <zstd.h>
+#endif
 
 
 /*****************************************************************************
@@ -428,6 +437,1838 @@ static bool Test8(void)
 }
 
 
+// Packed arrays of numbers.
+static bool Test9(void)
+{
+    bool ret = false;
+    jnode_t *n;
+    int *ints;
+
+    json = "[[1, 2, 3], [1.5, -2.5], [4, 5.5, \"x\"], []]";
+
+    printf("%s: %s\n", __func__, json);
+
+    jp_set_flags(jp, JP_PACK);
+    if (jp_parse(jp, &node, json, strlen(json)))
+        goto exit;
+    if (node->type != JT_ARR || node->elts.count != 4)
+        goto exit;
+
+    // array of ints
+    n = jn_elt(node, 0);
+    ints = jn_ints(n);
+    if (!ints || n->elts.count != 3 || n->elts.values != NULL)
+        goto exit;
+    if (ints[0] != 1 || ints[1] != 2 || ints[2] != 3)
+        goto exit;
+    if (!is_node_int(jn_elt(n, 2), 3) || jn_ints(n) != ints)
+        goto exit;
+
+#if JSON_DOUBLE == 1
+    // array of doubles
+    n = jn_elt(node, 1);
+    double *dbls = jn_dbls(n);
+    if (!dbls || n->elts.count != 2 || dbls[0] != 1.5 || dbls[1] != -2.5)
+        goto exit;
+    if (!is_node_dbl(jn_elt(n, 1), -2.5))
+        goto exit;
+
+    // mixed array
+    n = jn_elt(node, 2);
+    if (jn_ints(n) || jn_dbls(n) || n->elts.count != 3)
+        goto exit;
+    if (!is_node_int(n->elts.values[0], 4))
+        goto exit;
+    if (!is_node_dbl(n->elts.values[1], 5.5))
+        goto exit;
+    if (!is_node_str(n->elts.values[2], "x"))
+        goto exit;
+#endif
+
+    // empty array
+    n = jn_elt(node, 3);
+    if (n->type != JT_ARR || n->elts.count != 0 || jn_ints(n))
+        goto exit;
+
+    ret = true;
+
+exit:
+    jp_set_flags(jp, 0);
+    return ret;
+}
+
+
+// Matrices.
+static bool Test10(void)
+{
+    bool ret = false;
+    int shape[JSON_NDIM_MAX];
+    jnode_t *n;
+    int *ints;
+
+    json = "{\"m2\": [[1, 2], [3, 4], [5, 6]],"
+           " \"m3\": [[[1, 2], [3, 4]], [[5, 6], [7, 8]]],"
+           " \"bad\": [[1, 2], [3], 4]}";
+
+    printf("%s: %s\n", __func__, json);
+
+    jp_set_flags(jp, JP_MATRIX);
+    if (jp_parse(jp, &node, json, strlen(json)))
+        goto exit;
+
+    // 3x2 matrix
+    n = jn_attr(node, "m2");
+    ints = jn_ints(n);
+    if (jn_matrix(n, shape) != 2 || shape[0] != 3 || shape[1] != 2)
+        goto exit;
+    for (int i = 0; i < 6; i++)
+        if (ints[i] != i + 1)
+            goto exit;
+    if (n->elts.count != 3 || !is_node_int(jn_elt(jn_elt(n, 2), 1), 6))
+        goto exit;
+    if (jn_ints(jn_elt(n, 1)) != ints + 2)
+        goto exit;
+
+    // 2x2x2 matrix
+    n = jn_attr(node, "m3");
+    ints = jn_ints(n);
+    if (jn_matrix(n, shape) != 3 || shape[0] != 2 || shape[1] != 2
+            || shape[2] != 2)
+        goto exit;
+    for (int i = 0; i < 8; i++)
+        if (ints[i] != i + 1)
+            goto exit;
+    n = jn_elt(n, 1);
+    if (jn_matrix(n, shape) != 2 || !is_node_int(jn_elt(jn_elt(n, 0), 1), 6))
+        goto exit;
+
+    // not a matrix
+    n = jn_attr(node, "bad");
+    if (jn_matrix(n, shape) != 0 || n->elts.count != 3)
+        goto exit;
+    if (jn_matrix(jn_elt(n, 0), shape) != 1 || shape[0] != 2)
+        goto exit;
+    if (jn_matrix(jn_elt(n, 1), shape) != 1 || shape[0] != 1)
+        goto exit;
+    if (!is_node_int(jn_elt(jn_elt(n, 1), 0), 3))
+        goto exit;
+    if (!is_node_int(jn_elt(n, 2), 4))
+        goto exit;
+
+    ret = true;
+
+exit:
+    jp_set_flags(jp, 0);
+    return ret;
+}
+
+
+// Interned string values.
+static bool Test11(void)
+{
+    bool ret = false;
+
+    json = "[\"Feature\", \"Polygon\", \"Feature\", \"Fea\\tture\","
+           " \"Fea\\tture\"]";
+
+    printf("%s: %s\n", __func__, json);
+
+    jp_set_flags(jp, JP_INTERN);
+    if (jp_parse(jp, &node, json, strlen(json)))
+        goto exit;
+    if (node->type != JT_ARR || node->elts.count != 5)
+        goto exit;
+    if (!is_node_str(jn_elt(node, 0), "Feature"))
+        goto exit;
+    if (!is_node_str(jn_elt(node, 1), "Polygon"))
+        goto exit;
+    if (!is_node_str(jn_elt(node, 3), "Fea\tture"))
+        goto exit;
+    if (jn_elt(node, 3)->str_len != 8)
+        goto exit;
+    if (jn_elt(node, 0)->str_val != jn_elt(node, 2)->str_val)
+        goto exit;
+    if (jn_elt(node, 0)->str_val == jn_elt(node, 1)->str_val)
+        goto exit;
+    if (jn_elt(node, 3)->str_val != jn_elt(node, 4)->str_val)
+        goto exit;
+
+    ret = true;
+
+exit:
+    jp_set_flags(jp, 0);
+    return ret;
+}
+
+
+// Short and long string values.
+static bool Test12(void)
+{
+    const char *vals[] = {
+        "", "a", "0123456789abcde", "0123456789abcdef",
+        "tab\tquote\"end", "long string value with \"escapes\"\n"
+    };
+    enum { count = sizeof(vals) / sizeof(vals[0]) };
+
+    jw_begin(jw);
+    {
+        jw_abegin(jw, NULL);
+        for (int i = 0; i < count; i++)
+            jw_str(jw, vals[i], NULL);
+        jw_aend(jw);
+    }
+    if (jw_get(jw, &json, &jsize))
+        return false;
+
+    printf("%s: %s\n", __func__, json);
+
+    if (jp_parse(jp, &node, json, jsize))
+        return false;
+    if (node->type != JT_ARR || node->elts.count != count)
+        return false;
+    for (int i = 0; i < count; i++) {
+        jnode_t *n = jn_elt(node, i);
+        if (!is_node_str(n, vals[i]) || n->str_len != (int)strlen(vals[i]))
+            return false;
+    }
+
+    return true;
+}
+
+
+// Sharing of equal objects and arrays.
+static bool Test13(void)
+{
+    bool ret = false;
+    jnode_t *a, *b;
+
+    json = "[{\"id\": 1, \"tags\": [\"x\", \"y\"], \"p\": [1, 2]},"
+           " {\"id\": 2, \"tags\": [\"x\", \"y\"], \"p\": [1, 2]},"
+           " {\"id\": 1, \"tags\": [\"x\", \"y\"], \"p\": [1, 2]},"
+           " {\"tags\": [\"x\", \"y\"], \"id\": 1, \"p\": [1, 2]},"
+           " [[1, 2], [1, 2]]]";
+
+    printf("%s: %s\n", __func__, json);
+
+    jp_set_flags(jp, JP_DEDUP);
+    if (jp_parse(jp, &node, json, strlen(json)))
+        goto exit;
+    if (node->type != JT_ARR || node->elts.count != 5)
+        goto exit;
+
+    // equal objects are shared
+    a = jn_elt(node, 0);
+    b = jn_elt(node, 2);
+    if (a != b || !is_node_int(jn_attr(b, "id"), 1))
+        goto exit;
+
+    // different objects contain shared arrays
+    b = jn_elt(node, 1);
+    if (a == b || !is_node_int(jn_attr(b, "id"), 2))
+        goto exit;
+    if (jn_attr(a, "tags") != jn_attr(b, "tags"))
+        goto exit;
+    if (!is_node_str(jn_elt(jn_attr(b, "tags"), 1), "y"))
+        goto exit;
+
+    // attribute order matters
+    b = jn_elt(node, 3);
+    if (a == b || jn_attr(a, "p") != jn_attr(b, "p"))
+        goto exit;
+
+    // shared arrays inside of array
+    b = jn_elt(node, 4);
+    if (jn_elt(b, 0) != jn_elt(b, 1) || jn_elt(b, 0) != jn_attr(a, "p"))
+        goto exit;
+
+    // shared packed arrays and matrices
+    jp_set_flags(jp, JP_DEDUP | JP_MATRIX);
+    json = "{\"a\": [[1, 2], [3, 4]], \"b\": [[1, 2], [3, 4]],"
+           " \"c\": [1, 2], \"d\": [1, 2]}";
+    if (jp_parse(jp, &node, json, strlen(json)))
+        goto exit;
+    if (jn_attr(node, "a") != jn_attr(node, "b"))
+        goto exit;
+    if (jn_attr(node, "c") != jn_attr(node, "d"))
+        goto exit;
+    if (jn_ints(jn_attr(node, "b"))[3] != 4)
+        goto exit;
+
+    // packed arrays are compared without making element nodes
+    jp_set_flags(jp, JP_MATRIX);
+    json = "{\"a\": [[1, 2], [3, 4]], \"b\": [[1, 2], [3, 4, 5]]}";
+    if (jp_parse(jp, &node, json, strlen(json)))
+        goto exit;
+    a = jn_attr(node, "a");
+    if (jn_equal(a, jn_attr(node, "b"), 0) || a->elts.values != NULL)
+        goto exit;
+
+    ret = true;
+
+exit:
+    jp_set_flags(jp, 0);
+    return ret;
+}
+
+
+// Decimal numbers.
+static bool Test14(void)
+{
+    bool ret = false;
+    jnode_t *n;
+
+    json = "[1.50, -0.001, 1e3, 2.5E-2, 12345678901,"
+           " 123456789012345678901234567890.5, 7]";
+
+    printf("%s: %s\n", __func__, json);
+
+    jp_set_flags(jp, JP_DECIMAL);
+    if (jp_parse(jp, &node, json, strlen(json)))
+        goto exit;
+    if (node->type != JT_ARR || node->elts.count != 7)
+        goto exit;
+
+    n = jn_elt(node, 0);
+    if (n->type != JT_DEC || n->dec_val.mant != 150 || n->dec_val.exp != -2)
+        goto exit;
+    n = jn_elt(node, 1);
+    if (n->type != JT_DEC || n->dec_val.mant != -1 || n->dec_val.exp != -3)
+        goto exit;
+    n = jn_elt(node, 2);
+    if (n->type != JT_DEC || n->dec_val.mant != 1 || n->dec_val.exp != 3)
+        goto exit;
+    n = jn_elt(node, 3);
+    if (n->type != JT_DEC || n->dec_val.mant != 25 || n->dec_val.exp != -3)
+        goto exit;
+    n = jn_elt(node, 4);
+    if (n->type != JT_DEC || n->dec_val.mant != 12345678901LL
+            || n->dec_val.exp != 0 || n->num_txt != NULL)
+        goto exit;
+    n = jn_elt(node, 5);
+    if (n->type != JT_DEC || !n->num_txt
+            || strcmp(n->num_txt, "123456789012345678901234567890.5"))
+        goto exit;
+    if (!is_node_int(jn_elt(node, 6), 7))
+        goto exit;
+
+    // zero with kept text is not a number given by text only
+    if (jp_parse(jp, &node, "[0.0]", 5))
+        goto exit;
+    unsigned int h = jn_hash(node, 0);
+    jp_set_flags(jp, JP_DECIMAL | JP_RAWNUM);
+    if (jp_parse(jp, &node, "[0e0]", 5))
+        goto exit;
+    n = jn_elt(node, 0);
+    if (n->type != JT_DEC || !n->num_txt || n->dec_val.mant != 0
+            || jn_hash(node, 0) != h)
+        goto exit;
+    jp_set_flags(jp, JP_DECIMAL);
+
+    // write decimals
+    jw_begin(jw);
+    {
+        jw_abegin(jw, NULL);
+        {
+            jw_decimal(jw, 150, -2, NULL);
+            jw_decimal(jw, -1, -3, NULL);
+            jw_decimal(jw, 1, 3, NULL);
+            jw_decimal(jw, -12345, 0, NULL);
+            jw_decimal(jw, 5, -30, NULL);
+        }
+        jw_aend(jw);
+    }
+    if (jw_get(jw, &json, &jsize))
+        goto exit;
+
+    printf("%s: %s\n", __func__, json);
+
+    if (!strstr(json, "1.50,") || !strstr(json, "-0.001,")
+            || !strstr(json, "1e3,") || !strstr(json, "-12345,")
+            || !strstr(json, "5e-30"))
+        goto exit;
+
+    ret = true;
+
+exit:
+    jp_set_flags(jp, 0);
+    return ret;
+}
+
+
+// Writing of parsed json with original number text.
+static bool Test15(void)
+{
+    bool ret = false;
+    const char *src = "[1.0,1.000,-0,1e3,12345678901234567890123,"
+                      "{\"a\":2.50,\"b\":[true,null,\"s\"]}]";
+    char *out;
+
+    printf("%s: %s\n", __func__, src);
+
+    jp_set_flags(jp, JP_RAWNUM);
+    if (jp_parse(jp, &node, src, strlen(src)))
+        goto exit;
+    if (!is_node_int(jn_elt(node, 2), 0) || strcmp(jn_elt(node, 2)->num_txt, "-0"))
+        goto exit;
+
+    jw_pretty_print(jw, 0, 0);
+    jw_begin(jw);
+    jw_node(jw, node, NULL);
+    if (jw_get(jw, &out, NULL))
+        goto exit;
+    printf("%s: %s\n", __func__, out);
+    if (strcmp(out, src))
+        goto exit;
+
+    // numbers without original text
+    jp_set_flags(jp, JP_PACK | JP_DECIMAL);
+    if (jp_parse(jp, &node, src, strlen(src)))
+        goto exit;
+    jw_begin(jw);
+    jw_node(jw, node, NULL);
+    if (jw_get(jw, &out, NULL))
+        goto exit;
+    printf("%s: %s\n", __func__, out);
+    if (strcmp(out, "[1.0,1.000,0,1e3,12345678901234567890123,"
+                    "{\"a\":2.50,\"b\":[true,null,\"s\"]}]"))
+        goto exit;
+
+    ret = true;
+
+exit:
+    jw_pretty_print(jw, 2, 2);
+    jp_set_flags(jp, 0);
+    return ret;
+}
+
+
+// Base64 data.
+static bool Test16(void)
+{
+    enum { count = 40 };
+    unsigned char data[count], buf[count];
+
+    for (int i = 0; i < count; i++)
+        data[i] = (unsigned char)(i * 37 + 11);
+
+    jw_begin(jw);
+    {
+        jw_abegin(jw, NULL);
+        for (int i = 0; i <= count; i++)
+            jw_base64(jw, data, (size_t)i, NULL);
+        jw_str(jw, "TWFu\nTWE=", NULL);
+        jw_str(jw, "TW!u", NULL);
+        jw_aend(jw);
+    }
+    if (jw_get(jw, &json, &jsize))
+        return false;
+
+    printf("%s: %s\n", __func__, json);
+
+    if (jp_parse(jp, &node, json, jsize))
+        return false;
+    if (node->elts.count != count + 3)
+        return false;
+    for (int i = 0; i <= count; i++) {
+        int res = jn_base64_decode(jn_elt(node, i), buf, sizeof(buf));
+        if (res != i || memcmp(buf, data, (size_t)i))
+            return false;
+    }
+    if (jn_base64_decode(jn_elt(node, count), buf, count - 1) != -1)
+        return false;
+    if (jn_base64_decode(jn_elt(node, count + 1), buf, sizeof(buf)) != 5
+            || memcmp(buf, "ManMa", 5))
+        return false;
+    if (jn_base64_decode(jn_elt(node, count + 2), buf, sizeof(buf)) != -1)
+        return false;
+
+    // padding must complete the last quantum, trailing bits must be zero
+    static const char *pads[] = {"QQ", "QQ== ", "QUI=", "QQ==garbage", "=xyz",
+        "A", "QR==", "QQ=", "QUI=="};
+    for (int i = 0; i < 9; i++) {
+        jnode_t n = {.type = JT_STR, .str_val = pads[i],
+            .str_len = (int)strlen(pads[i])};
+        if (jn_base64_decode(&n, buf, sizeof(buf)) != (i < 3 ? 1 + i / 2 : -1))
+            return false;
+    }
+
+    return true;
+}
+
+
+// Nodes are not interleaved with string data.
+static bool Test17(void)
+{
+    jw_begin(jw);
+    {
+        jw_abegin(jw, NULL);
+        for (int i = 0; i < 100; i++) {
+            char buf[128];
+            snprintf(buf, sizeof(buf), "%03d-%0100d", i, i);
+            jw_str(jw, buf, NULL);
+        }
+        jw_aend(jw);
+    }
+    if (jw_get(jw, &json, &jsize))
+        return false;
+
+    if (jp_parse(jp, &node, json, jsize))
+        return false;
+    if (node->elts.count != 100)
+        return false;
+
+    // all nodes fit in less memory than their strings occupy
+    const char *lo = (const char*)jn_elt(node, 0);
+    const char *hi = lo;
+    for (int i = 0; i < node->elts.count; i++) {
+        const char *p = (const char*)jn_elt(node, i);
+        if (jn_elt(node, i)->str_len != 104)
+            return false;
+        lo = p < lo ? p : lo;
+        hi = p > hi ? p : hi;
+    }
+    if (hi - lo >= 100 * 104)
+        return false;
+
+    printf("%s: %s\n", __func__, jn_elt(node, 99)->str_val);
+    return true;
+}
+
+
+// Tree walker callbacks: record visited nodes to buffer.
+static char walk_buf[256];
+
+static int walk_pre(jnode_t *node, const char *name, int depth, void *ctx)
+{
+    (void)depth;
+    char *b = walk_buf + strlen(walk_buf);
+    if (name)
+        b += sprintf(b, "%s:", name);
+    *b++ = "-nbidsaoD"[node->type];
+    *b = 0;
+    if (name && strcmp(name, ctx) == 0)
+        return name[0] == 's' ? JN_WALK_STOP : JN_WALK_SKIP;
+    return JN_WALK_NEXT;
+}
+
+static int walk_post(jnode_t *node, const char *name, int depth, void *ctx)
+{
+    (void)node;
+    (void)depth;
+    (void)ctx;
+    char *b = walk_buf + strlen(walk_buf);
+    sprintf(b, ")%s ", name ? name : "");
+    return JN_WALK_NEXT;
+}
+
+static int walk_depth(jnode_t *node, const char *name, int depth, void *ctx)
+{
+    (void)name;
+    int *max = ctx;
+    if (depth > *max)
+        *max = depth;
+    if (node->type == JT_INT)
+        max[1] += node->int_val;
+    return JN_WALK_NEXT;
+}
+
+// Tree walker.
+static bool Test18(void)
+{
+    const char *src = "{\"a\": [1, 2, {\"b\": null}], \"c\": {\"d\": true},"
+        " \"s\": [\"x\", 3], \"e\": 4}";
+    jparser_t *p = NULL;
+    bool ret = false;
+
+    jp_set_flags(jp, JP_PACK);
+    if (jp_parse(jp, &node, src, strlen(src)))
+        goto exit;
+
+    walk_buf[0] = 0;
+    if (jn_walk(node, walk_pre, walk_post, "c") != 0)
+        goto exit;
+    printf("%s: %s\n", __func__, walk_buf);
+    if (strcmp(walk_buf, "oa:aiiob:n) )a c:o)c s:asi)s e:i) "))
+        goto exit;
+
+    walk_buf[0] = 0;
+    if (jn_walk(node, walk_pre, NULL, "s") != 1)
+        goto exit;
+    printf("%s: %s\n", __func__, walk_buf);
+    if (strcmp(walk_buf, "oa:aiiob:nc:od:bs:a"))
+        goto exit;
+
+    // deep nesting and packed arrays
+    enum { deep = 100 };
+    char buf[2 * deep + 16];
+    int len = 0;
+    for (int i = 0; i < deep; i++)
+        buf[len++] = '[';
+    len += sprintf(buf + len, "1, 2, 3");
+    for (int i = 0; i < deep; i++)
+        buf[len++] = ']';
+    if (jp_create(&p, 0, deep + 2))
+        goto exit;
+    jp_set_flags(p, JP_PACK);
+    if (jp_parse(p, &node, buf, (size_t)len))
+        goto exit;
+    int res[2] = {0, 0};
+    if (jn_walk(node, walk_depth, NULL, res) != 0)
+        goto exit;
+    if (res[0] != deep || res[1] != 6)
+        goto exit;
+
+    ret = true;
+
+exit:
+    jp_destroy(p);
+    jp_set_flags(jp, 0);
+    return ret;
+}
+
+
+// Apply patch (or merge patch) to json and compare result with expected one.
+static bool patch_check(jparser_t *p, bool merge, const char *src,
+    const char *patch, const char *res)
+{
+    jnode_t *doc, *pn;
+    char *out;
+
+    if (jp_parse(jp, &doc, src, strlen(src)))
+        return false;
+    if (jp_parse(p, &pn, patch, strlen(patch)))
+        return false;
+
+    jw_begin(jw);
+    int err = merge ? jn_merge_patch(jw, doc, pn, NULL)
+                    : jn_patch(jw, doc, pn, NULL);
+    if (res == NULL)
+        return err != 0;
+    if (err || jw_get(jw, &out, NULL))
+        return false;
+    printf("%s: %s\n", __func__, out);
+    return strcmp(out, res) == 0;
+}
+
+// Diff and patch.
+static bool Test19(void)
+{
+    const char *a = "{\"name\":\"cfg\",\"v\":1,\"list\":[1,2,3,4,5],"
+        "\"obj\":{\"x\":1,\"y\":[true,false]},\"gone\":\"z\",\"a/b\":1}";
+    const char *b = "{\"name\":\"cfg\",\"v\":2,\"list\":[1,2,9,4,5,6],"
+        "\"obj\":{\"x\":1,\"y\":[true]},\"a/b\":2,\"new\":{\"k\":null}}";
+    jparser_t *p = NULL;
+    jnode_t *na, *nb;
+    char *out;
+    bool ret = false;
+
+    jw_pretty_print(jw, 0, 0);
+    if (jp_create(&p, 0, 0))
+        goto exit;
+
+    // diff of trees
+    if (jp_parse(jp, &na, a, strlen(a)) || jp_parse(p, &nb, b, strlen(b)))
+        goto exit;
+    jw_begin(jw);
+    if (jn_diff(jw, na, nb, NULL) || jw_get(jw, &out, NULL))
+        goto exit;
+    printf("%s: %s\n", __func__, out);
+    if (strcmp(out, "[{\"op\":\"replace\",\"path\":\"\\/v\",\"value\":2},"
+            "{\"op\":\"replace\",\"path\":\"\\/list\\/2\",\"value\":9},"
+            "{\"op\":\"add\",\"path\":\"\\/list\\/5\",\"value\":6},"
+            "{\"op\":\"remove\",\"path\":\"\\/obj\\/y\\/1\"},"
+            "{\"op\":\"remove\",\"path\":\"\\/gone\"},"
+            "{\"op\":\"replace\",\"path\":\"\\/a~1b\",\"value\":2},"
+            "{\"op\":\"add\",\"path\":\"\\/new\",\"value\":{\"k\":null}}]"))
+        goto exit;
+
+    // applying of diff gives target tree
+    jparser_t *q = NULL;
+    if (jp_create(&q, 0, 0))
+        goto exit;
+    bool ok = patch_check(q, false, a, out, b);
+    jp_destroy(q);
+    if (!ok)
+        goto exit;
+
+    // no difference
+    jw_begin(jw);
+    if (jn_diff(jw, nb, nb, NULL) || jw_get(jw, &out, NULL) || strcmp(out, "[]"))
+        goto exit;
+
+    // operations of RFC 6902
+    if (!patch_check(p, false,
+            "{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+            "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"},"
+            "{\"op\":\"copy\",\"from\":\"/qux\",\"path\":\"/foo/q\"},"
+            "{\"op\":\"add\",\"path\":\"/foo/q/a\",\"value\":[1]},"
+            "{\"op\":\"add\",\"path\":\"/foo/q/a/0\",\"value\":0},"
+            "{\"op\":\"add\",\"path\":\"/foo/q/a/-\",\"value\":2},"
+            "{\"op\":\"test\",\"path\":\"/qux/thud\",\"value\":\"fred\"},"
+            "{\"op\":\"replace\",\"path\":\"/foo/bar\",\"value\":true}]",
+            "{\"foo\":{\"bar\":true,\"q\":{\"corge\":\"grault\",\"thud\":\"fred\","
+            "\"a\":[0,1,2]}},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}"))
+        goto exit;
+
+    // failed operations
+    if (!patch_check(p, false, "{\"a\":[1]}",
+            "[{\"op\":\"test\",\"path\":\"/a/0\",\"value\":2}]", NULL))
+        goto exit;
+    if (!patch_check(p, false, "{\"a\":[1]}",
+            "[{\"op\":\"add\",\"path\":\"/a/2\",\"value\":2}]", NULL))
+        goto exit;
+    if (!patch_check(p, false, "{\"a\":[1]}",
+            "[{\"op\":\"remove\",\"path\":\"/b\"}]", NULL))
+        goto exit;
+
+    // failed test is told apart from error
+    const char *t = "[{\"op\":\"test\",\"path\":\"/0\",\"value\":2}]";
+    jw_begin(jw);
+    if (jp_parse(jp, &na, "[1]", 3) || jp_parse(p, &nb, t, strlen(t))
+            || jn_patch(jw, na, nb, NULL) != 1
+            || jn_patch(jw, na, na, NULL) != -1)
+        goto exit;
+    t = "[{\"op\":\"test\",\"path\":\"/1\",\"value\":1}]";
+    if (jp_parse(p, &nb, t, strlen(t)) || jn_patch(jw, na, nb, NULL) != -1)
+        goto exit;
+
+    // numbers of different types are compared by value
+    for (int k = 0; k < 2; k++) {
+        jp_set_flags(p, k ? JP_DECIMAL : 0);
+        if (!patch_check(p, false, "{\"a\":[1,{\"x\":-2,\"y\":30}]}",
+                "[{\"op\":\"test\",\"path\":\"/a\","
+                "\"value\":[1.0,{\"y\":3e1,\"x\":-2}]}]",
+                "{\"a\":[1,{\"x\":-2,\"y\":30}]}"))
+            goto exit;
+    }
+    jp_set_flags(p, 0);
+
+    // merge patch example of RFC 7396
+    if (!patch_check(p, true,
+            "{\"title\":\"Goodbye!\",\"author\":{\"givenName\":\"John\","
+            "\"familyName\":\"Doe\"},\"tags\":[\"example\",\"sample\"],"
+            "\"content\":\"This will be unchanged\"}",
+            "{\"title\":\"Hello!\",\"phoneNumber\":\"+01-555-1234\","
+            "\"author\":{\"familyName\":null},\"tags\":[\"example\"],"
+            "\"x\":{\"y\":null,\"z\":{}}}",
+            "{\"title\":\"Hello!\",\"author\":{\"givenName\":\"John\"},"
+            "\"tags\":[\"example\"],\"content\":\"This will be unchanged\","
+            "\"phoneNumber\":\"+01-555-1234\",\"x\":{\"z\":{}}}"))
+        goto exit;
+
+    ret = true;
+
+exit:
+    jp_destroy(p);
+    jw_pretty_print(jw, 2, 2);
+    return ret;
+}
+
+
+// Hashing and equality of subtrees.
+static bool Test20(void)
+{
+    const char *src = "[{\"a\": 1, \"b\": [{\"x\": 1, \"y\": 2}, [1, 2, 3]]},"
+        " {\"b\": [{\"y\": 2, \"x\": 1}, [1, 2, 3]], \"a\": 1},"
+        " {\"a\": 1, \"b\": [{\"x\": 1, \"y\": 3}, [1, 2, 3]]}]";
+    jparser_t *p = NULL;
+    jnode_t *other;
+    bool ret = false;
+
+    if (jp_parse(jp, &node, src, strlen(src)))
+        goto exit;
+    jnode_t *e0 = jn_elt(node, 0);
+    jnode_t *e1 = jn_elt(node, 1);
+    jnode_t *e2 = jn_elt(node, 2);
+
+    // order of attributes
+    if (jn_equal(e0, e1, 0) || !jn_equal(e0, e1, JN_UNORDERED))
+        goto exit;
+    if (jn_hash(e0, 0) == jn_hash(e1, 0))
+        goto exit;
+    if (jn_hash(e0, JN_UNORDERED) != jn_hash(e1, JN_UNORDERED))
+        goto exit;
+
+    // different values
+    if (jn_equal(e0, e2, 0) || jn_equal(e0, e2, JN_UNORDERED))
+        goto exit;
+    if (jn_hash(e0, JN_UNORDERED) == jn_hash(e2, JN_UNORDERED))
+        goto exit;
+
+    // nodes of different trees (with packed arrays in one of them)
+    if (jp_create(&p, 0, 0))
+        goto exit;
+    jp_set_flags(p, JP_PACK);
+    if (jp_parse(p, &other, src, strlen(src)))
+        goto exit;
+    if (jn_ints(jn_elt(jn_attr(jn_elt(other, 0), "b"), 1)) == NULL)
+        goto exit;
+    if (!jn_equal(node, other, 0) || jn_hash(node, 0) != jn_hash(other, 0))
+        goto exit;
+    if (!jn_equal(e1, jn_elt(other, 0), JN_UNORDERED))
+        goto exit;
+    if (jn_hash(e1, JN_UNORDERED) != jn_hash(jn_elt(other, 0), JN_UNORDERED))
+        goto exit;
+
+    printf("%s: %08x %08x\n", __func__, jn_hash(node, 0),
+        jn_hash(node, JN_UNORDERED));
+    ret = true;
+
+exit:
+    jp_destroy(p);
+    return ret;
+}
+
+
+// Copying of subtrees to json document.
+static bool Test21(void)
+{
+    const char *src = "{\"skip\": [1, 2], \"keep\": {\"id\": 7, \"pi\": 3.25,"
+        " \"name\": \"short\", \"text\": \"a string longer than sixteen bytes\","
+        " \"m\": [[1, 2], [3, 4]], \"l\": [true, null, {}, [], {\"id\": 8}]}}";
+    const int flags[] = {0, JP_MATRIX, JP_RAWNUM | JP_INTERN | JP_DEDUP};
+    jdoc_t *jd = NULL;
+    char buf[512];
+    char *out;
+    bool ret = false;
+
+    jw_pretty_print(jw, 0, 0);
+    for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); f++) {
+        jp_set_flags(jp, flags[f]);
+        if (jp_parse(jp, &node, src, strlen(src)))
+            goto exit;
+        jnode_t *keep = jn_attr(node, "keep");
+        jw_begin(jw);
+        jw_node(jw, keep, NULL);
+        if (jw_get(jw, &out, NULL))
+            goto exit;
+        snprintf(buf, sizeof(buf), "%s", out);
+
+        if (jdoc_create(&jd, 0))
+            goto exit;
+        jnode_t *c = jn_clone(jd, keep);
+        jnode_t *c2 = jn_clone(jd, jn_elt(jn_attr(keep, "l"), 4));
+        if (c == NULL || c2 == NULL)
+            goto exit;
+
+        // parser memory is reused
+        if (jp_parse(jp, &node, "[0]", 3))
+            goto exit;
+
+        jw_begin(jw);
+        jw_node(jw, c, NULL);
+        if (jw_get(jw, &out, NULL) || strcmp(out, buf))
+            goto exit;
+        if (jn_attr(c, "id")->int_val != 7 || jn_attr(c2, "id")->int_val != 8)
+            goto exit;
+        if (c->attrs.names[0] != c2->attrs.names[0])
+            goto exit;
+        if (f == 1 && jn_ints(jn_attr(c, "m")) == NULL)
+            goto exit;
+        if (jn_elt(jn_elt(jn_attr(c, "m"), 1), 0)->int_val != 3)
+            goto exit;
+
+        jdoc_destroy(jd);
+        jd = NULL;
+    }
+    printf("%s: %s\n", __func__, buf);
+    ret = true;
+
+exit:
+    jdoc_destroy(jd);
+    jp_set_flags(jp, 0);
+    jw_pretty_print(jw, 2, 2);
+    return ret;
+}
+
+
+// Memory arenas for application data.
+static bool Test22(void)
+{
+    const char *src = "[\"alpha\", \"beta\", \"gamma\"]";
+    jdoc_t *jd = NULL;
+    jarena_t *ja = NULL;
+    bool ret = false;
+
+    // index of parsed strings in parser arena
+    if (jp_parse(jp, &node, src, strlen(src)))
+        goto exit;
+    const char **idx = jarena_alloc(jp_arena(jp), 3 * sizeof(idx[0]));
+    if (idx == NULL || ((uintptr_t)idx & (sizeof(void*) - 1)))
+        goto exit;
+    for (int i = 0; i < 3; i++)
+        idx[2 - i] = jn_elt(node, i)->str_val;
+    if (strcmp(idx[0], "gamma") || strcmp(jn_elt(node, 0)->str_val, "alpha"))
+        goto exit;
+
+    // document arena outlives parser memory
+    if (jdoc_create(&jd, 0))
+        goto exit;
+    char *s = jarena_strdup(jdoc_arena(jd), idx[1]);
+    if (s == NULL)
+        goto exit;
+    if (jp_parse(jp, &node, "[]", 2) || strcmp(s, "beta"))
+        goto exit;
+
+    // parser arena stays with parser when tree is taken by document
+    jarena_t *pa = jp_arena(jp);
+    jdoc_t *tmp;
+    if (jdoc_parse(&tmp, jp, src, strlen(src)))
+        goto exit;
+    jdoc_destroy(tmp);
+    if (jp_arena(jp) != pa || jarena_strdup(pa, "delta") == NULL)
+        goto exit;
+
+    // own arena
+    ja = jarena_create(0);
+    if (ja == NULL)
+        goto exit;
+    for (int n = 0; n < 2; n++) {
+        for (int i = 0; i < 10000; i++) {
+            int *p = jarena_alloc(ja, (size_t)(i % 100 + 1) * sizeof(int));
+            if (p == NULL)
+                goto exit;
+            p[i % 100] = i;
+        }
+        if (jarena_reset(ja))
+            goto exit;
+    }
+
+    printf("%s: %s\n", __func__, s);
+    ret = true;
+
+exit:
+    jarena_destroy(ja);
+    jdoc_destroy(jd);
+    return ret;
+}
+
+
+// Join callback: record pairs of names.
+static int join_cb(jnode_t *a, jnode_t *b, void *ctx)
+{
+    char *buf = ctx;
+    sprintf(buf + strlen(buf), "%s-%s ", jn_attr(a, "name")->str_val,
+        jn_attr(b, "name")->str_val);
+    return 0;
+}
+
+// Hash index on field of array of objects.
+static bool Test23(void)
+{
+    const char *src = "{\"events\": [{\"id\": 1, \"name\": \"e1\"},"
+        " {\"id\": \"2\", \"name\": \"e2\"}, {\"id\": 3, \"name\": \"e3\"},"
+        " {\"name\": \"e4\"}],"
+        " \"perfs\": [{\"eventId\": 1, \"name\": \"p1\"},"
+        " {\"eventId\": 3, \"name\": \"p2\"}, {\"eventId\": 1, \"name\": \"p3\"},"
+        " {\"eventId\": 2, \"name\": \"p4\"}, {\"eventId\": \"2\", \"name\": \"p5\"},"
+        " {\"name\": \"p6\"}, 7]}";
+    char buf[128] = "";
+
+    if (jp_parse(jp, &node, src, strlen(src)))
+        return false;
+    jnode_t *events = jn_attr(node, "events");
+    jnode_t *perfs = jn_attr(node, "perfs");
+
+    jindex_t *ji = jn_index_build(jp_arena(jp), perfs, "eventId");
+    if (ji == NULL)
+        return false;
+
+    // lookup by key made by caller
+    jnode_t key = {.type = JT_INT, .int_val = 1};
+    int i = jn_index_find(ji, &key);
+    if (i != 0 || (i = jn_index_next(ji, i)) != 2 || jn_index_next(ji, i) != -1)
+        return false;
+    key.int_val = 5;
+    if (jn_index_find(ji, &key) != -1)
+        return false;
+
+    if (jn_index_join(ji, events, "id", join_cb, buf))
+        return false;
+    printf("%s: %s\n", __func__, buf);
+    if (strcmp(buf, "e1-p1 e1-p3 e2-p5 e3-p2 "))
+        return false;
+
+    return true;
+}
+
+
+// Sort array and compare result with expected one.
+static bool sort_check(int pflags, const char *src, const char *path,
+    int flags, const char *res)
+{
+    char *out;
+
+    jp_set_flags(jp, pflags);
+    if (jp_parse(jp, &node, src, strlen(src)))
+        return false;
+    if (jn_sort(node, "", path, flags))
+        return false;
+
+    jw_begin(jw);
+    jw_node(jw, node, NULL);
+    if (jw_get(jw, &out, NULL))
+        return false;
+    printf("%s: %s\n", __func__, out);
+    return strcmp(out, res) == 0;
+}
+
+// Sorting of arrays.
+static bool Test24(void)
+{
+    const char *objs = "[{\"n\":\"a\",\"p\":3},{\"n\":\"b\",\"p\":-1},{\"n\":\"c\"},"
+        "{\"n\":\"d\",\"p\":3},{\"n\":\"e\",\"p\":100000}]";
+    const char *ints = "[{\"n\":\"a\",\"p\":3},{\"n\":\"b\",\"p\":-1},"
+        "{\"n\":\"d\",\"p\":3},{\"n\":\"e\",\"p\":100000}]";
+    bool ret = false;
+
+    jw_pretty_print(jw, 0, 0);
+
+    // keys of different types
+    if (!sort_check(0, objs, "/p", 0, "[{\"n\":\"c\"},{\"n\":\"b\",\"p\":-1},"
+            "{\"n\":\"a\",\"p\":3},{\"n\":\"d\",\"p\":3},{\"n\":\"e\",\"p\":100000}]"))
+        goto exit;
+    if (!sort_check(0, objs, "/p", JN_DESC, "[{\"n\":\"e\",\"p\":100000},"
+            "{\"n\":\"a\",\"p\":3},{\"n\":\"d\",\"p\":3},{\"n\":\"b\",\"p\":-1},{\"n\":\"c\"}]"))
+        goto exit;
+
+    // int keys
+    if (!sort_check(0, ints, "/p", 0, "[{\"n\":\"b\",\"p\":-1},{\"n\":\"a\",\"p\":3},"
+            "{\"n\":\"d\",\"p\":3},{\"n\":\"e\",\"p\":100000}]"))
+        goto exit;
+    if (!sort_check(0, ints, "/p", JN_DESC, "[{\"n\":\"e\",\"p\":100000},"
+            "{\"n\":\"a\",\"p\":3},{\"n\":\"d\",\"p\":3},{\"n\":\"b\",\"p\":-1}]"))
+        goto exit;
+
+    // string keys and numbers of different types
+    if (!sort_check(0, "[{\"m\":{\"s\":\"b\"}},{\"m\":{\"s\":\"ab\"}},{\"m\":{\"s\":\"a\"}}]",
+            "/m/s", 0, "[{\"m\":{\"s\":\"a\"}},{\"m\":{\"s\":\"ab\"}},{\"m\":{\"s\":\"b\"}}]"))
+        goto exit;
+    if (!sort_check(JP_DECIMAL, "[2, 1.5, -3, 1e1, 0.25]", "", 0,
+            "[-3,0.25,1.5,2,1e1]"))
+        goto exit;
+
+    // packed arrays
+    if (!sort_check(JP_PACK, "[3, 1, 2, -5]", "", JN_DESC, "[3,2,1,-5]"))
+        goto exit;
+    if (!sort_check(JP_MATRIX, "[[3, 1], [1, 2], [2, 0]]", "/1", 0,
+            "[[2,0],[3,1],[1,2]]"))
+        goto exit;
+    if (jn_elt(jn_elt(node, 1), 0)->int_val != 3)
+        goto exit;
+
+    // rows of matrix are kept, hashes of parents are cleared
+    jp_set_flags(jp, JP_MATRIX);
+    if (jp_parse(jp, &node, "{\"m\": [[1, 2], [3, 1]]}", 23))
+        goto exit;
+    unsigned int h = jn_hash(node, 0);
+    if (jp_parse(jp, &node, "{\"m\": [[3, 1], [1, 2]]}", 23))
+        goto exit;
+    jnode_t *m = jn_attr(node, "m");
+    jnode_t *row = jn_elt(m, 1);
+    if (jn_hash(node, 0) == h || jn_sort(node, "/m", "/0", 0)
+            || jn_elt(m, 0) != row || jn_elt(row, 0)->int_val != 1
+            || jn_ints(row)[1] != 2 || jn_hash(node, 0) != h)
+        goto exit;
+
+    // nested array
+    jp_set_flags(jp, 0);
+    if (jp_parse(jp, &node, "{\"k\": {\"a\": [1, 2]}}", 20))
+        goto exit;
+    h = jn_hash(node, 0);
+    if (jp_parse(jp, &node, "{\"k\": {\"a\": [2, 1]}}", 20))
+        goto exit;
+    if (jn_hash(node, 0) == h || jn_sort(node, "/k/a", "", 0)
+            || jn_hash(node, 0) != h || jn_sort(node, "/k/b", "", 0) == 0)
+        goto exit;
+
+    // shared arrays are not sorted
+    jp_set_flags(jp, JP_DEDUP);
+    const char *dup = "{\"x\": [2, 1], \"y\": [2, 1], \"z\": [4, 3]}";
+    if (jp_parse(jp, &node, dup, strlen(dup)))
+        goto exit;
+    if (jn_sort(node, "/y", "", 0) == 0 || jn_sort(node, "/x", "", 0) == 0
+            || jn_sort(node, "/z", "", 0)
+            || !is_node_int(jn_elt(jn_attr(node, "z"), 0), 3))
+        goto exit;
+
+    ret = true;
+
+exit:
+    jp_set_flags(jp, 0);
+    jw_pretty_print(jw, 2, 2);
+    return ret;
+}
+
+
+// Streaming aggregations.
+static bool Test25(void)
+{
+    const char *src =
+        "{\"items\": [{\"price\": 10, \"q\": [1, 2]}, {\"price\": 2.5},"
+        " {\"price\": \"n/a\"}, {\"cost\": 7, \"price\": -1}], \"total\": 3}\n"
+        "{\"items\": [{\"price\": 100, \"q\": [3]}], \"total\": 1}\n";
+    jagg_t *ja = NULL;
+    bool ret = false;
+
+    if (jagg_create(&ja))
+        goto exit;
+    int price = jagg_add(ja, "/items/*/price", JAGG_COUNT | JAGG_SUM
+        | JAGG_MIN | JAGG_MAX | JAGG_AVG);
+    int q = jagg_add(ja, "/items/*/q/*", JAGG_SUM);
+    int first = jagg_add(ja, "/items/0/price", JAGG_SUM);
+    int total = jagg_add(ja, "/total", JAGG_COUNT);
+    if (price < 0 || q < 0 || first < 0 || total < 0)
+        goto exit;
+    if (jagg_hist(ja, price, 0, 20, 4))
+        goto exit;
+
+    // input is given by parts
+    size_t half = (size_t)(strchr(src, '\n') - src);
+    if (jagg_run(ja, src, half) || jagg_run(ja, src + half, strlen(src) - half))
+        goto exit;
+
+    printf("%s: count %g, sum %g, min %g, max %g, avg %g\n", __func__,
+        jagg_get(ja, price, JAGG_COUNT), jagg_get(ja, price, JAGG_SUM),
+        jagg_get(ja, price, JAGG_MIN), jagg_get(ja, price, JAGG_MAX),
+        jagg_get(ja, price, JAGG_AVG));
+    if (jagg_get(ja, price, JAGG_COUNT) != 4
+            || jagg_get(ja, price, JAGG_SUM) != 111.5
+            || jagg_get(ja, price, JAGG_MIN) != -1
+            || jagg_get(ja, price, JAGG_MAX) != 100)
+        goto exit;
+    if (jagg_get(ja, q, JAGG_SUM) != 6 || jagg_get(ja, q, JAGG_COUNT) != 0)
+        goto exit;
+    if (jagg_get(ja, first, JAGG_SUM) != 110)
+        goto exit;
+    if (jagg_get(ja, total, JAGG_COUNT) != 2)
+        goto exit;
+
+    int bins;
+    const long *h = jagg_bins(ja, price, &bins);
+    if (h == NULL || bins != 4 || h[0] != 2 || h[1] != 0 || h[2] != 1
+            || h[3] != 1)
+        goto exit;
+
+    // numbers end with given part even if text continues
+    int root = jagg_add(ja, "", JAGG_SUM);
+    jagg_reset(ja);
+    if (root < 0 || jagg_run(ja, "2.5e17", 5) || jagg_run(ja, "12", 1)
+            || jagg_get(ja, root, JAGG_SUM) != 26)
+        goto exit;
+
+    // invalid json
+    jagg_reset(ja);
+    if (jagg_run(ja, "[1, 2", 5) == 0 || jagg_run(ja, "{\"a\" 1}", 7) == 0)
+        goto exit;
+
+    ret = true;
+
+exit:
+    jagg_destroy(ja);
+    return ret;
+}
+
+
+// Pre-filter of json by attribute value.
+static bool Test26(void)
+{
+    static const struct {
+        const char *json;
+        bool level; // has "level": "error"
+        bool code; // has "code": 5
+    } recs[] = {
+        {"{\"level\":\"error\",\"code\":5}", true, true},
+        {"{ \"msg\": \"x\", \"level\" : \"error\" }", true, false},
+        {"{\"level\":\"errors\",\"code\":55}", false, false},
+        {"{\"msg\":\"\\\"level\\\":\\\"error\\\"\",\"code\":5.0}", false, false},
+        {"{\"a\":{\"b\":[{\"level\":\"error\"}]},\"code\":5}", true, true},
+        {"{\"tag\":\"level\",\"x\":\"error\",\"code\": 5 }", false, true},
+        {"[\"level\", \"error\"]", false, false},
+        {"{\"v\":\"level\",\"level\":\"error\"}", true, false},
+    };
+    jfilter_t *fl = NULL, *fc = NULL, *fk = NULL;
+    bool ret = false;
+
+    if (jfilter_create(&fl, "level", "\"error\"") || jfilter_create(&fc, "code", "5")
+            || jfilter_create(&fk, "code", NULL))
+        goto exit;
+
+    int cnt = 0;
+    for (size_t i = 0; i < sizeof(recs) / sizeof(recs[0]); i++) {
+        const char *j = recs[i].json;
+        if (jfilter_match(fl, j, strlen(j)) != recs[i].level
+                || jfilter_match(fc, j, strlen(j)) != recs[i].code)
+            goto exit;
+        cnt += jfilter_match(fk, j, strlen(j));
+    }
+    printf("%s: %d\n", __func__, cnt);
+    if (cnt != 5)
+        goto exit;
+
+    ret = true;
+
+exit:
+    jfilter_destroy(fl);
+    jfilter_destroy(fc);
+    jfilter_destroy(fk);
+    return ret;
+}
+
+
+// Flatten json to "path=value;" string using small batches.
+static bool flat_check(jflat_t *jf, const char *j, int cnt, size_t size,
+    const char *expect)
+{
+    jleaf_t leaves[8];
+    char buf[256], out[1024];
+    size_t len = 0;
+    int n;
+
+    jflat_begin(jf, j, strlen(j));
+    while ((n = jflat_next(jf, leaves, cnt, buf, size)) > 0) {
+        for (int i = 0; i < n; i++) {
+            jnode_t *v = &leaves[i].value;
+            len += sprintf(out + len, "%s=", leaves[i].path);
+            if (v->type == JT_NULL)
+                len += sprintf(out + len, "null");
+            else if (v->type == JT_BOOL)
+                len += sprintf(out + len, "%s", v->bool_val ? "true" : "false");
+            else if (v->type == JT_INT)
+                len += sprintf(out + len, "%d", v->int_val);
+            else if (v->type == JT_DBL)
+                len += sprintf(out + len, "%g", v->dbl_val);
+            else if (v->type == JT_STR)
+                len += sprintf(out + len, "'%s'", v->str_val);
+            else
+                len += sprintf(out + len, v->type == JT_ARR ? "[]" : "{}");
+            out[len++] = ';';
+        }
+    }
+    out[len] = 0;
+    printf("%s: %s\n", __func__, out);
+    return n == 0 && strcmp(out, expect) == 0;
+}
+
+
+// Flattening of json into path/value pairs.
+static bool Test27(void)
+{
+    static const char j[] = "{\"id\": 7, \"user\": {\"name\": \"A\\tc\","
+        " \"tags\": [\"x\", \"y\"]}, \"pos\": [[1.5, null], []], \"a\\\"b\": {},"
+        " \"ok\": true}";
+    jflat_t *jf = NULL, *jb = NULL;
+    bool ret = false;
+
+    if (jflat_create(&jf, NULL, 0) || jflat_create(&jb, "/", JFLAT_BRACKETS))
+        goto exit;
+
+    // whole document at once and one leaf per call
+    const char *expect = "id=7;user.name='A\tc';user.tags.0='x';"
+        "user.tags.1='y';pos.0.0=1.5;pos.0.1=null;pos.1=[];a\"b={};ok=true;";
+    if (!flat_check(jf, j, 8, 256, expect) || !flat_check(jf, j, 1, 256, expect)
+            || !flat_check(jf, j, 8, 24, expect))
+        goto exit;
+
+    // brackets and custom separator
+    if (!flat_check(jb, j, 8, 256, "id=7;user/name='A\tc';user/tags[0]='x';"
+            "user/tags[1]='y';pos[0][0]=1.5;pos[0][1]=null;pos[1]=[];"
+            "a\"b={};ok=true;"))
+        goto exit;
+
+    // stream of values
+    if (!flat_check(jb, "[10, {\"k\": false}]\n\"s\"\n{\"z\": [{}]}", 8, 256,
+            "[0]=10;[1]/k=false;='s';z[0]={};"))
+        goto exit;
+
+    // leaf too big for buffer and invalid json
+    jleaf_t leaves[2];
+    char buf[256];
+    jflat_begin(jf, j, sizeof(j) - 1);
+    if (jflat_next(jf, leaves, 2, buf, 2) != -1)
+        goto exit;
+    jflat_begin(jf, "[1, 2", 5);
+    if (jflat_next(jf, leaves, 2, buf, sizeof(buf)) != 2
+            || jflat_next(jf, leaves, 2, buf, sizeof(buf)) != -1)
+        goto exit;
+
+    ret = true;
+
+exit:
+    jflat_destroy(jf);
+    jflat_destroy(jb);
+    return ret;
+}
+
+
+// Convert json to CSV text using output buffer of given size.
+static bool csv_check(jcsv_t *jc, const char *j, size_t size,
+    const char *expect)
+{
+    char buf[256], out[1024];
+    size_t len, olen = 0;
+    int res;
+
+    jcsv_begin(jc, j, strlen(j));
+    while ((res = jcsv_next(jc, buf, size, &len)) > 0) {
+        memcpy(out + olen, buf, len);
+        olen += len;
+    }
+    out[olen] = 0;
+    printf("%s:\n%s", __func__, out);
+    return res == 0 && strcmp(out, expect) == 0;
+}
+
+
+// Conversion of json to CSV.
+static bool Test28(void)
+{
+    static const char j[] = "[{\"id\": 1, \"name\": \"Ann\", \"addr\": "
+        "{\"city\": \"Oslo\"}, \"tags\": [\"a\", \"b\"]},\n"
+        " {\"name\": \"Bob \\\"B\\\", Jr.\", \"id\": 2.5, \"x\": [{}]},\n"
+        " {\"id\": null, \"addr\": {\"city\": \"New\\nYork\", \"zip\": 1},"
+        " \"name\": true}]";
+    jcsv_t *jc = NULL, *jt = NULL;
+    bool ret = false;
+
+    if (jcsv_create(&jc, ',', JCSV_HEADER) || jcsv_create(&jt, '\t', 0))
+        goto exit;
+    if (jcsv_add(jc, "/id") != 0 || jcsv_add(jc, "/name") != 1
+            || jcsv_add(jc, "/addr/city") != 2 || jcsv_add(jc, "/tags") != 3
+            || jcsv_add(jt, "/name") != 0 || jcsv_add(jt, "/id") != 1
+            || jcsv_add(jc, "name") != -1)
+        goto exit;
+
+    // big buffer and buffer for one row
+    const char *expect = "id,name,addr/city,tags\n"
+        "1,Ann,Oslo,\"[\"\"a\"\", \"\"b\"\"]\"\n"
+        "2.5,\"Bob \"\"B\"\", Jr.\",,\n"
+        ",true,\"New\nYork\",\n";
+    if (!csv_check(jc, j, 256, expect) || !csv_check(jc, j, 30, expect))
+        goto exit;
+
+    // TSV of object stream
+    if (!csv_check(jt, "{\"id\": 1, \"name\": \"a,b\"}\n{\"name\": \"c\\td\"}",
+            256, "a,b\t1\n\"c\td\"\t\n"))
+        goto exit;
+
+    // row too big for buffer and row which is not an object
+    char buf[256];
+    size_t len;
+    jcsv_begin(jc, j, sizeof(j) - 1);
+    if (jcsv_next(jc, buf, 10, &len) != -1)
+        goto exit;
+    jcsv_begin(jt, "[{\"id\": 1}, 2]", 14);
+    if (jcsv_next(jt, buf, sizeof(buf), &len) != 1 || len != 3
+            || jcsv_next(jt, buf, sizeof(buf), &len) != -1)
+        goto exit;
+
+    // bad row ends conversion, it is not retried by next call
+    jcsv_begin(jt, "[{\"id\": 1}, 5, {\"id\": 2}]", 25);
+    if (jcsv_next(jt, buf, sizeof(buf), &len) != 1 || len != 3
+            || jcsv_next(jt, buf, sizeof(buf), &len) != -1 || len != 0
+            || jcsv_next(jt, buf, sizeof(buf), &len) != -1)
+        goto exit;
+
+    ret = true;
+
+exit:
+    jcsv_destroy(jc);
+    jcsv_destroy(jt);
+    return ret;
+}
+
+
+// Iteration over elements of json array.
+static bool Test29(void)
+{
+    static const char j[] = " [ {\"id\": 1, \"tags\": [1, 2]},\n"
+        "{\"id\": 2, \"tags\": []}, 3, \"s\", [{\"id\": 4}] ] ";
+    bool ret = false;
+    jnode_t *n;
+    int res, cnt = 0, sum = 0;
+    const char *name = NULL;
+    char *kept = NULL;
+
+    jp_set_flags(jp, JP_PACK);
+    if (jp_iter_begin(jp, j, sizeof(j) - 1))
+        goto exit;
+    while ((res = jp_iter_next(jp, &n)) > 0) {
+        // application data is kept for all elements
+        if (cnt++ == 0 && (kept = jarena_strdup(jp_arena(jp), "kept")) == NULL)
+            goto exit;
+        if (n->type == JT_OBJ) {
+            // names are shared by elements
+            if (name && name != n->attrs.names[0])
+                goto exit;
+            name = n->attrs.names[0];
+            sum += jn_attr(n, "id")->int_val + jn_attr(n, "tags")->elts.count;
+        } else if (n->type == JT_INT) {
+            sum += n->int_val;
+        } else if (n->type == JT_ARR) {
+            sum += jn_attr(jn_elt(n, 0), "id")->int_val;
+        }
+    }
+    printf("%s: %d elements, sum %d\n", __func__, cnt, sum);
+    if (res != 0 || cnt != 5 || sum != 1 + 2 + 2 + 0 + 3 + 4
+            || jp_iter_next(jp, &n) != 0 || strcmp(kept, "kept"))
+        goto exit;
+
+    // empty array and invalid arrays
+    if (jp_iter_begin(jp, "[ ]", 3) || jp_iter_next(jp, &n) != 0
+            || jp_iter_begin(jp, "{}", 2) == 0)
+        goto exit;
+    static const char *bad[] = {"[1 2]", "[1,]", "[,1]", "[1] 2", "[{]"};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        if (jp_iter_begin(jp, bad[i], strlen(bad[i])))
+            goto exit;
+        while ((res = jp_iter_next(jp, &n)) > 0)
+            ;
+        if (res != -1)
+            goto exit;
+    }
+
+    // parser works as usual after iteration
+    if (jp_parse(jp, &n, "{\"a\": 1}", 8) || jn_attr(n, "a")->int_val != 1)
+        goto exit;
+
+    ret = true;
+
+exit:
+    jp_set_flags(jp, 0);
+    return ret;
+}
+
+
+// Offset index of json elements.
+static bool Test30(void)
+{
+    static const char j[] = "[{\"id\": 1}, \"a,]\" , -2.5e3,[[],{}], null ]\n";
+    static const char *file = "test30.json";
+    static const char *ifile = "test30.json.idx";
+    joffs_t *jo = NULL, *jl = NULL;
+    jfile_t *jf = NULL;
+    bool ret = false;
+    size_t pos, len;
+    jnode_t *n;
+
+    // spans of array elements and of root values
+    if (joffs_build(&jo, j, sizeof(j) - 1) || joffs_count(jo) != 5
+            || joffs_span(jo, 1, &pos, &len) || pos != 12 || len != 5
+            || joffs_span(jo, 3, &pos, &len) || memcmp(j + pos, "[[],{}]", len)
+            || joffs_span(jo, 5, &pos, &len) == 0)
+        goto exit;
+    joffs_destroy(jo);
+    jo = NULL;
+    if (joffs_build(&jo, "{\"a\":1}\n2\n\"x\"\n", 14) || joffs_count(jo) != 3
+            || joffs_span(jo, 2, &pos, &len) || pos != 10 || len != 3)
+        goto exit;
+    joffs_destroy(jo);
+    jo = NULL;
+    if (joffs_build(&jo, "[1 2]", 5) == 0 || joffs_build(&jo, "[[1]", 4) == 0)
+        goto exit;
+
+    // saving and loading
+    FILE *f = fopen(file, "wb");
+    if (f == NULL || fwrite(j, sizeof(j) - 1, 1, f) != 1 || fclose(f))
+        goto exit;
+    if (joffs_build(&jo, j, sizeof(j) - 1) || joffs_save(jo, ifile)
+            || joffs_load(&jl, ifile, sizeof(j) - 1) || joffs_count(jl) != 5
+            || joffs_span(jl, 4, &pos, &len) || memcmp(j + pos, "null", len))
+        goto exit;
+    joffs_destroy(jl);
+    jl = NULL;
+    if (joffs_load(&jl, ifile, 10) == 0)
+        goto exit;
+    remove(ifile);
+
+    // random access to elements of memory mapped file
+    for (int k = 0; k < 2; k++) {
+        if (jfile_open(&jf, file) || jfile_count(jf) != 5
+                || jfile_parse(jf, jp, 3, &n) || n->type != JT_ARR || n->elts.count != 2
+                || jn_elt(n, 1)->type != JT_OBJ
+                || jfile_parse(jf, jp, 0, &n) || jn_attr(n, "id")->int_val != 1
+                || jfile_parse(jf, jp, 5, &n) == 0)
+            goto exit;
+        jfile_close(jf);
+        jf = NULL;
+    }
+    if (joffs_load(&jl, ifile, sizeof(j) - 1))
+        goto exit;
+    joffs_destroy(jl);
+    jl = NULL;
+
+    // index with span out of file is not loaded (offsets follow header)
+    f = fopen(ifile, "r+b");
+    if (f == NULL || fseek(f, -12 * 5, SEEK_END)
+            || fwrite("\xff\xff\xff\xff\xff\xff\xff\x7f", 8, 1, f) != 1
+            || fclose(f) || joffs_load(&jl, ifile, 0) == 0)
+        goto exit;
+
+    // rewrite of file with the same size makes index stale
+    static const char j2[] = "[{\"id\":1},\"a,]\"   , -2.5e3,[[],{}], null ]\n";
+    struct utimbuf ut = {0, 1000000};
+    if (jfile_open(&jf, file))
+        goto exit;
+    jfile_close(jf);
+    jf = NULL;
+    f = fopen(file, "wb");
+    if (f == NULL || fwrite(j2, sizeof(j2) - 1, 1, f) != 1 || fclose(f)
+            || utime(file, &ut) || jfile_open(&jf, file)
+            || jfile_parse(jf, jp, 1, &n) || !is_node_str(n, "a,]"))
+        goto exit;
+
+    ret = true;
+
+exit:
+    joffs_destroy(jo);
+    joffs_destroy(jl);
+    jfile_close(jf);
+    remove(file);
+    remove(ifile);
+    return ret;
+}
+
+
+// Cache of parsed documents.
+static bool Test31(void)
+{
+    static const char *j[] = {"{\"a\": [1, 2, 3]}", "{\"a\": [1, 2, 4]}",
+        "[\"x\"]"};
+    jparser_t *p = NULL;
+    jcache_t *jc = NULL;
+    jdoc_t *d[4] = {NULL}, *dn[2] = {NULL};
+    bool ret = false;
+
+    // memory of documents is about 32K with minimal arenas
+    if (jp_create(&p, 0, 0) || jcache_create(&jc, 80 * 1024))
+        goto exit;
+
+    // equal strings give the same document
+    char buf[32];
+    strcpy(buf, j[0]);
+    if (jcache_parse(jc, p, &d[0], j[0], strlen(j[0]))
+            || jcache_parse(jc, p, &d[1], buf, strlen(buf)) || d[0] != d[1]
+            || jcache_parse(jc, p, &d[2], j[1], strlen(j[1])) || d[2] == d[0])
+        goto exit;
+    jnode_t *a = jn_attr(jdoc_root(d[0]), "a");
+    jnode_t *b = jn_attr(jdoc_root(d[2]), "a");
+    if (jn_elt(a, 2)->int_val != 3 || jn_elt(b, 2)->int_val != 4)
+        goto exit;
+    jdoc_destroy(d[1]);
+    d[1] = NULL;
+
+    // least recently used document is evicted, but stays valid while used
+    if (jcache_parse(jc, p, &d[1], j[1], strlen(j[1])) || d[1] != d[2]
+            || jcache_parse(jc, p, &d[3], j[2], strlen(j[2])))
+        goto exit;
+    jdoc_destroy(d[1]);
+    d[1] = NULL;
+    if (jcache_parse(jc, p, &d[1], j[1], strlen(j[1])) || d[1] != d[2])
+        goto exit;
+    jdoc_destroy(d[1]);
+    d[1] = NULL;
+    if (jcache_parse(jc, p, &d[1], j[0], strlen(j[0])) || d[1] == d[0]
+            || jn_elt(a, 2)->int_val != 3)
+        goto exit;
+
+    // documents are not changed by parsing of invalid json
+    if (jcache_parse(jc, p, &d[1], "[1,", 3) == 0
+            || !is_node_str(jn_elt(jdoc_root(d[3]), 0), "x"))
+        goto exit;
+
+    // parser flags are part of cache key
+    if (jcache_parse(jc, p, &dn[0], "[1.5]", 5))
+        goto exit;
+    jp_set_flags(p, JP_DECIMAL);
+    if (jcache_parse(jc, p, &dn[1], "[1.5]", 5) || dn[1] == dn[0]
+            || jn_elt(jdoc_root(dn[1]), 0)->type != JT_DEC)
+        goto exit;
+
+    ret = true;
+
+exit:
+    for (int i = 0; i < 4; i++)
+        jdoc_destroy(d[i]);
+    jdoc_destroy(dn[0]);
+    jdoc_destroy(dn[1]);
+    jcache_destroy(jc);
+    jp_destroy(p);
+    return ret;
+}
+
+
+// Edit text of document and compare it with parsed edited text.
+static bool reparse_check(jdoc_t *jd, const char *find, const char *text)
+{
+    size_t len;
+    const char *s = jdoc_text(jd, &len);
+    const char *f = strstr(s, find);
+    if (f == NULL || jp_reparse(jp, jd, (size_t)(f - s), strlen(find), text,
+            strlen(text)))
+        return false;
+
+    s = jdoc_text(jd, &len);
+    printf("%s: %s\n", __func__, s);
+    return jp_parse(jp, &node, s, len) == 0
+        && jn_equal(jdoc_root(jd), node, 0);
+}
+
+
+// Incremental reparsing of edited documents.
+static bool Test32(void)
+{
+    static const char j[] = "{\"a\": [1, 2, {\"b\": \"x\"}], \"c\": {\"d\":"
+        " [true]}, \"m\": [[1, 2], [3, 4]], \"e\": 5}";
+    jdoc_t *jd = NULL;
+    bool ret = false;
+
+    jp_set_flags(jp, JP_MATRIX);
+    if (jdoc_parse_text(&jd, jp, j, sizeof(j) - 1))
+        goto exit;
+    jnode_t *root = jdoc_root(jd);
+    jnode_t *a = jn_attr(root, "a");
+    jnode_t *c = jn_attr(root, "c");
+
+    // only the smallest container is replaced
+    if (!reparse_check(jd, "\"x\"", "\"yy\"")
+            || jdoc_root(jd) != root || jn_attr(root, "a") != a
+            || jn_attr(root, "c") != c
+            || !is_node_str(jn_attr(jn_elt(a, 2), "b"), "yy"))
+        goto exit;
+
+    // offsets after edited part are adjusted
+    if (!reparse_check(jd, "true", "false") || jn_attr(root, "c") != c
+            || jn_attr(root, "a") != a || !reparse_check(jd, "5}", "[6]}")
+            || !reparse_check(jd, "[3, 4]", "[3, 4, 5]")
+            || !reparse_check(jd, ", 2, {", ", 20, {"))
+        goto exit;
+
+    // edit which makes container invalid is parsed by parent
+    if (!reparse_check(jd, "20", "2], \"z\": [3")
+            || jn_attr(jdoc_root(jd), "z")->elts.count != 2)
+        goto exit;
+
+    // invalid edit does not change document
+    size_t len;
+    const char *s = jdoc_text(jd, &len);
+    char buf[256];
+    strcpy(buf, s);
+    if (jp_reparse(jp, jd, 0, 1, "[", 1) == 0
+            || jp_reparse(jp, jd, 5, 1, "}", 1) == 0
+            || jp_reparse(jp, jd, len, 1, "", 0) == 0
+            || strcmp(jdoc_text(jd, &len), buf) != 0)
+        goto exit;
+
+    // whole text is parsed if root changes
+    if (!reparse_check(jd, buf, "[1, {\"q\": [2]}]")
+            || !reparse_check(jd, "2", "{}")
+            || !reparse_check(jd, "{}]", "{}, 3]"))
+        goto exit;
+
+    // memory of replaced nodes is released by parsing of whole text,
+    // application data is kept
+    char *kept = jarena_strdup(jdoc_arena(jd), "kept");
+    root = jdoc_root(jd);
+    for (int i = 0; i < 100 && jdoc_root(jd) == root; i++) {
+        s = jdoc_text(jd, &len);
+        const char *f = strstr(s, "3]");
+        if (f == NULL || jp_reparse(jp, jd, (size_t)(f - s), 1, "3", 1))
+            goto exit;
+    }
+    if (kept == NULL || jdoc_root(jd) == root || strcmp(kept, "kept")
+            || !reparse_check(jd, "3]", "7]"))
+        goto exit;
+
+    ret = true;
+
+exit:
+    jp_set_flags(jp, 0);
+    jdoc_destroy(jd);
+    return ret;
+}
+
+
+// Reader of json from memory by parts of given size.
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t part;
+} part_reader;
+
+static size_t part_read(void *ctx, char *buf, size_t size)
+{
+    part_reader *r = ctx;
+    size_t n = r->len < r->part ? r->len : r->part;
+    if (n > size)
+        n = size;
+    memcpy(buf, r->data, n);
+    r->data += n;
+    r->len -= n;
+    return n;
+}
+
+static size_t fail_read(void *ctx, char *buf, size_t size)
+{
+    (void)ctx;
+    (void)buf;
+    (void)size;
+    return (size_t)-1;
+}
+
+// Reader of json head, filler bytes and json tail counting bytes read.
+typedef struct {
+    const char *head;
+    size_t fill;
+    const char *tail;
+    size_t nread;
+} fill_reader;
+
+static size_t fill_read(void *ctx, char *buf, size_t size)
+{
+    fill_reader *r = ctx;
+    size_t n = 0;
+    while (n < size && *r->head)
+        buf[n++] = *r->head++;
+    size_t k = size - n < r->fill ? size - n : r->fill;
+    memset(buf + n, ' ', k);
+    r->fill -= k;
+    n += k;
+    while (n < size && !r->fill && *r->tail)
+        buf[n++] = *r->tail++;
+    r->nread += n;
+    return n;
+}
+
+#if JSON_ZLIB == 1
+// Compress data to gzip member.
+static size_t gzip_data(const char *data, size_t len, char *buf, size_t size)
+{
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY))
+        return 0;
+    z.next_in = (Bytef*)data;
+    z.avail_in = (uInt)len;
+    z.next_out = (Bytef*)buf;
+    z.avail_out = (uInt)size;
+    int r = deflate(&z, Z_FINISH);
+    deflateEnd(&z);
+    return (r == Z_STREAM_END) ? size - z.avail_out : 0;
+}
+#endif
+
+
+// Parsing of json read by parts and of compressed json.
+static bool Test33(void)
+{
+    static const char *files[] = {"data/twitter.json", "data/citm_catalog.json",
+        "data/canada.json"};
+    static const size_t parts[] = {1, 7, 100000};
+    jparser_t *p = NULL;
+    char *data = NULL, *zbuf = NULL;
+    bool ret = false;
+    jnode_t *n;
+
+    if (jp_create(&p, 0, 0))
+        goto exit;
+    jp_set_flags(jp, JP_PACK);
+    jp_set_flags(p, JP_PACK);
+
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        size_t len;
+        free(data);
+        data = read_file_to_mem(files[i], &len);
+        if (data == NULL || jp_parse(jp, &node, data, len))
+            goto exit;
+
+        // tokens are split between parts in all possible ways
+        for (size_t k = 0; k < sizeof(parts) / sizeof(parts[0]); k++) {
+            if (i && parts[k] == 1)
+                continue;
+            part_reader r = {data, len, parts[k]};
+            if (jp_parse_read(p, &n, part_read, &r) || !jn_equal(n, node, 0))
+                goto exit;
+        }
+
+#if JSON_ZLIB == 1
+        // two gzip members
+        size_t zsize = len + 1024;
+        free(zbuf);
+        zbuf = malloc(zsize);
+        if (zbuf == NULL)
+            goto exit;
+        size_t z1 = gzip_data(data, len / 2, zbuf, zsize);
+        size_t z2 = gzip_data(data + len / 2, len - len / 2, zbuf + z1,
+            zsize - z1);
+        if (z1 == 0 || z2 == 0 || jp_parse_gzip(p, &n, zbuf, z1 + z2)
+                || !jn_equal(n, node, 0))
+            goto exit;
+        printf("%s: %s gzip %zu -> %zu\n", __func__, files[i], z1 + z2, len);
+
+        // truncated and damaged data
+        if (jp_parse_gzip(p, &n, zbuf, z1 + z2 - 10) == 0)
+            goto exit;
+        zbuf[z1 / 2] ^= 0x55;
+        if (jp_parse_gzip(p, &n, zbuf, z1 + z2) == 0)
+            goto exit;
+#endif
+
+#if JSON_ZSTD == 1
+        size_t zs = ZSTD_compressBound(len);
+        free(zbuf);
+        zbuf = malloc(zs);
+        if (zbuf == NULL)
+            goto exit;
+        zs = ZSTD_compress(zbuf, zs, data, len, 3);
+        if (ZSTD_isError(zs) || jp_parse_zstd(p, &n, zbuf, zs)
+                || !jn_equal(n, node, 0)
+                || jp_parse_zstd(p, &n, zbuf, zs - 10) == 0)
+            goto exit;
+        printf("%s: %s zstd %zu -> %zu\n", __func__, files[i], zs, len);
+#endif
+    }
+
+    // numbers at end of window are not mixed with text of previous json
+    part_reader r1 = {"123456", 6, 100};
+    part_reader r2 = {"9", 1, 100};
+    part_reader r3 = {"[7.25e1]", 8, 100};
+    part_reader r4 = {"1.5", 3, 100};
+    if (jp_parse_read(p, &n, part_read, &r1) || !is_node_int(n, 123456)
+            || jp_parse_read(p, &n, part_read, &r2) || !is_node_int(n, 9)
+            || jp_parse_read(p, &n, part_read, &r3)
+            || !is_node_dbl(jn_elt(n, 0), 72.5)
+            || jp_parse_read(p, &n, part_read, &r4) || !is_node_dbl(n, 1.5))
+        goto exit;
+
+    // invalid json and error of reading
+    part_reader r = {"[1, 2", 5, 2};
+    if (jp_parse_read(p, &n, part_read, &r) == 0
+            || jp_parse_read(p, &n, fail_read, NULL) == 0)
+        goto exit;
+
+    // error in the middle of window does not read the rest of json
+    fill_reader f1 = {"[@", 64 << 20, "]", 0};
+    if (jp_parse_read(p, &n, fill_read, &f1) == 0 || f1.nread > (1 << 20))
+        goto exit;
+
+    // blanks longer than window between tokens
+    fill_reader f2 = {"[1,", 1 << 20, "2]", 0};
+    if (jp_parse_read(p, &n, fill_read, &f2) || n->type != JT_ARR
+            || n->elts.count != 2 || !is_node_int(jn_elt(n, 1), 2))
+        goto exit;
+
+    ret = true;
+
+exit:
+    jp_set_flags(jp, 0);
+    free(data);
+    free(zbuf);
+    jp_destroy(p);
+    return ret;
+}
+
+
 /*****************************************************************************
 * List of all test functions.
 *****************************************************************************/
@@ -435,7 +2276,14 @@ static bool Test8(void)
 typedef bool (*test_f)(void);
 static test_f tests[] = {
     Test1, Test2, Test3, Test4,
-    Test5, Test6, Test7, Test8
+    Test5, Test6, Test7, Test8,
+    Test9, Test10, Test11, Test12,
+    Test13, Test14, Test15, Test16,
+    Test17, Test18, Test19, Test20,
+    Test21, Test22, Test23, Test24,
+    Test25, Test26, Test27, Test28,
+    Test29, Test30, Test31, Test32,
+    Test33
 };
 
 